@@ -103,7 +103,14 @@ else
         RPATH="$RPATH:$EXTERNAL/raylib/lib"
     fi
 
-    gcc src/main.c src/processor.c \
+    # Optional allocator: ALLOCATOR=mimalloc|jemalloc (default: system malloc)
+    ALLOC_FLAGS=""
+    case "${ALLOCATOR:-}" in
+        mimalloc) ALLOC_FLAGS="-DUSE_MIMALLOC $(pkg-config --cflags --libs mimalloc 2>/dev/null || echo -lmimalloc)" ;;
+        jemalloc) ALLOC_FLAGS="-DUSE_JEMALLOC $(pkg-config --cflags --libs jemalloc 2>/dev/null || echo -ljemalloc)" ;;
+    esac
+
+    gcc src/main.c src/processor.c src/daemon.c $ALLOC_FLAGS \
         $(pkg-config --cflags vips) $VIPS_CFLAGS_EXTRA $RAYLIB_CFLAGS \
         -Iinclude \
         -o build/compressor \
@@ -57,6 +57,13 @@ if %ERRORLEVEL% NEQ 0 (
     exit /b 1
 )
 
+echo Step 1b: Compiling daemon.c (Debug)...
+gcc -m64 -c src/daemon.c -o build/daemon_debug.o -Iinclude -g
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile daemon.c
+    exit /b 1
+)
+
 echo Step 2: Compiling main.c (Debug)...
 gcc -m64 -c src/main.c -o build/main_debug.o %RAYLIB_CFLAGS% -Iinclude -g
 if %ERRORLEVEL% NEQ 0 (
@@ -65,7 +72,7 @@ if %ERRORLEVEL% NEQ 0 (
 )
 
 echo Step 3: Linking (Debug Mode)...
-gcc -m64 build/main_debug.o build/processor_debug.o -o build/compressor_debug.exe %VIPS_LIBS% %RAYLIB_LIBS% -lgdi32 -lwinmm -lopengl32 -lpthread -lpsapi -static-libgcc -static-libstdc++
+gcc -m64 build/main_debug.o build/processor_debug.o build/daemon_debug.o -o build/compressor_debug.exe %VIPS_LIBS% %RAYLIB_LIBS% -lgdi32 -lwinmm -lopengl32 -lpthread -lpsapi -static-libgcc -static-libstdc++
 if %ERRORLEVEL% NEQ 0 (
     echo ERROR: Failed to link
     exit /b 1
@@ -109,4 +116,4 @@ echo Run: build\compressor_debug.exe
 echo.
 
 REM Cleanup
-del build\main_debug.o build\processor_debug.o 2>nul
+del build\main_debug.o build\processor_debug.o build\daemon_debug.o 2>nul
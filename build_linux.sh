@@ -129,14 +129,25 @@ if [ -d "$LIBVIPS_DIR/lib/glib-2.0/include" ]; then
     VIPS_CFLAGS="$VIPS_CFLAGS -I$LIBVIPS_DIR/lib/glib-2.0/include"
 fi
 
+# Optional allocator: ALLOCATOR=mimalloc|jemalloc (default: system malloc)
+ALLOC_FLAGS=""
+case "${ALLOCATOR:-}" in
+    mimalloc) ALLOC_FLAGS="-DUSE_MIMALLOC $(pkg-config --cflags --libs mimalloc 2>/dev/null || echo -lmimalloc)" ;;
+    jemalloc) ALLOC_FLAGS="-DUSE_JEMALLOC $(pkg-config --cflags --libs jemalloc 2>/dev/null || echo -ljemalloc)" ;;
+    "") ;;
+    *) echo "ERROR: unknown ALLOCATOR '${ALLOCATOR}' (use mimalloc or jemalloc)"; exit 1 ;;
+esac
+
 echo "Building with vendored dependencies..."
 echo "RAYLIB_DIR: $RAYLIB_DIR"
 echo "LIBVIPS_DIR: $LIBVIPS_DIR"
 echo "VIPS_CFLAGS: $VIPS_CFLAGS"
 echo "VIPS_LIBS:   $VIPS_LIBS"
+echo "ALLOCATOR:   ${ALLOCATOR:-system}"
 echo ""
 
-gcc src/main.c src/processor.c -o "$BUILD_DIR/compressor" \
+gcc src/main.c src/processor.c src/daemon.c -o "$BUILD_DIR/compressor" \
+    $ALLOC_FLAGS \
     $VIPS_CFLAGS \
     -Iinclude \
     -I"$RAYLIB_DIR/include" \
@@ -146,6 +157,33 @@ gcc src/main.c src/processor.c -o "$BUILD_DIR/compressor" \
     -Wl,-rpath,'$ORIGIN/../external/libvips/lib:$ORIGIN/../external/raylib/lib' \
     -O2
 
+# Headless command-line build (no raylib/X11)
+gcc src/cli.c src/processor.c src/daemon.c -o "$BUILD_DIR/compressor-cli" \
+    $ALLOC_FLAGS \
+    $VIPS_CFLAGS \
+    -Iinclude \
+    $VIPS_LIBS \
+    -lm -lpthread -ldl -lrt \
+    -Wl,-rpath,'$ORIGIN/../external/libvips/lib' \
+    -O2
+
+# Live monitor for compressor-cli (reads shared memory, no vips)
+gcc src/top.c -o "$BUILD_DIR/compressor-top" -Iinclude -lrt -O2
+
+# Embeddable library (see include/imgcompress.h): shared and static
+gcc -shared -fPIC src/imgcompress.c src/processor.c -o "$BUILD_DIR/libimgcompress.so" \
+    $ALLOC_FLAGS \
+    $VIPS_CFLAGS \
+    -Iinclude \
+    $VIPS_LIBS \
+    -lm -lpthread -ldl -lrt \
+    -Wl,-rpath,'$ORIGIN/../external/libvips/lib' \
+    -O2
+gcc -c src/imgcompress.c -o "$BUILD_DIR/imgcompress.o" -Iinclude -O2
+gcc -c src/processor.c -o "$BUILD_DIR/processor.o" $VIPS_CFLAGS -Iinclude -O2
+ar rcs "$BUILD_DIR/libimgcompress.a" "$BUILD_DIR/imgcompress.o" "$BUILD_DIR/processor.o"
+rm -f "$BUILD_DIR/imgcompress.o" "$BUILD_DIR/processor.o"
+
 # Copy resources
 echo "Copying resources..."
 mkdir -p "$BUILD_DIR/resources"
@@ -156,5 +194,7 @@ echo "============================================"
 echo " BUILD SUCCESSFUL!"
 echo "============================================"
 echo "Binary: $BUILD_DIR/compressor"
+echo "CLI:    $BUILD_DIR/compressor-cli (monitor: $BUILD_DIR/compressor-top)"
+echo "Lib:    $BUILD_DIR/libimgcompress.so, $BUILD_DIR/libimgcompress.a (include/imgcompress.h)"
 echo "Run: LD_LIBRARY_PATH=$LD_LIBRARY_PATH $BUILD_DIR/compressor"
 echo ""
@@ -60,6 +60,13 @@ if %ERRORLEVEL% NEQ 0 (
     exit /b 1
 )
 
+echo Step 1b: Compiling daemon.c...
+gcc -m64 -c src/daemon.c -o build/daemon.o -Iinclude -O2
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile daemon.c
+    exit /b 1
+)
+
 echo Step 2: Compiling main.c (raylib only)...
 gcc -m64 -c src/main.c -o build/main.o %RAYLIB_CFLAGS% -Iinclude -O2
 if %ERRORLEVEL% NEQ 0 (
@@ -68,12 +75,42 @@ if %ERRORLEVEL% NEQ 0 (
 )
 
 echo Step 3: Linking (Release Mode)...
-gcc -m64 build/main.o build/processor.o -o build/compressor.exe %VIPS_LIBS% %RAYLIB_LIBS% -lgdi32 -lwinmm -lopengl32 -lpthread -lpsapi -static-libgcc -static-libstdc++ -mwindows -Wl,--subsystem,windows
+gcc -m64 build/main.o build/processor.o build/daemon.o -o build/compressor.exe %VIPS_LIBS% %RAYLIB_LIBS% -lgdi32 -lwinmm -lopengl32 -lpthread -lpsapi -static-libgcc -static-libstdc++ -mwindows -Wl,--subsystem,windows
 if %ERRORLEVEL% NEQ 0 (
     echo ERROR: Failed to link
     exit /b 1
 )
 
+echo Step 3b: Building command-line tool...
+gcc -m64 -c src/cli.c -o build/cli.o -Iinclude -O2
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile cli.c
+    exit /b 1
+)
+gcc -m64 build/cli.o build/processor.o build/daemon.o -o build/compressor-cli.exe %VIPS_LIBS% -lpthread -lpsapi -static-libgcc -static-libstdc++
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to link compressor-cli
+    exit /b 1
+)
+
+gcc -m64 src/top.c -o build/compressor-top.exe -Iinclude -O2 -static-libgcc
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to build compressor-top
+    exit /b 1
+)
+
+echo Step 3c: Building libimgcompress (static library)...
+gcc -m64 -c src/imgcompress.c -o build/imgcompress.o -Iinclude -O2
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to compile imgcompress.c
+    exit /b 1
+)
+ar rcs build/libimgcompress.a build/imgcompress.o build/processor.o
+if %ERRORLEVEL% NEQ 0 (
+    echo ERROR: Failed to create libimgcompress.a
+    exit /b 1
+)
+
 echo Step 4: Creating Portable Bundle...
 if exist "vendor\vips" (
     echo [INFO] Copying libvips DLLs...
@@ -113,4 +150,4 @@ echo You can move the 'build' folder anywhere and run compressor.exe.
 echo.
 
 REM Cleanup object files
-del build\main.o build\processor.o 2>nul
+del build\main.o build\processor.o build\daemon.o build\cli.o build\imgcompress.o 2>nul
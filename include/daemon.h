@@ -0,0 +1,66 @@
+/*
+ * daemon.h - Local daemon mode (Unix domain socket)
+ * One long-running process owns a warm libvips instance and a single job
+ * queue; the CLI and the GUI submit and control jobs as thin clients.
+ * Like processor.h, this header does NOT include any vips or raylib headers.
+ *
+ * Protocol: one command per line, fields separated by tabs/spaces as shown.
+ *   SUBMIT\t<folder>[\t<key>=<value>]...   -> "OK <id>" | "ERR <message>"
+ *       keys: quality speed threads pin background cpu_limit memory_limit
+ *             isolate shard (i/N) lease lease_ttl read_ahead read_ahead_mb
+ *             serial_writes write_queue_mb sync_writes drop_cache direct_io
+ *             disk_order decoders (-1 = auto) decode_queue_mb encoder (ENCODER_* or
+ *             name; ERR if not built into libheif)
+ *             no_tail_boost max_width max_height max_megapixels
+ *             segment_height (-1 = never split)
+ *   PAUSE <id> | RESUME <id> | STOP <id>    -> "OK" | "ERR <message>"
+ *   STATUS [<id>]                           -> "JOB ..." lines, then "END"
+ *   WATCH                                   -> streams "JOB ..." lines on every change
+ *   SHUTDOWN                                -> "OK", stops all jobs and exits
+ * JOB line: JOB <id> <status> <done> <total> <failed> <active> <folder>
+ * (status uses the JOB_* values from processor.h)
+ *
+ * The socket is created 0600 and connections from other users are refused.
+ * POSIX only; on Windows every call fails.
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "processor.h"
+
+// Default socket: $XDG_RUNTIME_DIR/image-compressor.sock or /tmp/image-compressor-<uid>.sock
+void daemon_default_socket_path(char *path, int maxLen);
+
+// Run the daemon until SHUTDOWN (blocks)
+// Returns: process exit code
+int daemon_run(const char *socketPath);
+
+// Connect to a running daemon
+// Returns: socket fd, or -1 if no daemon is listening
+int daemon_connect(const char *socketPath);
+
+// Close a client connection
+void daemon_close(int fd);
+
+// Submit a folder (absolute path) with the given settings
+// Returns: daemon job id (> 0), or -1 on error
+int daemon_submit(int fd, const char *folder, const CompressionConfig *config);
+
+// Send PAUSE, RESUME or STOP for a job
+// Returns: 0 on success, -1 on error
+int daemon_job_command(int fd, const char *verb, int jobId);
+
+// Query one job; fills status, doneFiles, totalFiles, failedFiles, activeThreads, progress
+// Returns: 0 on success, -1 on error or unknown job
+int daemon_query_job(int fd, int jobId, FolderJob *out);
+
+// Read one line from the daemon (newline stripped), for STATUS/WATCH output
+// Returns: line length, or -1 when the connection is closed
+int daemon_read_line(int fd, char *line, int maxLen);
+
+// Send one raw command line (newline appended)
+// Returns: 0 on success, -1 on error
+int daemon_send_line(int fd, const char *line);
+
+#endif // DAEMON_H
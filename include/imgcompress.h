@@ -0,0 +1,101 @@
+/*
+ * imgcompress.h - libimgcompress, embeddable API
+ * The folder processor and in-memory AVIF compression for use inside other
+ * programs: opaque job handles, callbacks instead of polling, and the
+ * caller's allocator for everything the library hands back.
+ * Like processor.h, this header does NOT include any vips or raylib headers.
+ *
+ * Typical use:
+ *   imgc_init(NULL);
+ *   CompressionConfig cfg; imgc_default_config(&cfg);
+ *   void *avif; size_t avifSize;
+ *   if (imgc_compress_buffer(jpeg, jpegSize, &cfg, &avif, &avifSize) == 0) {
+ *       ...
+ *       imgc_free(avif);
+ *   }
+ *   imgc_shutdown();
+ */
+
+#ifndef IMGCOMPRESS_H
+#define IMGCOMPRESS_H
+
+#include "processor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opaque folder job handle
+typedef struct ImgcJob ImgcJob;
+
+// Allocator hooks for job handles and returned buffers (NULL fields = malloc/free)
+// libvips itself keeps allocating through GLib.
+typedef struct {
+    void *(*alloc)(size_t size, void *userData);
+    void (*free)(void *ptr, void *userData);
+    void *userData;
+} ImgcAllocator;
+
+// Job notifications, called from library threads
+typedef struct {
+    // After every image; file is the name inside the folder
+    void (*onProgress)(ImgcJob *job, int done, int total, int failed, const char *file, void *userData);
+    // Once, when the job ends; status is JOB_COMPLETED, JOB_STOPPED or JOB_ERROR
+    void (*onComplete)(ImgcJob *job, int status, void *userData);
+    void *userData;
+} ImgcCallbacks;
+
+// Initialize the library (call once, before any other imgc_* call)
+// allocator may be NULL; it is copied. The process's malloc settings are
+// left alone (the front ends cap glibc's arenas, a host program decides)
+// Returns: 1 on success, 0 on error
+int imgc_init(const ImgcAllocator *allocator);
+
+// Shutdown the library (no job may be running)
+void imgc_shutdown(void);
+
+// Fill a config with the GUI defaults (quality 55, speed 6, half of the CPUs)
+void imgc_default_config(CompressionConfig *config);
+
+// Compress one encoded image in memory to AVIF in memory (thread-safe)
+// *output is allocated with the library allocator, release it with imgc_free()
+// Returns: 0 on success, -1 on error
+int imgc_compress_buffer(const void *input, size_t inputSize, const CompressionConfig *config,
+                         void **output, size_t *outputSize);
+
+// Release memory returned by the library
+void imgc_free(void *ptr);
+
+// Release per-thread libvips state (call before a thread that used imgc_compress_buffer exits)
+void imgc_thread_cleanup(void);
+
+// Start compressing a folder in a background thread
+// Output goes to "<folder> (compressed)"; callbacks may be NULL
+// config->isolate is ignored: the child would be the host application
+// config->cpuLimit needs a cgroup of our own (Linux) or a job object (Windows),
+// without them the job runs uncapped
+// Returns: job handle, or NULL on error
+ImgcJob* imgc_job_start(const char *folder, const CompressionConfig *config, const ImgcCallbacks *callbacks);
+
+// Pause, resume or stop a running job (stop returns immediately, see imgc_job_wait)
+void imgc_job_pause(ImgcJob *job);
+void imgc_job_resume(ImgcJob *job);
+void imgc_job_stop(ImgcJob *job);
+
+// Snapshot of a job's counters (any pointer may be NULL)
+// Returns: job status (JOB_* constant)
+int imgc_job_get_progress(ImgcJob *job, int *done, int *total, int *failed);
+
+// Block until the job ends; any number of threads may wait on the same job
+// Returns: final status (JOB_COMPLETED, JOB_STOPPED or JOB_ERROR)
+int imgc_job_wait(ImgcJob *job);
+
+// Stop (if needed), wait and release a job handle
+// Other threads must be done with the handle (including imgc_job_wait) first
+void imgc_job_destroy(ImgcJob *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IMGCOMPRESS_H
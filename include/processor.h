@@ -7,6 +7,9 @@
 #ifndef PROCESSOR_H
 #define PROCESSOR_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 // Job status codes
 #define JOB_PENDING    0
 #define JOB_PROCESSING 1
@@ -16,33 +19,89 @@
 #define JOB_PAUSED     5
 #define JOB_STOPPING   6
 
+// AV1 encoder backends (libheif plugins), for CompressionConfig.encoder
+#define ENCODER_AUTO   0     // Whatever libheif picks (usually libaom)
+#define ENCODER_AOM    1
+#define ENCODER_RAV1E  2
+#define ENCODER_SVT    3     // SVT-AV1
+#define ENCODER_COUNT  4
+
 // Compression settings
 typedef struct {
     int quality;      // 0-100 (default: 55)
     int speed;        // 0-10 (default: 8, higher = faster)
     int threads;      // Number of worker threads
+    int pinThreads;   // 1 = pin each worker to a NUMA node (nodes filled core by core, SMT siblings last)
+    int background;   // 1 = idle CPU/IO priority (desktop stays responsive); on Linux forces isolate
+    int cpuLimit;     // 1-99 = cap the process at this % of total CPU while the job runs, 0 or 100 = no cap
+    int memoryLimitMB; // RSS above this throttles admission of new images (0 = half of RAM)
+    int isolate;      // 1 = encode in recycled child processes so a crash only fails one image (Linux)
+    int shardIndex;   // Static split: process only shard shardIndex of shardCount
+    int shardCount;   // 0 or 1 = no sharding
+    int useLeases;    // 1 = claim images with lease files so several processes can share a folder
+    int leaseTtl;     // Seconds before an unrefreshed lease is reclaimed (0 = default 120)
+    int readAhead;    // Files read into memory ahead of the workers (0 = off; slow disks, NAS, FUSE)
+    int readAheadMB;  // Memory budget for read-ahead buffers (0 = default 256)
+    int serialWrites; // 1 = one writer thread per job writes every output (spinning disks, SMR)
+    int writeQueueMB; // Writer backlog before encoders wait (0 = default 128)
+    int syncWrites;   // 1 = fsync outputs before renaming them, batched by the writer (implies serialWrites)
+    int dropCache;    // 1 = drop sources and outputs from the page cache once done (huge batches; POSIX)
+    int directIO;     // 1 = copy large kept originals with O_DIRECT, bypassing the page cache (Linux)
+    int diskOrder;    // 1 = process a folder in on-disk order (physical extent or inode) for spinning disks (POSIX)
+    int decoders;     // Decode-stage threads feeding the encoders: 0 = off (each worker decodes), -1 = auto
+    int decodeQueueMB;// Memory for decoded images waiting for an encoder (0 = default 512 MB)
+    int encoder;      // ENCODER_* backend (0 = libheif's default)
+    int noTailBoost;  // 1 = don't raise vips concurrency for the last images of a job
+    int maxWidth;     // Downscale larger images to fit (shrink-on-load), 0 = no limit
+    int maxHeight;    // Same for height, 0 = no limit
+    float maxMegapixels; // Downscale images above this many megapixels, 0 = no limit
+    int segmentHeight;// Split taller images into AVIF segments this high (0 = 8192 above 16384, -1 = never)
 } CompressionConfig;
 
 // Single folder job
-typedef struct {
+typedef struct FolderJob {
     char sourcePath[512];
     char outputPath[512];
     volatile int status;       // Use JOB_* constants
     int progress;
     int totalFiles;
     int doneFiles;
+    int failedFiles;           // Images that failed to load/encode (or crashed the encoder)
     char currentFile[256];
     int activeThreads;         // How many threads are currently processing an image
+    int allowedThreads;        // Workers allowed under memory pressure (0 = not throttled)
     CompressionConfig config;
+    int remoteId;              // > 0 = job runs in the daemon (GUI thin-client mode, see daemon.h)
+    int remoteStatus;          // Last status received from the daemon
+    // Optional: called from the worker thread after each image (outside the job lock)
+    void (*onImageDone)(struct FolderJob *job, const char *name, int failed);
+    void *callbackData;        // For onImageDone, not touched by the processor
+    int eventId;               // Job id on the event stream (assigned on first event)
+    long long eventStartMs;    // Event stream bookkeeping (duration, progress rate limit)
+    long long eventProgressMs;
+    int statsSlot;             // Job slot + 1 in the shared stats segment, 0 = none
 } FolderJob;
 
 // Initialize libvips (call once at startup)
 // Returns: 1 on success, 0 on error
 int processor_init(void);
 
+// Same, for use inside another program (libimgcompress): process-wide
+// settings such as the malloc arena cap are left to the host, and no encoder
+// child processes are started (not even to enforce a CPU cap)
+// Returns: 1 on success, 0 on error
+int processor_init_embedded(void);
+
 // Shutdown libvips (call before exit)
 void processor_shutdown(void);
 
+// Command-line argument that starts the isolated encoder child process
+#define ENCODER_SERVER_ARG "--encoder-server"
+
+// Entry point for the encoder child (call from main() when argv[1] is ENCODER_SERVER_ARG)
+// Returns the process exit code
+int processor_encoder_server_main(void);
+
 // Clean up current thread vips resources
 void processor_thread_cleanup(void);
 
@@ -50,13 +109,72 @@ void processor_thread_cleanup(void);
 // Updates job->progress, job->doneFiles, job->currentFile during processing
 int process_folder(FolderJob *job);
 
+// Compress one encoded image (JPEG/PNG/WebP...) held in memory to AVIF in memory
+// The result is allocated with allocFn(size, allocData), or malloc() when allocFn is NULL
+// Returns: 0 on success (*output/*outputSize set), -1 on error
+int processor_compress_buffer(const void *input, size_t inputSize, const CompressionConfig *config,
+                              void *(*allocFn)(size_t size, void *allocData), void *allocData,
+                              void **output, size_t *outputSize);
+
+// Name of an ENCODER_* backend ("auto", "aom", "rav1e", "svt")
+const char* processor_encoder_name(int encoder);
+
+// ENCODER_* backend for a name, -1 if unknown
+int processor_encoder_from_name(const char *name);
+
+// Backends this libvips/libheif build can encode with, as a mask of (1 << ENCODER_*)
+// Asked from libheif's encoder plugins on first call, call after processor_init()
+int processor_available_encoders(void);
+
+// Encode a sample of a folder's images with every available backend and print
+// time and size per backend (config gives quality and speed)
+// Returns: 0 on success, -1 if the folder has no images
+int processor_benchmark_encoders(const char *folder, const CompressionConfig *config, int sampleCount);
+
+// Process images whose paths arrive on a stream (e.g. stdin from `find -print0`)
+// Entries are separated by delimiter ('\n' or '\0'); encoding starts as they arrive.
+// Output: outputDir NULL = "<folder> (compressed)" next to each image,
+// otherwise flat into outputDir, or mirroring the folders below mirrorPrefix
+// Returns when the stream ends and every image is done (or the job is stopped)
+int process_file_stream(FolderJob *job, FILE *input, int delimiter, const char *outputDir, const char *mirrorPrefix);
+
+// Machine-readable event stream: one JSON object per line on out (NULL = off)
+// Set it before starting jobs. Format version 1; every line has
+//   "v":1, "t":<unix ms>, "event":<name>, "job":<id>
+// plus, per event:
+//   job_queued      folder
+//   job_started     folder, output, total, threads, streaming
+//   image_queued    file                      (streamed input only)
+//   image_started   file, worker
+//   image_finished  file, in_bytes, out_bytes, ratio, ms, kept_original, segments (0 = not split)
+//                   (with serial writes: encoded and queued; a failed write is a later image_error)
+//   image_skipped   file, reason              (already in the output)
+//   image_error     file, error, ms
+//   progress        done, total, failed, active  (at most every 500 ms per job, and at the end)
+//   job_finished    status ("completed", "stopped", "error"), done, total, failed, ms,
+//                   rss_bytes, vips_bytes, vips_peak_bytes, vips_allocs, vips_files, cache_ops[, error]
+// New members may be added within a version; renames or removals bump "v".
+void processor_set_event_output(FILE *out);
+
+// Publish live counters in a shared-memory segment for compressor-top (see stats.h)
+// Call once at startup, before starting jobs
+// Returns: 1 if publishing, 0 if the segment could not be created
+int processor_stats_publish(void);
+
+// Remove the shared-memory segment (call before exit)
+void processor_stats_unpublish(void);
+
+// Emit job_queued for a job that a front end has accepted but not started yet
+void processor_event_job_queued(FolderJob *job);
+
 // Get output path for compressed folder
 void get_output_folder_path(const char *inputPath, char *outputPath, int maxLen);
 
 // Check if a path is a directory (handles unicode on Windows)
 int check_is_directory(const char *path);
 
-// Get the number of CPU cores available
+// Get the number of CPU cores available to this process
+// Honors the affinity mask and cgroup CPU quotas (e.g. Kubernetes limits)
 int get_cpu_count(void);
 
 // Sleep current thread
@@ -70,4 +188,54 @@ char* pick_folder_dialog(void);
 // Get current process RAM usage (Working Set) in bytes
 long long get_process_ram_usage(void);
 
+// libvips' own accounting, to tell pixel buffers apart from the rest of RSS
+typedef struct {
+    long long trackedBytes;    // Memory in libvips tracked buffers (pixels, mostly)
+    long long trackedPeak;     // High-water mark of trackedBytes since startup
+    int trackedAllocs;         // Live tracked allocations
+    int openFiles;             // Files libvips has open
+    int cacheOps;              // Operations in the libvips cache
+    int cacheMaxOps;           // Cache limits set in processor_init()
+    long long cacheMaxBytes;
+    int cacheMaxFiles;
+} VipsMemoryStats;
+
+// Sample libvips memory, file and cache counters (cheap, any thread)
+void processor_get_vips_stats(VipsMemoryStats *stats);
+
+// ---- Process metrics sampler ----
+// A background thread samples the process every few hundred ms into a ring
+// buffer, so the UI reads numbers without touching /proc on the render thread.
+#define METRICS_HISTORY 480        // Samples kept (4 minutes at 500 ms)
+
+typedef struct {
+    long long timeMs;              // Monotonic ms when taken
+    long long rssBytes;
+    float cpuPercent;              // Process CPU, % of the CPUs available to us
+    int threadCount;
+    float busiestThreadPercent;    // Busiest thread, % of one core (Linux)
+    long long readBytes;           // Storage bytes read/written since start (Linux: /proc/self/io)
+    long long writeBytes;
+    float readBytesPerSec;
+    float writeBytesPerSec;
+    long long imagesDone;          // Images finished (ok or failed) since start, all jobs
+    float imagesPerSec;
+    VipsMemoryStats vips;
+} MetricsSample;
+
+// Start the sampler thread (no-op if already running)
+// Returns: 1 on success, 0 on error
+int processor_metrics_start(int intervalMs);
+
+// Stop the sampler thread
+void processor_metrics_stop(void);
+
+// Copy the latest sample (no system calls)
+// Returns: 1 if a sample exists, 0 otherwise
+int processor_metrics_latest(MetricsSample *out);
+
+// Copy up to max samples, oldest first
+// Returns: number of samples copied
+int processor_metrics_history(MetricsSample *out, int max);
+
 #endif // PROCESSOR_H
@@ -0,0 +1,74 @@
+/*
+ * stats.h - Live counters in shared memory
+ * Layout of the segment a running compressor publishes (processor_stats_publish)
+ * and compressor-top reads. Readers map it read-only and never block the writer.
+ * Like processor.h, this header does NOT include any vips or raylib headers.
+ *
+ * Segment name: STATS_SHM_PREFIX + pid
+ *   POSIX:   shm_open("/image-compressor-stats-<pid>") (Linux: /dev/shm/...)
+ *   Windows: "Local\image-compressor-stats-<pid>" file mapping
+ *
+ * Consistency: every job and worker slot has its own sequence counter. The
+ * writer makes it odd, updates the slot, then makes it even again; a reader
+ * copies the slot and retries if the counter was odd or changed meanwhile.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#define STATS_MAGIC        0x53434d49u   // "IMCS"
+#define STATS_VERSION      3             // Bumped on any layout change
+#define STATS_SHM_PREFIX   "image-compressor-stats-"
+#define STATS_MAX_JOBS     8
+#define STATS_MAX_WORKERS  128
+
+// Worker states
+#define STATS_WORKER_FREE      0         // Slot unused
+#define STATS_WORKER_IDLE      1         // Waiting for an image (or paused/throttled)
+#define STATS_WORKER_LOADING   2         // Opening and reading the header
+#define STATS_WORKER_ENCODING  3         // Decode + AV1 encode (one step with sequential access)
+#define STATS_WORKER_WRITING   4         // Moving the output into place / copying a kept original
+
+typedef struct {
+    volatile unsigned int seq;
+    int state;                 // STATS_WORKER_*
+    int job;                   // Index in StatsRegion.jobs
+    int pad;
+    long long stateSinceMs;    // Unix ms when the current state began
+    char file[256];
+} StatsWorker;
+
+typedef struct {
+    volatile unsigned int seq;
+    int status;                // JOB_* from processor.h
+    int total;
+    int done;
+    int failed;
+    int queued;                // Images not started yet
+    int activeThreads;
+    int inUse;                 // 0 once finished; the slot keeps its last values until reused
+    int writerActive;          // 1 = outputs go through the writer stage (serial writes)
+    int writeQueued;           // Outputs waiting for the writer
+    long long bytesIn;         // Of the images encoded so far
+    long long bytesOut;
+    long long writeQueuedBytes;
+    long long bytesWritten;    // By the writer
+    int untrackedWorkers;      // Running workers that got no slot in StatsRegion.workers (all taken)
+    int pad;
+    long long startedMs;       // Unix ms, 0 = slot never used
+    long long updatedMs;
+    char folder[512];
+} StatsJob;
+
+typedef struct {
+    unsigned int magic;        // STATS_MAGIC
+    unsigned int version;      // STATS_VERSION
+    unsigned int size;         // sizeof(StatsRegion)
+    int pid;
+    volatile long long rssBytes;
+    volatile long long updatedMs;
+    StatsJob jobs[STATS_MAX_JOBS];
+    StatsWorker workers[STATS_MAX_WORKERS];
+} StatsRegion;
+
+#endif // STATS_H
@@ -0,0 +1,494 @@
+/*
+ * Image Compressor - Command Line Interface
+ * Headless batch mode for servers and scripts (no raylib, no window).
+ *
+ * This file ONLY uses processor.h/daemon.h, never vips or raylib directly.
+ *
+ * Build (Linux):
+ *   gcc cli.c processor.c daemon.c -o compressor-cli $(pkg-config --cflags --libs vips) -lm -lpthread -ldl -lrt
+ *
+ * Usage:
+ *   compressor-cli [options] <folder>...
+ *   find ... -print0 | compressor-cli --stdin -0 [options]
+ *   compressor-cli --daemon                 (long-running job server)
+ *   compressor-cli --submit [options] <folder>...
+ */
+
+#include "processor.h"
+#include "daemon.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+    #include <io.h>
+    #define dup _dup
+    #define dup2 _dup2
+    #define fdopen _fdopen
+#else
+    #include <unistd.h>
+#endif
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options] <folder>...\n", prog);
+    printf("       %s --stdin [-0] [options]      (image paths on stdin)\n", prog);
+    printf("\n");
+    printf("Compression:\n");
+    printf("  -q, --quality N        AVIF quality 0-100 (default: 55)\n");
+    printf("  -s, --speed N          0 (slow/best) to 10 (fast) (default: 6)\n");
+    printf("  -t, --threads N        Images processed at once (default: half of CPUs)\n");
+    printf("  --encoder NAME         AV1 encoder: auto, aom, svt, rav1e (default: auto)\n");
+    printf("  --max-width N          Downscale wider images to N pixels (shrink-on-load)\n");
+    printf("  --max-height N         Downscale taller images to N pixels\n");
+    printf("  --max-megapixels MP    Downscale images above MP megapixels\n");
+    printf("  --segment-height N     Split taller images into AVIF segments N pixels high\n");
+    printf("                         (default: 8192, only images over 16384; 0 = never)\n");
+    printf("  --list-encoders        Show the AV1 encoders this build can use\n");
+    printf("  --benchmark-encoders N Encode N images of each folder with every encoder and\n");
+    printf("                         compare time and size (nothing is written)\n");
+    printf("\n");
+    printf("Scheduling:\n");
+    printf("  --pin                  Keep each worker on one NUMA node (filled core by core)\n");
+    printf("  --background           Idle CPU/IO priority for the job (Linux: encodes isolated)\n");
+    printf("  --cpu-limit P          Cap the job at P%% of total CPU\n");
+    printf("  --memory-limit MB      Throttle new images above this RSS (default: half of RAM)\n");
+    printf("  --no-tail-boost        Keep one vips thread count when few images are left\n");
+    printf("  --decoders N|auto      Decode in N separate threads so workers only encode\n");
+    printf("                         (auto: sized from measured decode/encode times)\n");
+    printf("  --decode-queue-mb MB   Memory for decoded images waiting (default: 512)\n");
+    printf("  --isolate              Encode in recycled child processes (Linux)\n");
+    printf("\n");
+    printf("I/O (slow disks, NAS, network mounts):\n");
+    printf("  --read-ahead N         Read the next N files into memory ahead of the encoders\n");
+    printf("  --read-ahead-mb MB     Memory for read-ahead buffers (default: 256)\n");
+    printf("  --serial-writes        One writer thread writes all outputs (spinning disks, SMR)\n");
+    printf("  --write-queue-mb MB    Writer backlog before encoders wait (default: 128)\n");
+    printf("  --sync-writes          fsync outputs in batches before renaming them (implies\n");
+    printf("                         --serial-writes)\n");
+    printf("  --drop-cache           Drop sources and outputs from the page cache once done\n");
+    printf("                         (huge batches, keeps the host's cache for other work)\n");
+    printf("  --direct-io            Copy large kept originals with O_DIRECT (Linux)\n");
+    printf("  --disk-order           Process files in on-disk order, not readdir order\n");
+    printf("                         (cold folders on spinning disks)\n");
+    printf("\n");
+    printf("Sharing a folder between processes/machines:\n");
+    printf("  --shard i/N            Process only shard i (0-based) of N\n");
+    printf("  --lease                Claim images with lease files in the output folder\n");
+    printf("  --lease-ttl SEC        Reclaim leases not refreshed for SEC seconds (default: 120)\n");
+    printf("\n");
+    printf("Streaming input (encoding starts while the list is still arriving):\n");
+    printf("  --stdin                Read image paths from stdin, one per line\n");
+    printf("  -0, --null             Paths are NUL-separated (find -print0)\n");
+    printf("  --output-dir DIR       Write all outputs to DIR (default: \"<folder> (compressed)\"\n");
+    printf("                         next to each image)\n");
+    printf("  --mirror PREFIX        With --output-dir: recreate the subfolders below PREFIX\n");
+    printf("\n");
+    printf("Automation:\n");
+    printf("  --json                 JSON-lines events on stdout (log messages go to stderr)\n");
+    printf("  --json-fd N            JSON-lines events on file descriptor N\n");
+    printf("  --no-stats             Don't publish live stats for compressor-top\n");
+    printf("\n");
+    printf("Daemon (one warm process owns the queue; POSIX only):\n");
+    printf("  --daemon               Run the job server until --shutdown\n");
+    printf("  --socket PATH          Socket path (default: $XDG_RUNTIME_DIR/image-compressor.sock)\n");
+    printf("  --submit               Queue the folders in the daemon instead of running here\n");
+    printf("  --status               List daemon jobs\n");
+    printf("  --watch                Stream daemon job progress\n");
+    printf("  --pause ID, --resume ID, --stop ID\n");
+    printf("  --shutdown             Stop all jobs and the daemon\n");
+    printf("\n");
+    printf("Output goes to \"<folder> (compressed)\".\n");
+}
+
+static const char* status_name(int status) {
+    switch (status) {
+        case JOB_PENDING:    return "pending";
+        case JOB_PROCESSING: return "processing";
+        case JOB_COMPLETED:  return "done";
+        case JOB_ERROR:      return "error";
+        case JOB_STOPPED:    return "stopped";
+        case JOB_PAUSED:     return "paused";
+        case JOB_STOPPING:   return "stopping";
+        default:             return "unknown";
+    }
+}
+
+// Print "JOB ..." lines from the daemon until END (or forever for WATCH)
+static int print_daemon_jobs(int fd) {
+    char line[700];
+    while (daemon_read_line(fd, line, sizeof(line)) >= 0) {
+        if (strcmp(line, "END") == 0) return 0;
+        int id, status, done, total, failed, active, pathOffset = 0;
+        if (sscanf(line, "JOB %d %d %d %d %d %d %n", &id, &status, &done, &total, &failed, &active, &pathOffset) == 6) {
+            printf("%4d  %-10s %6d/%-6d failed %-4d threads %-3d %s\n",
+                   id, status_name(status), done, total, failed, active, line + pathOffset);
+            fflush(stdout);
+        } else {
+            fprintf(stderr, "%s\n", line);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Client side of daemon mode: submit folders or send one command
+static int run_daemon_client(const char *socketPath, const char *command, int jobId,
+                             const char **folders, int folderCount, const CompressionConfig *config) {
+    int fd = daemon_connect(socketPath);
+    if (fd < 0) {
+        fprintf(stderr, "Error: no daemon listening on %s (start one with --daemon)\n", socketPath);
+        return 1;
+    }
+
+    int exitCode = 0;
+    if (strcmp(command, "SUBMIT") == 0) {
+        for (int i = 0; i < folderCount; i++) {
+            // The daemon may run in another directory: send absolute paths
+            char absolute[1024];
+#ifdef _WIN32
+            if (!_fullpath(absolute, folders[i], sizeof(absolute))) {
+#else
+            if (!realpath(folders[i], absolute)) {
+#endif
+                fprintf(stderr, "Error: cannot resolve %s\n", folders[i]);
+                exitCode = 1;
+                continue;
+            }
+            int id = daemon_submit(fd, absolute, config);
+            if (id < 0) {
+                exitCode = 1;
+            } else {
+                printf("Submitted job %d: %s\n", id, absolute);
+            }
+        }
+    } else if (strcmp(command, "STATUS") == 0 || strcmp(command, "WATCH") == 0) {
+        if (daemon_send_line(fd, command) != 0) exitCode = 1;
+        else exitCode = print_daemon_jobs(fd);
+    } else if (strcmp(command, "SHUTDOWN") == 0) {
+        char reply[256];
+        if (daemon_send_line(fd, command) != 0 || daemon_read_line(fd, reply, sizeof(reply)) < 0) exitCode = 1;
+    } else if (daemon_job_command(fd, command, jobId) != 0) {
+        fprintf(stderr, "Error: %s %d failed\n", command, jobId);
+        exitCode = 1;
+    }
+
+    daemon_close(fd);
+    return exitCode;
+}
+
+// Parse an integer option value, exits on error
+static int parse_int_arg(const char *opt, const char *value, int minVal, int maxVal) {
+    char *end = NULL;
+    long v = value ? strtol(value, &end, 10) : 0;
+    if (!value || *value == '\0' || *end != '\0' || v < minVal || v > maxVal) {
+        fprintf(stderr, "Error: %s expects a number between %d and %d\n", opt, minVal, maxVal);
+        exit(2);
+    }
+    return (int)v;
+}
+
+int main(int argc, char **argv) {
+    // Isolated encoder child process (see CompressionConfig.isolate)
+    if (argc > 1 && strcmp(argv[1], ENCODER_SERVER_ARG) == 0) {
+        return processor_encoder_server_main();
+    }
+
+    int cpus = get_cpu_count();
+    CompressionConfig config;
+    memset(&config, 0, sizeof(config));
+    config.quality = 55;
+    config.speed = 6;
+    config.threads = cpus / 2 > 0 ? cpus / 2 : 1;
+    config.cpuLimit = 100;
+
+    const char **folders = (const char **)malloc(argc * sizeof(char *));
+    int folderCount = 0;
+    if (!folders) return 1;
+
+    char socketPath[512];
+    daemon_default_socket_path(socketPath, sizeof(socketPath));
+    int runDaemon = 0;
+    const char *clientCommand = NULL;   // SUBMIT, STATUS, WATCH, PAUSE, RESUME, STOP, SHUTDOWN
+    int clientJobId = 0;
+    int readStdin = 0;
+    int delimiter = '\n';
+    const char *outputDir = NULL;
+    const char *mirrorPrefix = NULL;
+    int jsonFd = -1;            // 1 = stdout
+    int listEncoders = 0;
+    int benchmarkSample = 0;    // > 0 = compare encoders on the folders instead of compressing
+    int publishStats = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *next = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            print_usage(argv[0]);
+            free(folders);
+            return 0;
+        } else if (strcmp(arg, "-q") == 0 || strcmp(arg, "--quality") == 0) {
+            config.quality = parse_int_arg(arg, next, 0, 100); i++;
+        } else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--speed") == 0) {
+            config.speed = parse_int_arg(arg, next, 0, 10); i++;
+        } else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0) {
+            config.threads = parse_int_arg(arg, next, 1, 4096); i++;
+        } else if (strcmp(arg, "--encoder") == 0) {
+            config.encoder = next ? processor_encoder_from_name(next) : -1;
+            if (config.encoder < 0) {
+                fprintf(stderr, "Error: --encoder expects auto, aom, svt or rav1e\n");
+                free(folders);
+                return 2;
+            }
+            i++;
+        } else if (strcmp(arg, "--max-width") == 0) {
+            config.maxWidth = parse_int_arg(arg, next, 1, 1 << 20); i++;
+        } else if (strcmp(arg, "--max-height") == 0) {
+            config.maxHeight = parse_int_arg(arg, next, 1, 1 << 20); i++;
+        } else if (strcmp(arg, "--max-megapixels") == 0) {
+            config.maxMegapixels = next ? (float)atof(next) : 0.0f;
+            if (config.maxMegapixels <= 0.0f) {
+                fprintf(stderr, "Error: --max-megapixels expects a positive number\n");
+                free(folders);
+                return 2;
+            }
+            i++;
+        } else if (strcmp(arg, "--segment-height") == 0) {
+            config.segmentHeight = parse_int_arg(arg, next, 0, 1 << 20); i++;
+            if (config.segmentHeight == 0) config.segmentHeight = -1;
+        } else if (strcmp(arg, "--list-encoders") == 0) {
+            listEncoders = 1;
+        } else if (strcmp(arg, "--benchmark-encoders") == 0) {
+            benchmarkSample = parse_int_arg(arg, next, 1, 1000); i++;
+        } else if (strcmp(arg, "--pin") == 0) {
+            config.pinThreads = 1;
+        } else if (strcmp(arg, "--background") == 0) {
+            config.background = 1;
+        } else if (strcmp(arg, "--cpu-limit") == 0) {
+            config.cpuLimit = parse_int_arg(arg, next, 1, 100); i++;
+        } else if (strcmp(arg, "--memory-limit") == 0) {
+            config.memoryLimitMB = parse_int_arg(arg, next, 1, 1 << 30); i++;
+        } else if (strcmp(arg, "--isolate") == 0) {
+            config.isolate = 1;
+        } else if (strcmp(arg, "--read-ahead") == 0) {
+            config.readAhead = parse_int_arg(arg, next, 0, 4096); i++;
+        } else if (strcmp(arg, "--read-ahead-mb") == 0) {
+            config.readAheadMB = parse_int_arg(arg, next, 1, 1 << 20); i++;
+        } else if (strcmp(arg, "--serial-writes") == 0) {
+            config.serialWrites = 1;
+        } else if (strcmp(arg, "--write-queue-mb") == 0) {
+            config.writeQueueMB = parse_int_arg(arg, next, 1, 1 << 20); i++;
+        } else if (strcmp(arg, "--sync-writes") == 0) {
+            config.syncWrites = 1;
+        } else if (strcmp(arg, "--drop-cache") == 0) {
+            config.dropCache = 1;
+        } else if (strcmp(arg, "--direct-io") == 0) {
+            config.directIO = 1;
+        } else if (strcmp(arg, "--no-tail-boost") == 0) {
+            config.noTailBoost = 1;
+        } else if (strcmp(arg, "--decoders") == 0) {
+            if (next && strcmp(next, "auto") == 0) config.decoders = -1;
+            else config.decoders = parse_int_arg(arg, next, 0, 256);
+            i++;
+        } else if (strcmp(arg, "--decode-queue-mb") == 0) {
+            config.decodeQueueMB = parse_int_arg(arg, next, 1, 1 << 20); i++;
+        } else if (strcmp(arg, "--disk-order") == 0) {
+            config.diskOrder = 1;
+        } else if (strcmp(arg, "--shard") == 0) {
+            if (!next || sscanf(next, "%d/%d", &config.shardIndex, &config.shardCount) != 2 ||
+                config.shardCount < 1 || config.shardIndex < 0 || config.shardIndex >= config.shardCount) {
+                fprintf(stderr, "Error: --shard expects i/N with 0 <= i < N\n");
+                free(folders);
+                return 2;
+            }
+            i++;
+        } else if (strcmp(arg, "--lease") == 0) {
+            config.useLeases = 1;
+        } else if (strcmp(arg, "--lease-ttl") == 0) {
+            config.leaseTtl = parse_int_arg(arg, next, 1, 86400); i++;
+        } else if (strcmp(arg, "--stdin") == 0) {
+            readStdin = 1;
+        } else if (strcmp(arg, "-0") == 0 || strcmp(arg, "--null") == 0) {
+            delimiter = '\0';
+        } else if (strcmp(arg, "--output-dir") == 0 || strcmp(arg, "--mirror") == 0) {
+            if (!next) {
+                fprintf(stderr, "Error: %s expects a path\n", arg);
+                free(folders);
+                return 2;
+            }
+            if (arg[2] == 'o') outputDir = next;
+            else mirrorPrefix = next;
+            i++;
+        } else if (strcmp(arg, "--no-stats") == 0) {
+            publishStats = 0;
+        } else if (strcmp(arg, "--json") == 0) {
+            jsonFd = 1;
+        } else if (strcmp(arg, "--json-fd") == 0) {
+            jsonFd = parse_int_arg(arg, next, 0, 1 << 20); i++;
+        } else if (strcmp(arg, "--daemon") == 0) {
+            runDaemon = 1;
+        } else if (strcmp(arg, "--socket") == 0) {
+            if (!next) {
+                fprintf(stderr, "Error: --socket expects a path\n");
+                free(folders);
+                return 2;
+            }
+            strncpy(socketPath, next, sizeof(socketPath) - 1);
+            socketPath[sizeof(socketPath) - 1] = '\0';
+            i++;
+        } else if (strcmp(arg, "--submit") == 0) {
+            clientCommand = "SUBMIT";
+        } else if (strcmp(arg, "--status") == 0) {
+            clientCommand = "STATUS";
+        } else if (strcmp(arg, "--watch") == 0) {
+            clientCommand = "WATCH";
+        } else if (strcmp(arg, "--shutdown") == 0) {
+            clientCommand = "SHUTDOWN";
+        } else if (strcmp(arg, "--pause") == 0 || strcmp(arg, "--resume") == 0 || strcmp(arg, "--stop") == 0) {
+            clientCommand = strcmp(arg, "--pause") == 0 ? "PAUSE" : strcmp(arg, "--resume") == 0 ? "RESUME" : "STOP";
+            clientJobId = parse_int_arg(arg, next, 1, 1 << 30); i++;
+        } else if (arg[0] == '-' && arg[1] != '\0') {
+            fprintf(stderr, "Error: unknown option %s\n", arg);
+            print_usage(argv[0]);
+            free(folders);
+            return 2;
+        } else {
+            folders[folderCount++] = arg;
+        }
+    }
+
+    // Event stream; on stdout the human-readable log moves to stderr
+    if (jsonFd >= 0) {
+        int fd = dup(jsonFd);
+        FILE *events = fd >= 0 ? fdopen(fd, "w") : NULL;
+        if (!events) {
+            fprintf(stderr, "Error: cannot write events to file descriptor %d\n", jsonFd);
+            free(folders);
+            return 2;
+        }
+        if (jsonFd == 1) dup2(2, 1);
+        processor_set_event_output(events);
+    }
+
+    if (runDaemon) {
+        free(folders);
+        if (publishStats) processor_stats_publish();   // Live counters for compressor-top
+        int rc = daemon_run(socketPath);
+        processor_stats_unpublish();
+        return rc;
+    }
+    if (clientCommand && (strcmp(clientCommand, "SUBMIT") != 0 || folderCount > 0)) {
+        int rc = run_daemon_client(socketPath, clientCommand, clientJobId, folders, folderCount, &config);
+        free(folders);
+        return rc;
+    }
+
+    if (mirrorPrefix && !outputDir) {
+        fprintf(stderr, "Error: --mirror needs --output-dir\n");
+        free(folders);
+        return 2;
+    }
+    if ((outputDir || delimiter != '\n') && !readStdin) {
+        fprintf(stderr, "Error: -0, --output-dir and --mirror only apply to --stdin\n");
+        free(folders);
+        return 2;
+    }
+    if (listEncoders) {
+        free(folders);
+        if (!processor_init()) return 1;
+        int available = processor_available_encoders();
+        for (int i = 0; i < ENCODER_COUNT; i++) {
+            if (available & (1 << i)) printf("%s\n", processor_encoder_name(i));
+        }
+        processor_shutdown();
+        return 0;
+    }
+    if (readStdin ? folderCount > 0 : folderCount == 0) {
+        print_usage(argv[0]);
+        free(folders);
+        return 2;
+    }
+
+    if (!processor_init()) {
+        fprintf(stderr, "ERROR: Failed to initialize libvips!\n");
+        free(folders);
+        return 1;
+    }
+    if (config.encoder != ENCODER_AUTO && !(processor_available_encoders() & (1 << config.encoder))) {
+        fprintf(stderr, "Error: encoder %s is not available in this libvips/libheif build\n",
+                processor_encoder_name(config.encoder));
+        processor_shutdown();
+        free(folders);
+        return 2;
+    }
+    if (benchmarkSample > 0) {
+        int rc = 0;
+        for (int i = 0; i < folderCount; i++) {
+            if (processor_benchmark_encoders(folders[i], &config, benchmarkSample) != 0) rc = 1;
+        }
+        processor_shutdown();
+        free(folders);
+        return rc;
+    }
+    if (publishStats) processor_stats_publish();   // Live counters for compressor-top
+
+    int exitCode = 0;
+    if (readStdin) {
+        FolderJob *job = (FolderJob *)calloc(1, sizeof(FolderJob));
+        if (!job) {
+            processor_shutdown();
+            processor_stats_unpublish();
+            free(folders);
+            return 1;
+        }
+        strncpy(job->sourcePath, "(stdin)", sizeof(job->sourcePath) - 1);
+        job->config = config;
+        job->status = JOB_PENDING;
+        processor_event_job_queued(job);
+
+        process_file_stream(job, stdin, delimiter, outputDir, mirrorPrefix);
+
+        printf("%s: %d/%d images, %d failed\n", job->sourcePath, job->doneFiles, job->totalFiles, job->failedFiles);
+        if (job->status != JOB_COMPLETED || job->failedFiles > 0) exitCode = 1;
+        free(job);
+    }
+
+    // Queue every folder first, then run them in order
+    FolderJob **jobs = (FolderJob **)calloc(folderCount > 0 ? folderCount : 1, sizeof(FolderJob *));
+    if (!jobs) exitCode = 1;
+    for (int i = 0; jobs && i < folderCount; i++) {
+        if (!check_is_directory(folders[i])) {
+            fprintf(stderr, "Error: not a directory: %s\n", folders[i]);
+            exitCode = 1;
+            continue;
+        }
+
+        FolderJob *job = (FolderJob *)calloc(1, sizeof(FolderJob));
+        if (!job) {
+            exitCode = 1;
+            break;
+        }
+        strncpy(job->sourcePath, folders[i], sizeof(job->sourcePath) - 1);
+        get_output_folder_path(job->sourcePath, job->outputPath, sizeof(job->outputPath));
+        job->config = config;
+        job->status = JOB_PENDING;
+        processor_event_job_queued(job);
+        jobs[i] = job;
+    }
+
+    for (int i = 0; jobs && i < folderCount; i++) {
+        FolderJob *job = jobs[i];
+        if (!job) continue;
+
+        process_folder(job);
+
+        printf("%s: %d/%d images, %d failed\n", job->sourcePath, job->doneFiles, job->totalFiles, job->failedFiles);
+        if (job->status != JOB_COMPLETED || job->failedFiles > 0) exitCode = 1;
+        free(job);
+    }
+    free(jobs);
+
+    processor_shutdown();
+    processor_stats_unpublish();
+    free(folders);
+    return exitCode;
+}
@@ -0,0 +1,576 @@
+/*
+ * daemon.c - Local daemon mode over a Unix domain socket
+ * See daemon.h for the protocol.
+ *
+ * This file ONLY uses processor.h, never vips or raylib directly.
+ */
+
+#ifndef _WIN32
+    #define _GNU_SOURCE  // struct ucred (SO_PEERCRED)
+#endif
+
+#include "daemon.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <signal.h>
+    #include <poll.h>
+    #include <stdint.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/stat.h>
+    #ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0  // SIGPIPE is ignored in daemon_run() instead
+    #endif
+#endif
+
+#define DAEMON_WATCH_INTERVAL_MS 250
+
+void daemon_default_socket_path(char *path, int maxLen) {
+#ifdef _WIN32
+    snprintf(path, maxLen, "image-compressor.sock");
+#else
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && runtimeDir[0]) {
+        snprintf(path, maxLen, "%s/image-compressor.sock", runtimeDir);
+    } else {
+        snprintf(path, maxLen, "/tmp/image-compressor-%d.sock", (int)getuid());
+    }
+#endif
+}
+
+#ifndef _WIN32
+
+// ---- Line I/O (shared by server and client) ----
+
+int daemon_send_line(int fd, const char *line) {
+    size_t len = strlen(line);
+    char *buf = (char *)malloc(len + 2);
+    if (!buf) return -1;
+    memcpy(buf, line, len);
+    buf[len] = '\n';
+
+    const char *p = buf;
+    size_t left = len + 1;
+    int rc = 0;
+    while (left > 0) {
+        ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { rc = -1; break; }
+        p += n;
+        left -= (size_t)n;
+    }
+    free(buf);
+    return rc;
+}
+
+// Control traffic is tiny, so byte-at-a-time reads keep this simple
+int daemon_read_line(int fd, char *line, int maxLen) {
+    int len = 0;
+    while (1) {
+        char c;
+        ssize_t n = recv(fd, &c, 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return len > 0 ? len : -1;
+        if (c == '\n') break;
+        if (c == '\r') continue;
+        if (len < maxLen - 1) line[len++] = c;
+    }
+    line[len] = '\0';
+    return len;
+}
+
+// ---- Server ----
+
+typedef struct {
+    FolderJob **jobs;           // Job id = index + 1; jobs live until the daemon exits
+    int jobCount;
+    int jobCapacity;
+    pthread_mutex_t lock;
+} DaemonState;
+
+static DaemonState daemonState = { NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+static volatile sig_atomic_t daemonShutdown = 0;
+
+static void daemon_signal_handler(int sig) {
+    (void)sig;
+    daemonShutdown = 1;
+}
+
+// Single worker: runs queued jobs one after another (same as the GUI's JobWorker)
+static void* daemon_job_worker(void *arg) {
+    (void)arg;
+    while (!daemonShutdown) {
+        FolderJob *job = NULL;
+
+        pthread_mutex_lock(&daemonState.lock);
+        for (int i = 0; i < daemonState.jobCount; i++) {
+            if (daemonState.jobs[i]->status == JOB_PENDING) {
+                job = daemonState.jobs[i];
+                job->status = JOB_PROCESSING;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&daemonState.lock);
+
+        if (job) {
+            process_folder(job);
+        } else {
+            processor_sleep(200);
+        }
+    }
+    return NULL;
+}
+
+static FolderJob* find_job(int id) {
+    if (id < 1 || id > daemonState.jobCount) return NULL;
+    return daemonState.jobs[id - 1];
+}
+
+static void format_job_line(char *line, int maxLen, int id, const FolderJob *job) {
+    snprintf(line, maxLen, "JOB %d %d %d %d %d %d %s", id, job->status, job->doneFiles,
+             job->totalFiles, job->failedFiles, job->activeThreads, job->sourcePath);
+}
+
+// Apply one "key=value" field of a SUBMIT line
+// Returns: 0 if applied, -1 for an unknown key, -2 for a value this build can't use
+static int apply_config_field(CompressionConfig *config, const char *field) {
+    const char *eq = strchr(field, '=');
+    if (!eq) return -1;
+    int keyLen = (int)(eq - field);
+    const char *value = eq + 1;
+
+#define CONFIG_KEY(name, member) \
+    if (keyLen == (int)strlen(name) && strncmp(field, name, keyLen) == 0) { config->member = atoi(value); return 0; }
+    CONFIG_KEY("quality", quality)
+    CONFIG_KEY("speed", speed)
+    CONFIG_KEY("threads", threads)
+    CONFIG_KEY("pin", pinThreads)
+    CONFIG_KEY("background", background)
+    CONFIG_KEY("cpu_limit", cpuLimit)
+    CONFIG_KEY("memory_limit", memoryLimitMB)
+    CONFIG_KEY("isolate", isolate)
+    CONFIG_KEY("lease", useLeases)
+    CONFIG_KEY("lease_ttl", leaseTtl)
+    CONFIG_KEY("read_ahead", readAhead)
+    CONFIG_KEY("read_ahead_mb", readAheadMB)
+    CONFIG_KEY("serial_writes", serialWrites)
+    CONFIG_KEY("write_queue_mb", writeQueueMB)
+    CONFIG_KEY("sync_writes", syncWrites)
+    CONFIG_KEY("drop_cache", dropCache)
+    CONFIG_KEY("direct_io", directIO)
+    CONFIG_KEY("disk_order", diskOrder)
+    CONFIG_KEY("decoders", decoders)
+    CONFIG_KEY("decode_queue_mb", decodeQueueMB)
+    CONFIG_KEY("no_tail_boost", noTailBoost)
+    CONFIG_KEY("max_width", maxWidth)
+    CONFIG_KEY("max_height", maxHeight)
+    CONFIG_KEY("segment_height", segmentHeight)
+#undef CONFIG_KEY
+
+    if (keyLen == 5 && strncmp(field, "shard", 5) == 0) {
+        return sscanf(value, "%d/%d", &config->shardIndex, &config->shardCount) == 2 ? 0 : -1;
+    }
+    if (keyLen == 7 && strncmp(field, "encoder", 7) == 0) {
+        // ENCODER_* number (what daemon_submit sends) or name, and built into libheif
+        int encoder = (*value >= '0' && *value <= '9') ? atoi(value) : processor_encoder_from_name(value);
+        if (encoder < 0 || encoder >= ENCODER_COUNT) return -2;
+        if (encoder != ENCODER_AUTO && !(processor_available_encoders() & (1 << encoder))) return -2;
+        config->encoder = encoder;
+        return 0;
+    }
+    if (keyLen == 14 && strncmp(field, "max_megapixels", 14) == 0) {
+        config->maxMegapixels = (float)atof(value);
+        return 0;
+    }
+    return -1;
+}
+
+static void handle_submit(int fd, char *args) {
+    char *saveptr = NULL;
+    char *folder = strtok_r(args, "\t", &saveptr);
+    if (!folder || !check_is_directory(folder)) {
+        daemon_send_line(fd, "ERR not a directory");
+        return;
+    }
+
+    FolderJob *job = (FolderJob *)calloc(1, sizeof(FolderJob));
+    if (!job) {
+        daemon_send_line(fd, "ERR out of memory");
+        return;
+    }
+    int cpus = get_cpu_count();
+    job->config.quality = 55;
+    job->config.speed = 6;
+    job->config.threads = cpus / 2 > 0 ? cpus / 2 : 1;
+    job->config.cpuLimit = 100;
+
+    char *field;
+    while ((field = strtok_r(NULL, "\t", &saveptr)) != NULL) {
+        int applied = apply_config_field(&job->config, field);
+        if (applied != 0) {
+            char reply[300];
+            snprintf(reply, sizeof(reply), "ERR %s %.200s", applied == -2 ? "unsupported value" : "unknown setting", field);
+            daemon_send_line(fd, reply);
+            free(job);
+            return;
+        }
+    }
+    if (job->config.threads < 1) job->config.threads = 1;
+
+    strncpy(job->sourcePath, folder, sizeof(job->sourcePath) - 1);
+    get_output_folder_path(job->sourcePath, job->outputPath, sizeof(job->outputPath));
+    job->status = JOB_PENDING;
+    processor_event_job_queued(job);
+
+    pthread_mutex_lock(&daemonState.lock);
+    if (daemonState.jobCount >= daemonState.jobCapacity) {
+        int capacity = daemonState.jobCapacity ? daemonState.jobCapacity * 2 : 64;
+        FolderJob **grown = (FolderJob **)realloc(daemonState.jobs, capacity * sizeof(FolderJob *));
+        if (!grown) {
+            pthread_mutex_unlock(&daemonState.lock);
+            free(job);
+            daemon_send_line(fd, "ERR out of memory");
+            return;
+        }
+        daemonState.jobs = grown;
+        daemonState.jobCapacity = capacity;
+    }
+    daemonState.jobs[daemonState.jobCount++] = job;
+    int id = daemonState.jobCount;
+    pthread_mutex_unlock(&daemonState.lock);
+
+    printf("Daemon: queued job %d: %s\n", id, job->sourcePath);
+    char reply[32];
+    snprintf(reply, sizeof(reply), "OK %d", id);
+    daemon_send_line(fd, reply);
+}
+
+static void handle_job_command(int fd, const char *verb, int id) {
+    const char *error = NULL;
+
+    pthread_mutex_lock(&daemonState.lock);
+    FolderJob *job = find_job(id);
+    if (!job) {
+        error = "ERR unknown job";
+    } else if (strcmp(verb, "PAUSE") == 0) {
+        if (job->status == JOB_PROCESSING) job->status = JOB_PAUSED;
+        else error = "ERR job is not running";
+    } else if (strcmp(verb, "RESUME") == 0) {
+        if (job->status == JOB_PAUSED) job->status = JOB_PROCESSING;
+        else error = "ERR job is not paused";
+    } else {
+        if (job->status == JOB_PENDING) job->status = JOB_STOPPED;
+        else if (job->status == JOB_PROCESSING || job->status == JOB_PAUSED) job->status = JOB_STOPPING;
+    }
+    pthread_mutex_unlock(&daemonState.lock);
+
+    daemon_send_line(fd, error ? error : "OK");
+}
+
+static void handle_status(int fd, int id) {
+    char line[700];
+
+    pthread_mutex_lock(&daemonState.lock);
+    int first = id > 0 ? id : 1;
+    int last = id > 0 ? id : daemonState.jobCount;
+    int known = id <= 0 || find_job(id) != NULL;
+    pthread_mutex_unlock(&daemonState.lock);
+
+    if (!known) {
+        daemon_send_line(fd, "ERR unknown job");
+        return;
+    }
+    for (int i = first; i <= last; i++) {
+        pthread_mutex_lock(&daemonState.lock);
+        format_job_line(line, sizeof(line), i, daemonState.jobs[i - 1]);
+        pthread_mutex_unlock(&daemonState.lock);
+        if (daemon_send_line(fd, line) != 0) return;
+    }
+    daemon_send_line(fd, "END");
+}
+
+// Stream a JOB line whenever a job's status or counters change
+static void handle_watch(int fd) {
+    char *lastSent = NULL;
+    int lastCount = 0;
+    char line[700];
+
+    while (!daemonShutdown) {
+        pthread_mutex_lock(&daemonState.lock);
+        int count = daemonState.jobCount;
+        pthread_mutex_unlock(&daemonState.lock);
+
+        if (count > lastCount) {
+            char *grown = (char *)realloc(lastSent, (size_t)count * sizeof(line));
+            if (!grown) break;
+            memset(grown + (size_t)lastCount * sizeof(line), 0, (size_t)(count - lastCount) * sizeof(line));
+            lastSent = grown;
+            lastCount = count;
+        }
+
+        for (int i = 1; i <= count; i++) {
+            pthread_mutex_lock(&daemonState.lock);
+            format_job_line(line, sizeof(line), i, daemonState.jobs[i - 1]);
+            pthread_mutex_unlock(&daemonState.lock);
+
+            char *previous = lastSent + (size_t)(i - 1) * sizeof(line);
+            if (strcmp(previous, line) == 0) continue;
+            if (daemon_send_line(fd, line) != 0) {
+                free(lastSent);
+                return;
+            }
+            strcpy(previous, line);
+        }
+        processor_sleep(DAEMON_WATCH_INTERVAL_MS);
+    }
+    free(lastSent);
+}
+
+static void handle_shutdown(int fd) {
+    pthread_mutex_lock(&daemonState.lock);
+    for (int i = 0; i < daemonState.jobCount; i++) {
+        FolderJob *job = daemonState.jobs[i];
+        if (job->status == JOB_PENDING) job->status = JOB_STOPPED;
+        else if (job->status == JOB_PROCESSING || job->status == JOB_PAUSED) job->status = JOB_STOPPING;
+    }
+    pthread_mutex_unlock(&daemonState.lock);
+    daemonShutdown = 1;
+    daemon_send_line(fd, "OK");
+}
+
+static void* daemon_client_thread(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    char line[2048];
+
+    while (!daemonShutdown && daemon_read_line(fd, line, sizeof(line)) >= 0) {
+        int id = 0;
+        if (strncmp(line, "SUBMIT\t", 7) == 0) {
+            handle_submit(fd, line + 7);
+        } else if (sscanf(line, "PAUSE %d", &id) == 1) {
+            handle_job_command(fd, "PAUSE", id);
+        } else if (sscanf(line, "RESUME %d", &id) == 1) {
+            handle_job_command(fd, "RESUME", id);
+        } else if (sscanf(line, "STOP %d", &id) == 1) {
+            handle_job_command(fd, "STOP", id);
+        } else if (strncmp(line, "STATUS", 6) == 0) {
+            if (sscanf(line, "STATUS %d", &id) != 1) id = 0;
+            handle_status(fd, id);
+        } else if (strcmp(line, "WATCH") == 0) {
+            handle_watch(fd);
+            break;
+        } else if (strcmp(line, "SHUTDOWN") == 0) {
+            handle_shutdown(fd);
+            break;
+        } else if (line[0] != '\0') {
+            daemon_send_line(fd, "ERR unknown command");
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+// Only the daemon's own user may talk to it: jobs read and write folders with its rights
+static int daemon_peer_allowed(int fd) {
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t length = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) != 0) return 0;
+    return cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) != 0) return 0;
+    return uid == getuid();
+#endif
+}
+
+int daemon_run(const char *socketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", socketPath);
+        return 1;
+    }
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+
+    // Refuse to start twice; otherwise clean up a stale socket file
+    int probe = daemon_connect(socketPath);
+    if (probe >= 0) {
+        close(probe);
+        fprintf(stderr, "Error: a daemon is already listening on %s\n", socketPath);
+        return 1;
+    }
+    unlink(socketPath);
+
+    // Created 0600 (the /tmp fallback is shared with other users)
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t oldMask = umask(077);
+    int bound = listenFd >= 0 && bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    umask(oldMask);
+    if (!bound || chmod(socketPath, 0600) != 0 || listen(listenFd, 16) != 0) {
+        fprintf(stderr, "Error: cannot listen on %s: %s\n", socketPath, strerror(errno));
+        if (listenFd >= 0) close(listenFd);
+        if (bound) unlink(socketPath);
+        return 1;
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, daemon_signal_handler);
+    signal(SIGTERM, daemon_signal_handler);
+
+    if (!processor_init()) {
+        close(listenFd);
+        unlink(socketPath);
+        return 1;
+    }
+
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, daemon_job_worker, NULL) != 0) {
+        close(listenFd);
+        unlink(socketPath);
+        return 1;
+    }
+    printf("Daemon listening on %s\n", socketPath);
+
+    while (!daemonShutdown) {
+        struct pollfd pfd = { listenFd, POLLIN, 0 };
+        if (poll(&pfd, 1, 500) <= 0) continue;
+
+        int clientFd = accept(listenFd, NULL, NULL);
+        if (clientFd < 0) continue;
+        if (!daemon_peer_allowed(clientFd)) {
+            fprintf(stderr, "Daemon: refused a connection from another user\n");
+            close(clientFd);
+            continue;
+        }
+
+        pthread_t client;
+        if (pthread_create(&client, NULL, daemon_client_thread, (void *)(intptr_t)clientFd) == 0) {
+            pthread_detach(client);
+        } else {
+            close(clientFd);
+        }
+    }
+
+    printf("Daemon shutting down\n");
+    close(listenFd);
+    unlink(socketPath);
+
+    // Let the running job wind down (SIGINT/SIGTERM skip the SHUTDOWN bookkeeping)
+    pthread_mutex_lock(&daemonState.lock);
+    for (int i = 0; i < daemonState.jobCount; i++) {
+        FolderJob *job = daemonState.jobs[i];
+        if (job->status == JOB_PROCESSING || job->status == JOB_PAUSED) job->status = JOB_STOPPING;
+    }
+    pthread_mutex_unlock(&daemonState.lock);
+    pthread_join(worker, NULL);
+
+    processor_shutdown();
+    return 0;
+}
+
+// ---- Client ----
+
+int daemon_connect(const char *socketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) return -1;
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void daemon_close(int fd) {
+    if (fd >= 0) close(fd);
+}
+
+int daemon_submit(int fd, const char *folder, const CompressionConfig *config) {
+    char line[2048];
+    snprintf(line, sizeof(line),
+             "SUBMIT\t%s\tquality=%d\tspeed=%d\tthreads=%d\tpin=%d\tbackground=%d\tcpu_limit=%d"
+             "\tmemory_limit=%d\tisolate=%d\tshard=%d/%d\tlease=%d\tlease_ttl=%d\tread_ahead=%d\tread_ahead_mb=%d"
+             "\tserial_writes=%d\twrite_queue_mb=%d\tsync_writes=%d\tdrop_cache=%d\tdirect_io=%d"
+             "\tdisk_order=%d\tdecoders=%d\tdecode_queue_mb=%d"
+             "\tencoder=%d\tno_tail_boost=%d\tmax_width=%d\tmax_height=%d\tmax_megapixels=%g\tsegment_height=%d",
+             folder, config->quality, config->speed, config->threads, config->pinThreads,
+             config->background, config->cpuLimit, config->memoryLimitMB, config->isolate,
+             config->shardIndex, config->shardCount, config->useLeases, config->leaseTtl,
+             config->readAhead, config->readAheadMB, config->serialWrites, config->writeQueueMB,
+             config->syncWrites, config->dropCache, config->directIO,
+             config->diskOrder, config->decoders, config->decodeQueueMB,
+             config->encoder, config->noTailBoost, config->maxWidth, config->maxHeight,
+             (double)config->maxMegapixels, config->segmentHeight);
+
+    char reply[256];
+    int id = -1;
+    if (daemon_send_line(fd, line) != 0 || daemon_read_line(fd, reply, sizeof(reply)) < 0) return -1;
+    if (sscanf(reply, "OK %d", &id) != 1) {
+        fprintf(stderr, "Daemon: %s\n", reply);
+        return -1;
+    }
+    return id;
+}
+
+int daemon_job_command(int fd, const char *verb, int jobId) {
+    char line[64], reply[256];
+    snprintf(line, sizeof(line), "%s %d", verb, jobId);
+    if (daemon_send_line(fd, line) != 0 || daemon_read_line(fd, reply, sizeof(reply)) < 0) return -1;
+    return strcmp(reply, "OK") == 0 ? 0 : -1;
+}
+
+int daemon_query_job(int fd, int jobId, FolderJob *out) {
+    char line[700];
+    snprintf(line, sizeof(line), "STATUS %d", jobId);
+    if (daemon_send_line(fd, line) != 0) return -1;
+
+    int found = -1;
+    while (daemon_read_line(fd, line, sizeof(line)) >= 0) {
+        if (strcmp(line, "END") == 0) return found;
+        if (strncmp(line, "ERR", 3) == 0) return -1;
+
+        int id, status, done, total, failed, active;
+        if (sscanf(line, "JOB %d %d %d %d %d %d", &id, &status, &done, &total, &failed, &active) == 6 && id == jobId) {
+            out->status = status;
+            out->doneFiles = done;
+            out->totalFiles = total;
+            out->failedFiles = failed;
+            out->activeThreads = active;
+            out->progress = total > 0 ? done * 100 / total : 0;
+            found = 0;
+        }
+    }
+    return -1;
+}
+
+#else
+
+int daemon_send_line(int fd, const char *line) { (void)fd; (void)line; return -1; }
+int daemon_read_line(int fd, char *line, int maxLen) { (void)fd; (void)line; (void)maxLen; return -1; }
+
+int daemon_run(const char *socketPath) {
+    (void)socketPath;
+    fprintf(stderr, "Daemon mode is not supported on Windows\n");
+    return 1;
+}
+
+int daemon_connect(const char *socketPath) { (void)socketPath; return -1; }
+void daemon_close(int fd) { (void)fd; }
+int daemon_submit(int fd, const char *folder, const CompressionConfig *config) { (void)fd; (void)folder; (void)config; return -1; }
+int daemon_job_command(int fd, const char *verb, int jobId) { (void)fd; (void)verb; (void)jobId; return -1; }
+int daemon_query_job(int fd, int jobId, FolderJob *out) { (void)fd; (void)jobId; (void)out; return -1; }
+
+#endif
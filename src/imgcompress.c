@@ -0,0 +1,176 @@
+/*
+ * imgcompress.c - libimgcompress, embeddable API over processor.c
+ *
+ * This file ONLY uses processor.h, never vips or raylib directly.
+ *
+ * Build (Linux):
+ *   gcc -shared -fPIC imgcompress.c processor.c -o libimgcompress.so $(pkg-config --cflags --libs vips) -lm -lpthread -ldl -lrt
+ */
+
+#include "imgcompress.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+struct ImgcJob {
+    FolderJob job;
+    ImgcCallbacks callbacks;
+    pthread_t thread;
+    pthread_mutex_t lock;      // Serializes status changes from the caller
+    pthread_cond_t joinedCond; // Broadcast once the job thread has been joined
+    int joinState;             // JOIN_*, guarded by lock
+};
+
+#define JOIN_NONE    0
+#define JOIN_RUNNING 1          // One waiter is in pthread_join, the others wait for it
+#define JOIN_DONE    2
+
+static ImgcAllocator allocator;
+
+static void* imgc_alloc(size_t size) {
+    return allocator.alloc ? allocator.alloc(size, allocator.userData) : malloc(size);
+}
+
+void imgc_free(void *ptr) {
+    if (!ptr) return;
+    if (allocator.free) allocator.free(ptr, allocator.userData);
+    else free(ptr);
+}
+
+// Adapter so processor_compress_buffer() allocates through the hooks
+static void* imgc_alloc_hook(size_t size, void *allocData) {
+    (void)allocData;
+    return imgc_alloc(size);
+}
+
+int imgc_init(const ImgcAllocator *custom) {
+    memset(&allocator, 0, sizeof(allocator));
+    if (custom) allocator = *custom;
+    return processor_init_embedded();
+}
+
+void imgc_shutdown(void) {
+    processor_shutdown();
+}
+
+void imgc_default_config(CompressionConfig *config) {
+    int cpus = get_cpu_count();
+    memset(config, 0, sizeof(*config));
+    config->quality = 55;
+    config->speed = 6;
+    config->threads = cpus / 2 > 0 ? cpus / 2 : 1;
+    config->cpuLimit = 100;
+}
+
+int imgc_compress_buffer(const void *input, size_t inputSize, const CompressionConfig *config,
+                         void **output, size_t *outputSize) {
+    if (!input || inputSize == 0 || !config || !output || !outputSize) return -1;
+    return processor_compress_buffer(input, inputSize, config, imgc_alloc_hook, NULL, output, outputSize);
+}
+
+void imgc_thread_cleanup(void) {
+    processor_thread_cleanup();
+}
+
+// ---- Folder jobs ----
+
+static void job_image_done(FolderJob *job, const char *name, int failed) {
+    ImgcJob *handle = (ImgcJob *)job->callbackData;
+    (void)failed;
+    if (handle->callbacks.onProgress) {
+        handle->callbacks.onProgress(handle, job->doneFiles, job->totalFiles, job->failedFiles,
+                                     name, handle->callbacks.userData);
+    }
+}
+
+static void* job_thread(void *arg) {
+    ImgcJob *handle = (ImgcJob *)arg;
+    process_folder(&handle->job);
+    // NOTE: no processor_thread_cleanup() here, same as the GUI worker
+    if (handle->callbacks.onComplete) {
+        handle->callbacks.onComplete(handle, handle->job.status, handle->callbacks.userData);
+    }
+    return NULL;
+}
+
+ImgcJob* imgc_job_start(const char *folder, const CompressionConfig *config, const ImgcCallbacks *callbacks) {
+    if (!folder || !config || !check_is_directory(folder)) return NULL;
+
+    ImgcJob *handle = (ImgcJob *)imgc_alloc(sizeof(ImgcJob));
+    if (!handle) return NULL;
+    memset(handle, 0, sizeof(*handle));
+
+    strncpy(handle->job.sourcePath, folder, sizeof(handle->job.sourcePath) - 1);
+    get_output_folder_path(handle->job.sourcePath, handle->job.outputPath, sizeof(handle->job.outputPath));
+    handle->job.config = *config;
+    // Isolated encoders re-exec /proc/self/exe, which is the host application here
+    handle->job.config.isolate = 0;
+    handle->job.onImageDone = job_image_done;
+    handle->job.callbackData = handle;
+    if (callbacks) handle->callbacks = *callbacks;
+    pthread_mutex_init(&handle->lock, NULL);
+    pthread_cond_init(&handle->joinedCond, NULL);
+    
+    // Mark as processing before the thread exists so an early stop isn't lost
+    handle->job.status = JOB_PROCESSING;
+    if (pthread_create(&handle->thread, NULL, job_thread, handle) != 0) {
+        pthread_cond_destroy(&handle->joinedCond);
+        pthread_mutex_destroy(&handle->lock);
+        imgc_free(handle);
+        return NULL;
+    }
+    return handle;
+}
+
+void imgc_job_pause(ImgcJob *job) {
+    pthread_mutex_lock(&job->lock);
+    if (job->job.status == JOB_PROCESSING) job->job.status = JOB_PAUSED;
+    pthread_mutex_unlock(&job->lock);
+}
+
+void imgc_job_resume(ImgcJob *job) {
+    pthread_mutex_lock(&job->lock);
+    if (job->job.status == JOB_PAUSED) job->job.status = JOB_PROCESSING;
+    pthread_mutex_unlock(&job->lock);
+}
+
+void imgc_job_stop(ImgcJob *job) {
+    pthread_mutex_lock(&job->lock);
+    if (job->job.status == JOB_PROCESSING || job->job.status == JOB_PAUSED) job->job.status = JOB_STOPPING;
+    pthread_mutex_unlock(&job->lock);
+}
+
+int imgc_job_get_progress(ImgcJob *job, int *done, int *total, int *failed) {
+    if (done) *done = job->job.doneFiles;
+    if (total) *total = job->job.totalFiles;
+    if (failed) *failed = job->job.failedFiles;
+    return job->job.status;
+}
+
+int imgc_job_wait(ImgcJob *job) {
+    pthread_mutex_lock(&job->lock);
+    if (job->joinState == JOIN_NONE) {
+        job->joinState = JOIN_RUNNING;
+        pthread_mutex_unlock(&job->lock);
+        pthread_join(job->thread, NULL);
+        pthread_mutex_lock(&job->lock);
+        job->joinState = JOIN_DONE;
+        pthread_cond_broadcast(&job->joinedCond);
+    }
+    while (job->joinState != JOIN_DONE) {
+        pthread_cond_wait(&job->joinedCond, &job->lock);
+    }
+    int status = job->job.status;
+    pthread_mutex_unlock(&job->lock);
+    return status;
+}
+
+void imgc_job_destroy(ImgcJob *job) {
+    if (!job) return;
+    imgc_job_stop(job);
+    imgc_job_wait(job);
+    pthread_cond_destroy(&job->joinedCond);
+    pthread_mutex_destroy(&job->lock);
+    imgc_free(job);
+}
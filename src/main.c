@@ -6,16 +6,17 @@
  * The processor.c file handles all vips operations.
  * 
  * Build (Windows MSYS2):
- *   gcc main.c processor.c -o compressor.exe $(pkg-config --cflags --libs vips) -lraylib -lgdi32 -lwinmm -lopengl32
+ *   gcc main.c processor.c daemon.c -o compressor.exe $(pkg-config --cflags --libs vips) -lraylib -lgdi32 -lwinmm -lopengl32 -lpsapi
  * 
  * Build (Linux):
- *   gcc main.c processor.c -o compressor $(pkg-config --cflags --libs vips) -lraylib -lGL -lm -lpthread -ldl -lrt -lX11
+ *   gcc main.c processor.c daemon.c -o compressor $(pkg-config --cflags --libs vips) -lraylib -lGL -lm -lpthread -ldl -lrt -lX11
  */
 
 #ifndef MAIN_C_HEADERS
 #define MAIN_C_HEADERS
 #include "raylib.h"
 #include "processor.h"
+#include "daemon.h"
 #include "font_data.h"
 #include <stdio.h>
 #include <string.h>
@@ -34,6 +35,14 @@ pthread_mutex_t jobMutex = PTHREAD_MUTEX_INITIALIZER;
 // Global font
 Font guiFont;
 
+// Daemon connection (thin-client mode), -1 when jobs run in this process
+// Set at startup; only DaemonSync talks to the daemon
+int daemonFd = -1;
+
+// job->remoteId of a dropped folder DaemonSync hasn't submitted yet
+#define REMOTE_QUEUED     -1
+#define REMOTE_SUBMITTING -2
+
 // Worker thread function
 void* JobWorker(void* arg) {
     printf("Worker: Thread started\n");
@@ -42,7 +51,7 @@ void* JobWorker(void* arg) {
 
         pthread_mutex_lock(&jobMutex);
         for (int i = 0; i < jobCount; i++) {
-            if (jobs[i] && jobs[i]->status == JOB_PENDING) {
+            if (jobs[i] && jobs[i]->status == JOB_PENDING && jobs[i]->remoteId == 0) {
                 currentJob = jobs[i];
                 // Mark as processing immediately to avoid double-processing
                 currentJob->status = JOB_PROCESSING;
@@ -65,6 +74,97 @@ void* JobWorker(void* arg) {
     return NULL;
 }
 
+// Job mirroring a daemon job, NULL if it was removed (call with jobMutex held)
+static FolderJob* FindRemoteJob(int remoteId) {
+    for (int i = 0; i < jobCount; i++) {
+        if (jobs[i] && jobs[i]->remoteId == remoteId) return jobs[i];
+    }
+    return NULL;
+}
+
+// Thin-client mode: submit dropped folders, mirror daemon jobs and forward
+// Pause/Resume/Stop clicks. The render loop takes jobMutex every frame, so
+// the socket round trips happen with it released: what to send is copied
+// under the lock, and the replies are applied under it again by job id.
+void* DaemonSync(void* arg) {
+    while (true) {
+        // Dropped folders, one at a time
+        char folder[512];
+        CompressionConfig config;
+        FolderJob *queued = NULL;
+        pthread_mutex_lock(&jobMutex);
+        queued = FindRemoteJob(REMOTE_QUEUED);
+        if (queued) {
+            queued->remoteId = REMOTE_SUBMITTING;
+            strncpy(folder, queued->sourcePath, sizeof(folder) - 1);
+            folder[sizeof(folder) - 1] = '\0';
+            config = queued->config;
+        }
+        pthread_mutex_unlock(&jobMutex);
+        if (queued) {
+            int remoteId = daemon_submit(daemonFd, folder, &config);
+            pthread_mutex_lock(&jobMutex);
+            FolderJob *job = FindRemoteJob(REMOTE_SUBMITTING);
+            if (job) {
+                job->remoteId = remoteId > 0 ? remoteId : 0;    // 0: fall back to running it here
+                job->remoteStatus = JOB_PENDING;
+            }
+            pthread_mutex_unlock(&jobMutex);
+            if (!job && remoteId > 0) daemon_job_command(daemonFd, "STOP", remoteId);   // Removed meanwhile
+            continue;
+        }
+        
+        // Mirrored jobs and the status the UI gave them
+        int remoteIds[MAX_JOBS], statuses[MAX_JOBS], remoteStatuses[MAX_JOBS];
+        int count = 0;
+        pthread_mutex_lock(&jobMutex);
+        for (int i = 0; i < jobCount; i++) {
+            if (!jobs[i] || jobs[i]->remoteId <= 0) continue;
+            remoteIds[count] = jobs[i]->remoteId;
+            statuses[count] = jobs[i]->status;
+            remoteStatuses[count] = jobs[i]->remoteStatus;
+            count++;
+        }
+        pthread_mutex_unlock(&jobMutex);
+        
+        for (int i = 0; i < count; i++) {
+            // The UI changed the status locally: tell the daemon
+            if (statuses[i] != remoteStatuses[i]) {
+                if (statuses[i] == JOB_PAUSED) {
+                    daemon_job_command(daemonFd, "PAUSE", remoteIds[i]);
+                } else if (statuses[i] == JOB_STOPPING) {
+                    daemon_job_command(daemonFd, "STOP", remoteIds[i]);
+                } else if (statuses[i] == JOB_PROCESSING && remoteStatuses[i] == JOB_PAUSED) {
+                    daemon_job_command(daemonFd, "RESUME", remoteIds[i]);
+                }
+            }
+            
+            FolderJob reply;
+            memset(&reply, 0, sizeof(reply));
+            int ok = daemon_query_job(daemonFd, remoteIds[i], &reply) == 0;
+            
+            pthread_mutex_lock(&jobMutex);
+            FolderJob *job = FindRemoteJob(remoteIds[i]);
+            if (job && ok) {
+                // A click made meanwhile wins; it's sent on the next pass
+                if (job->status == statuses[i]) job->status = reply.status;
+                job->remoteStatus = reply.status;
+                job->doneFiles = reply.doneFiles;
+                job->totalFiles = reply.totalFiles;
+                job->failedFiles = reply.failedFiles;
+                job->activeThreads = reply.activeThreads;
+                job->progress = reply.progress;
+            } else if (job) {
+                job->status = JOB_ERROR;
+                job->remoteStatus = JOB_ERROR;
+            }
+            pthread_mutex_unlock(&jobMutex);
+        }
+        processor_sleep(500);
+    }
+    return NULL;
+}
+
 // Use check_is_directory from processor.c (handles unicode paths on Windows)
 #define IsPathDirectory check_is_directory
 
@@ -109,6 +209,13 @@ void AddFolder(const char *path, CompressionConfig *config) {
     job->currentFile[0] = '\0';
     job->config = *config;
     
+    // Thin-client mode: the daemon runs the job, we only mirror it
+    // (DaemonSync submits it, this is the render thread)
+    if (daemonFd >= 0) {
+        job->remoteId = REMOTE_QUEUED;
+        job->remoteStatus = JOB_PENDING;
+    }
+    
     jobCount++;
     printf("AddFolder: Added %s (jobCount: %d)\n", job->sourcePath, jobCount);
     pthread_mutex_unlock(&jobMutex);
@@ -153,6 +260,69 @@ bool GuiButton(Rectangle bounds, const char *text, int fontSize, Color baseColor
     return clicked;
 }
 
+// Draw one series as a line graph, newest sample at the right edge
+// The scale grows with the data; minMax keeps flat low values from filling the box
+void DrawSparkline(Rectangle bounds, const float *values, int count, float minMax, Color color) {
+    DrawRectangleRec(bounds, (Color){ 28, 28, 33, 255 });
+    DrawRectangleLinesEx(bounds, 1, (Color){ 50, 50, 58, 255 });
+
+    float maxValue = minMax;
+    for (int i = 0; i < count; i++) {
+        if (values[i] > maxValue) maxValue = values[i];
+    }
+    DrawTextEx(guiFont, TextFormat("%.0f", maxValue), (Vector2){ bounds.x + 3, bounds.y + 2 }, 10, 0, DARKGRAY);
+    if (count < 2) return;
+
+    float step = bounds.width / (float)(METRICS_HISTORY - 1);
+    float bottom = bounds.y + bounds.height - 2;
+    float height = bounds.height - 4;
+    Vector2 prev = { 0 };
+    for (int i = 0; i < count; i++) {
+        float v = values[i] < 0 ? 0 : values[i];
+        Vector2 point = { bounds.x + bounds.width - (float)(count - 1 - i) * step, bottom - height * v / maxValue };
+        if (i > 0) DrawLineV(prev, point, color);
+        prev = point;
+    }
+}
+
+// Timeline panel: the sampler's history (last 4 minutes) as sparklines
+void DrawTimelinePanel(Rectangle bounds) {
+    static MetricsSample history[METRICS_HISTORY];
+    static float series[5][METRICS_HISTORY];
+    int count = processor_metrics_history(history, METRICS_HISTORY);
+
+    for (int i = 0; i < count; i++) {
+        series[0][i] = history[i].cpuPercent;
+        series[1][i] = (float)history[i].rssBytes / (1024.0f * 1024.0f);
+        series[2][i] = (float)history[i].vips.trackedBytes / (1024.0f * 1024.0f);
+        series[3][i] = (history[i].readBytesPerSec + history[i].writeBytesPerSec) / (1024.0f * 1024.0f);
+        series[4][i] = history[i].imagesPerSec;
+    }
+
+    DrawRectangleRec(bounds, (Color){ 35, 35, 42, 255 });
+    DrawRectangleLinesEx(bounds, 1, (Color){ 50, 50, 58, 255 });
+    DrawTextEx(guiFont, "Gráficas / Timeline (4 min)", (Vector2){ bounds.x + 10, bounds.y + 8 }, 16, 0, WHITE);
+
+    const char *labels[5] = { "CPU %", "RAM MB", "vips MB", "Disco MB/s", "Imágenes/s" };
+    const float minMax[5] = { 100.0f, 64.0f, 16.0f, 1.0f, 1.0f };
+    const Color colors[5] = {
+        (Color){ 80, 140, 200, 255 }, (Color){ 100, 220, 100, 255 }, (Color){ 200, 140, 80, 255 },
+        (Color){ 160, 100, 180, 255 }, (Color){ 220, 200, 90, 255 }
+    };
+
+    float gap = 10.0f;
+    float cellWidth = (bounds.width - gap * 6) / 5.0f;
+    for (int s = 0; s < 5; s++) {
+        float x = bounds.x + gap + (cellWidth + gap) * s;
+        float current = count > 0 ? series[s][count - 1] : 0.0f;
+        DrawTextEx(guiFont, labels[s], (Vector2){ x, bounds.y + 32 }, 12, 0, GRAY);
+        const char *valueText = (current >= 100.0f || s == 0) ? TextFormat("%.0f", current) : TextFormat("%.1f", current);
+        Vector2 valueSize = MeasureTextEx(guiFont, valueText, 14, 0);
+        DrawTextEx(guiFont, valueText, (Vector2){ x + cellWidth - valueSize.x, bounds.y + 30 }, 14, 0, colors[s]);
+        DrawSparkline((Rectangle){ x, bounds.y + 50, cellWidth, bounds.height - 60 }, series[s], count, minMax[s], colors[s]);
+    }
+}
+
 // Draw Help Dialog
 void DrawHelpDialog(int screenWidth, int screenHeight, bool *showHelp) {
     Rectangle modal = { 50, 50, (float)screenWidth - 100, (float)screenHeight - 100 };
@@ -166,7 +336,10 @@ void DrawHelpDialog(int screenWidth, int screenHeight, bool *showHelp) {
     DrawTextEx(guiFont, "Ajustes de Compresión:", (Vector2){ 70, (float)y }, 16, 0, YELLOW); y += 22;
     DrawTextEx(guiFont, "- Calidad: Fidelidad visual (55-65 recomendado).", (Vector2){ 70, (float)y }, 15, 0, LIGHTGRAY); y += 20;
     DrawTextEx(guiFont, "- Compresión (CPU): 0 (rápido) a 10 (mejor/lento).", (Vector2){ 70, (float)y }, 15, 0, LIGHTGRAY); y += 20;
-    DrawTextEx(guiFont, "- Hilos: Imágenes procesadas a la vez (# de CPUs).", (Vector2){ 70, (float)y }, 15, 0, LIGHTGRAY); y += 35;
+    DrawTextEx(guiFont, "- Hilos: Imágenes procesadas a la vez (# de CPUs).", (Vector2){ 70, (float)y }, 15, 0, LIGHTGRAY); y += 20;
+    DrawTextEx(guiFont, "- Fijar CPUs: Cada hilo en un nodo NUMA (núcleos físicos primero).", (Vector2){ 70, (float)y }, 15, 0, LIGHTGRAY); y += 20;
+    DrawTextEx(guiFont, "- Segundo plano: Prioridad baja de CPU/disco para el trabajo.", (Vector2){ 70, (float)y }, 15, 0, LIGHTGRAY); y += 20;
+    DrawTextEx(guiFont, "- Límite CPU: Porcentaje máximo de CPU que usa el trabajo.", (Vector2){ 70, (float)y }, 15, 0, LIGHTGRAY); y += 35;
     
     DrawTextEx(guiFont, "Gestión de Procesos:", (Vector2){ 70, (float)y }, 16, 0, YELLOW); y += 22;
     DrawTextEx(guiFont, "- Pausar/Reanudar: Detiene/continúa el trabajo.", (Vector2){ 70, (float)y }, 15, 0, LIGHTGRAY); y += 20;
@@ -182,6 +355,11 @@ void DrawHelpDialog(int screenWidth, int screenHeight, bool *showHelp) {
 }
 
 int main(int argc, char **argv) {
+    // Isolated encoder child process (see CompressionConfig.isolate)
+    if (argc > 1 && strcmp(argv[1], ENCODER_SERVER_ARG) == 0) {
+        return processor_encoder_server_main();
+    }
+    
 #ifdef _WIN32
     // Disable memory-mapped files in libvips on Windows to prevent folder locking
     _putenv("VIPS_MMAP=0");
@@ -193,10 +371,13 @@ int main(int argc, char **argv) {
         printf("Make sure libvips is installed.\n");
         return 1;
     }
+    processor_metrics_start(500);
+    int availableEncoders = processor_available_encoders();
     
     // Initialize window
     const int screenWidth = 700;
-    const int screenHeight = 550;
+    const int screenHeight = 575;
+    const int timelineHeight = 150;    // Extra window height while the timeline panel is open
     
     SetConfigFlags(FLAG_WINDOW_HIGHDPI | FLAG_MSAA_4X_HINT); // Enable High-DPI support and anti-aliasing
     InitWindow(screenWidth, screenHeight, "Manga Optimizer - AVIF Compressor");
@@ -256,10 +437,21 @@ int main(int argc, char **argv) {
         SetTextureFilter(guiFont.texture, TEXTURE_FILTER_BILINEAR);
     }
     
-    // Get CPU count for thread limit
+    // Get CPU count for thread limit (affinity and container quota aware)
     int maxThreads = get_cpu_count();
     if (maxThreads < 1) maxThreads = 4;
-    if (maxThreads > 32) maxThreads = 32;
+    
+    // If a daemon is running, queue jobs there (warm libvips, one shared worker pool)
+    char daemonSocket[512];
+    daemon_default_socket_path(daemonSocket, sizeof(daemonSocket));
+    daemonFd = daemon_connect(daemonSocket);
+    if (daemonFd >= 0) {
+        printf("Connected to daemon at %s\n", daemonSocket);
+        pthread_t syncThread;
+        if (pthread_create(&syncThread, NULL, DaemonSync, NULL) == 0) {
+            pthread_detach(syncThread);
+        }
+    }
     
     // Start background worker thread
     pthread_t workerThread;
@@ -273,11 +465,17 @@ int main(int argc, char **argv) {
     CompressionConfig config = {
         .quality = 55,
         .speed = 6,
-        .threads = maxThreads / 2 > 0 ? maxThreads / 2 : 1  // Default to half of CPU count
+        .threads = maxThreads / 2 > 0 ? maxThreads / 2 : 1,  // Default to half of CPU count
+        .pinThreads = 0,
+        .background = 0,
+        .cpuLimit = 100,
+        .isolate = 0
     };
     
     bool isDragging = false;
     bool showHelp = false;
+    bool showTimeline = false;
+    int windowHeight = screenHeight;
     float jobScrollY = 0.0f;
     int totalJobsHeight = 0;
     
@@ -294,7 +492,7 @@ int main(int argc, char **argv) {
         }
         
         // Handle scrolling if mouse is over the jobs panel
-        Rectangle jobsPanelRec = { 15, 305, (float)screenWidth - 30, 210 };
+        Rectangle jobsPanelRec = { 15, 330, (float)screenWidth - 30, 210 };
         if (CheckCollisionPointRec(GetMousePosition(), jobsPanelRec)) {
             jobScrollY += GetMouseWheelMove() * 30.0f;
             
@@ -319,13 +517,26 @@ int main(int argc, char **argv) {
             showHelp = true;
         }
         
-        // Memory indicator (Dynamic)
-        long long ramUsed = get_process_ram_usage();
-        const char *ramText = TextFormat("RAM: %lld MB", ramUsed / (1024 * 1024));
+        // Memory indicator (latest sample from the metrics thread, no /proc reads here)
+        MetricsSample metrics;
+        if (!processor_metrics_latest(&metrics)) memset(&metrics, 0, sizeof(metrics));
+        long long ramUsed = metrics.rssBytes;
+        const char *ramText = TextFormat("RAM: %lld MB  CPU %.0f%%", ramUsed / (1024 * 1024), metrics.cpuPercent);
         if (ramUsed > 1024LL * 1024LL * 1024LL) {
-            ramText = TextFormat("RAM: %.2f GB", (double)ramUsed / (1024.0 * 1024.0 * 1024.0));
+            ramText = TextFormat("RAM: %.2f GB  CPU %.0f%%", (double)ramUsed / (1024.0 * 1024.0 * 1024.0), metrics.cpuPercent);
         }
         DrawTextEx(guiFont, ramText, (Vector2){ (float)screenWidth - 190, 48 }, 14, 0, (ramUsed > 800LL*1024*1024) ? ORANGE : (Color){ 100, 220, 100, 255 });
+        if (daemonFd >= 0) {
+            DrawTextEx(guiFont, "Daemon", (Vector2){ (float)screenWidth - 250, 48 }, 14, 0, (Color){ 100, 180, 255, 255 });
+        }
+        
+        // libvips share of the RAM (pixel buffers) and cache occupancy, right-aligned above
+        const VipsMemoryStats vipsStats = metrics.vips;
+        const char *vipsText = TextFormat("vips: %lld MB (pico %lld MB) | caché %d/%d | %d arch.",
+                                          vipsStats.trackedBytes / (1024 * 1024), vipsStats.trackedPeak / (1024 * 1024),
+                                          vipsStats.cacheOps, vipsStats.cacheMaxOps, vipsStats.openFiles);
+        Vector2 vipsSize = MeasureTextEx(guiFont, vipsText, 14, 0);
+        DrawTextEx(guiFont, vipsText, (Vector2){ (float)screenWidth - 60 - vipsSize.x, 30 }, 14, 0, (Color){ 150, 150, 160, 255 });
         
         // Drop zone
         Rectangle dropZone = { 20, 85, screenWidth - 40, 70 };
@@ -356,10 +567,30 @@ int main(int argc, char **argv) {
                  isDragging ? WHITE : (Color){ 180, 180, 190, 255 });
         
         // Settings panel
-        DrawRectangle(15, 170, screenWidth - 30, 120, (Color){ 35, 35, 42, 255 });
-        DrawRectangleLines(15, 170, screenWidth - 30, 120, (Color){ 50, 50, 58, 255 });
+        DrawRectangle(15, 170, screenWidth - 30, 145, (Color){ 35, 35, 42, 255 });
+        DrawRectangleLines(15, 170, screenWidth - 30, 145, (Color){ 50, 50, 58, 255 });
         DrawTextEx(guiFont, "Ajustes / Settings", (Vector2){ 25, 178 }, 16, 0, WHITE);
         
+        // CPU pinning toggle (physical cores first, SMT siblings last)
+        if (GuiButton((Rectangle){ (float)screenWidth - 145, 176, 120, 20 }, config.pinThreads ? "Fijar CPUs: On" : "Fijar CPUs: Off", 11,
+                      config.pinThreads ? (Color){ 60, 100, 60, 255 } : (Color){ 60, 60, 70, 255 })) {
+            config.pinThreads = !config.pinThreads;
+        }
+        
+        // Background priority toggle (applies to jobs added while enabled)
+        if (GuiButton((Rectangle){ (float)screenWidth - 270, 176, 120, 20 }, config.background ? "Segundo plano: On" : "Segundo plano: Off", 11,
+                      config.background ? (Color){ 60, 100, 60, 255 } : (Color){ 60, 60, 70, 255 })) {
+            config.background = !config.background;
+        }
+        
+#ifdef __linux__
+        // Crash isolation toggle (encode in recycled child processes)
+        if (GuiButton((Rectangle){ (float)screenWidth - 395, 176, 120, 20 }, config.isolate ? "Aislar procesos: On" : "Aislar procesos: Off", 11,
+                      config.isolate ? (Color){ 60, 100, 60, 255 } : (Color){ 60, 60, 70, 255 })) {
+            config.isolate = !config.isolate;
+        }
+#endif
+        
         // Quality slider
         DrawTextEx(guiFont, TextFormat("Calidad: %d", config.quality), (Vector2){ 30, 205 }, 16, 0, (Color){ 200, 200, 210, 255 });
         config.quality = DrawSlider((Rectangle){ 200, 203, 180, 16 }, config.quality, 0, 100, (Color){ 80, 160, 80, 255 });
@@ -375,14 +606,28 @@ int main(int argc, char **argv) {
         config.threads = DrawSlider((Rectangle){ 200, 253, 180, 16 }, config.threads, 1, maxThreads, (Color){ 200, 140, 80, 255 });
         DrawTextEx(guiFont, TextFormat("(max: %d CPUs)", maxThreads), (Vector2){ 400, 255 }, 14, 0, GRAY);
         
+        // AV1 encoder backend: cycles through the ones this build has
+        if (GuiButton((Rectangle){ (float)screenWidth - 145, 253, 120, 20 },
+                      TextFormat("Codificador: %s", processor_encoder_name(config.encoder)), 11,
+                      config.encoder != ENCODER_AUTO ? (Color){ 60, 100, 60, 255 } : (Color){ 60, 60, 70, 255 })) {
+            do {
+                config.encoder = (config.encoder + 1) % ENCODER_COUNT;
+            } while (!(availableEncoders & (1 << config.encoder)));
+        }
+        
+        // CPU cap slider (duty-cycles workers; 100 = no cap)
+        DrawTextEx(guiFont, TextFormat("Límite CPU: %d%%", config.cpuLimit), (Vector2){ 30, 280 }, 16, 0, (Color){ 200, 200, 210, 255 });
+        config.cpuLimit = DrawSlider((Rectangle){ 200, 278, 180, 16 }, config.cpuLimit, 10, 100, (Color){ 160, 100, 180, 255 });
+        DrawTextEx(guiFont, config.cpuLimit >= 100 ? "(sin límite)" : "(% de toda la CPU)", (Vector2){ 400, 280 }, 14, 0, GRAY);
+        
         // Jobs panel
-        DrawRectangle(15, 305, screenWidth - 30, 210, (Color){ 35, 35, 42, 255 });
-        DrawRectangleLines(15, 305, screenWidth - 30, 210, (Color){ 50, 50, 58, 255 });
-        DrawTextEx(guiFont, TextFormat("Trabajos / Jobs (%d)", jobCount), (Vector2){ 25, 313 }, 16, 0, WHITE);
+        DrawRectangle(15, 330, screenWidth - 30, 210, (Color){ 35, 35, 42, 255 });
+        DrawRectangleLines(15, 330, screenWidth - 30, 210, (Color){ 50, 50, 58, 255 });
+        DrawTextEx(guiFont, TextFormat("Trabajos / Jobs (%d)", jobCount), (Vector2){ 25, 338 }, 16, 0, WHITE);
         
         // Button to clear all finished jobs (Done, Error, Stopped)
         if (jobCount > 0) {
-            if (GuiButton((Rectangle){ (float)screenWidth - 135, 310, 110, 22 }, "Limpiar Listos", 12, (Color){ 60, 60, 70, 255 })) {
+            if (GuiButton((Rectangle){ (float)screenWidth - 135, 335, 110, 22 }, "Limpiar Listos", 12, (Color){ 60, 60, 70, 255 })) {
                 pthread_mutex_lock(&jobMutex);
                 for (int i = 0; i < jobCount; ) {
                     if (jobs[i] && (jobs[i]->status == JOB_COMPLETED || jobs[i]->status == JOB_ERROR || jobs[i]->status == JOB_STOPPED)) {
@@ -401,13 +646,13 @@ int main(int argc, char **argv) {
         }
         
         if (jobCount == 0) {
-            DrawTextEx(guiFont, "No hay trabajos. Arrastra una carpeta para comenzar.", (Vector2){ 40, 360 }, 15, 0, GRAY);
+            DrawTextEx(guiFont, "No hay trabajos. Arrastra una carpeta para comenzar.", (Vector2){ 40, 385 }, 15, 0, GRAY);
             totalJobsHeight = 0;
         } else {
             // Recorte para el área de la lista (clipping)
-            BeginScissorMode(16, 335, screenWidth - 32, 175);
+            BeginScissorMode(16, 360, screenWidth - 32, 175);
             
-            int yOffset = 345 + (int)jobScrollY;
+            int yOffset = 370 + (int)jobScrollY;
             int startY = yOffset;
             
             pthread_mutex_lock(&jobMutex);
@@ -416,7 +661,7 @@ int main(int argc, char **argv) {
                 if (!job) continue;
                 
                 // Skip rendering if far outside view for performance (optional)
-                if (yOffset > 550) { 
+                if (yOffset > 575) { 
                     yOffset += 60; 
                     continue; 
                 }
@@ -458,6 +703,9 @@ int main(int argc, char **argv) {
                 
                 // Row 1: Folder name
                 DrawTextEx(guiFont, displayPath, (Vector2){ 35, (float)yOffset }, 16, 0, WHITE);
+                if (job->config.background) {
+                    DrawTextEx(guiFont, "[bg]", (Vector2){ (float)screenWidth - 105, (float)yOffset + 2 }, 12, 0, GRAY);
+                }
                 
                 // Row 2: Progress bar + details
                 int detailsY = yOffset + 22;
@@ -473,9 +721,16 @@ int main(int argc, char **argv) {
                 // Progress text
                 if (job->status == JOB_PROCESSING || job->status == JOB_STOPPING) {
                     DrawTextEx(guiFont, TextFormat("%d/%d (Threads: %d)", job->doneFiles, job->totalFiles, job->activeThreads), (Vector2){ 440, (float)detailsY }, 14, 0, LIGHTGRAY);
+                    if (job->allowedThreads > 0) {
+                        DrawTextEx(guiFont, TextFormat("RAM: limitado a %d hilos", job->allowedThreads), (Vector2){ 440, (float)yOffset + 2 }, 12, 0, ORANGE);
+                    }
                 } else {
                     DrawTextEx(guiFont, TextFormat("%d/%d", job->doneFiles, job->totalFiles), (Vector2){ 460, (float)detailsY }, 14, 0, LIGHTGRAY);
                 }
+                if (job->failedFiles > 0) {
+                    float nameWidth = MeasureTextEx(guiFont, displayPath, 16, 0).x;
+                    DrawTextEx(guiFont, TextFormat("(%d errores)", job->failedFiles), (Vector2){ 45 + nameWidth, (float)yOffset + 2 }, 12, 0, (Color){ 255, 100, 100, 255 });
+                }
                 
                 // Status label
                 DrawTextEx(guiFont, statusText, (Vector2){ (float)screenWidth - 105, (float)detailsY }, 14, 0, statusColor);
@@ -528,13 +783,24 @@ int main(int argc, char **argv) {
             if (totalJobsHeight > 170) {
                 float scrollRatio = 170.0f / (float)totalJobsHeight;
                 float scrollThumbHeight = 170.0f * scrollRatio;
-                float scrollThumbY = 335.0f + (-jobScrollY / (float)totalJobsHeight) * 170.0f;
+                float scrollThumbY = 360.0f + (-jobScrollY / (float)totalJobsHeight) * 170.0f;
                 DrawRectangle(screenWidth - 12, (int)scrollThumbY, 4, (int)scrollThumbHeight, (Color){ 100, 100, 120, 255 });
             }
         }
         
+        // Timeline panel (collapsible, grows the window below the jobs panel)
+        if (showTimeline) {
+            DrawTimelinePanel((Rectangle){ 15, 545, (float)screenWidth - 30, (float)timelineHeight - 5 });
+        }
+        
         // Footer
-        DrawTextEx(guiFont, "v1.8 - raylib + libvips | UI Font: Noto Sans JP (Unicode Enabled)", (Vector2){ 20, (float)screenHeight - 22 }, 13, 0, DARKGRAY);
+        DrawTextEx(guiFont, "v1.8 - raylib + libvips | UI Font: Noto Sans JP (Unicode Enabled)", (Vector2){ 20, (float)windowHeight - 22 }, 13, 0, DARKGRAY);
+        if (GuiButton((Rectangle){ (float)screenWidth - 145, (float)windowHeight - 26, 120, 20 }, showTimeline ? "Gráficas: On" : "Gráficas: Off", 11,
+                      showTimeline ? (Color){ 60, 100, 60, 255 } : (Color){ 60, 60, 70, 255 })) {
+            showTimeline = !showTimeline;
+            windowHeight = screenHeight + (showTimeline ? timelineHeight : 0);
+            SetWindowSize(screenWidth, windowHeight);
+        }
         
         // Help Dialog (top layer)
         if (showHelp) DrawHelpDialog(screenWidth, screenHeight, &showHelp);
@@ -544,6 +810,7 @@ int main(int argc, char **argv) {
     
     UnloadFont(guiFont);
     CloseWindow();
+    processor_metrics_stop();
     processor_shutdown();
     
     // Final cleanup of remaining jobs
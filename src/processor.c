@@ -5,17 +5,27 @@
  * This file ONLY includes vips.h, never raylib.h to avoid conflicts.
  */
 
+#ifndef _WIN32
+    #define _GNU_SOURCE  // sched_getaffinity / CPU_SET helpers
+#endif
+
 #include "processor.h"
+#include "stats.h"
 #include <vips/vips.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <ctype.h>
 #include <pthread.h>
 #ifdef _WIN32
     #include <windows.h>
     #include <shlobj.h>
     #include <direct.h>
     #include <psapi.h>
+    #include <io.h>
+    #include <malloc.h>
     #define PATH_SEP '\\'
     #define PATH_SEP_STR "\\"
     #define my_mkdir(path) _mkdir(path)
@@ -23,11 +33,45 @@
     #include <sys/stat.h>
     #include <dirent.h>
     #include <unistd.h>
+    #include <sched.h>
+    #include <signal.h>
+    #include <errno.h>
+    #include <time.h>
+    #include <sys/resource.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <sys/socket.h>
+    #include <fcntl.h>
+    #include <utime.h>
+    #include <sys/mman.h>
+    #include <dlfcn.h>
+    #ifdef __linux__
+        #include <link.h>
+        #include <sys/syscall.h>
+        #include <sys/ioctl.h>
+        #include <linux/fs.h>
+        #include <linux/fiemap.h>
+    #endif
     #define PATH_SEP '/'
     #define PATH_SEP_STR "/"
     #define my_mkdir(path) mkdir(path, 0755)
 #endif
 
+// Optional allocator (build with ALLOCATOR=mimalloc|jemalloc), see release_heap_memory()
+#if defined(USE_MIMALLOC)
+    #include <mimalloc.h>
+#elif defined(USE_JEMALLOC)
+    #include <jemalloc/jemalloc.h>
+#elif defined(__GLIBC__)
+    #include <malloc.h>
+    // glibc creates up to 8 arenas per core; every worker thread ends up with
+    // its own arena that keeps freed decode buffers. Cap it at one arena per
+    // MALLOC_CPUS_PER_ARENA usable CPUs (the most workers a job normally runs),
+    // never below MALLOC_MIN_ARENAS, unless the user set MALLOC_ARENA_MAX.
+    #define MALLOC_CPUS_PER_ARENA 2
+    #define MALLOC_MIN_ARENAS     2
+#endif
+
 #ifdef _WIN32
 // Helper: Convert UTF-8 string to Wide string
 static int utf8_to_wide(const char *utf8, wchar_t *wide, int wideSize) {
@@ -57,6 +101,12 @@ static const char *SUPPORTED_EXTENSIONS[] = {
 };
 
 static int vips_initialized = 0;
+static int processorEmbedded = 0;   // Inside a host program: leave process-wide settings alone
+
+int processor_init_embedded(void) {
+    processorEmbedded = 1;
+    return processor_init();
+}
 
 int processor_init(void) {
     if (vips_initialized) return 1;
@@ -69,6 +119,15 @@ int processor_init(void) {
     // Set concurrency
     vips_concurrency_set(1);
     
+#if defined(MALLOC_CPUS_PER_ARENA)
+    // glibc fixes the limit when the first thread arena is created, so it is
+    // set here, before any worker exists
+    if (!processorEmbedded && !getenv("MALLOC_ARENA_MAX")) {
+        int arenas = get_cpu_count() / MALLOC_CPUS_PER_ARENA;
+        mallopt(M_ARENA_MAX, arenas > MALLOC_MIN_ARENAS ? arenas : MALLOC_MIN_ARENAS);
+    }
+#endif
+    
 #ifdef _WIN32
     // Completely disable file caching on Windows to prevent folder locking issues
     // This ensures Windows can delete folders immediately after processing
@@ -101,6 +160,22 @@ void processor_thread_cleanup(void) {
     vips_thread_shutdown();
 }
 
+// Return freed heap memory to the OS so RSS drops back between jobs
+static void release_heap_memory(void) {
+#if defined(USE_MIMALLOC)
+    mi_collect(true);
+#elif defined(USE_JEMALLOC)
+    char purge[64];
+    snprintf(purge, sizeof(purge), "arena.%u.purge", (unsigned)MALLCTL_ARENAS_ALL);
+    mallctl(purge, NULL, NULL, NULL, 0);
+#elif defined(_WIN32)
+    _heapmin();
+    HeapCompact(GetProcessHeap(), 0);
+#elif defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
+
 // Check if filename has a supported image extension
 static int is_supported_image(const char *filename) {
     if (!filename) return 0;
@@ -129,14 +204,293 @@ void get_output_folder_path(const char *inputPath, char *outputPath, int maxLen)
     snprintf(outputPath, maxLen, "%s (compressed)", inputPath);
 }
 
-// Get the number of logical CPU cores available
+// File name part of a path (accepts both separators on Windows)
+static const char* path_basename(const char *path) {
+    const char *name = path;
+    for (const char *p = path; *p; p++) {
+        if (*p == PATH_SEP || *p == '/') name = p + 1;
+    }
+    return name;
+}
+
+#ifdef __linux__
+// Read the first line of a small sysfs/procfs file. Returns 1 on success.
+static int read_line_file(const char *path, char *buf, int bufSize) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    int ok = fgets(buf, bufSize, f) != NULL;
+    fclose(f);
+    return ok;
+}
+
+// Our own cgroup while a job's CPU cap is set through it (see cpu_cap_apply):
+// its cpu.max is the job's cap, not a limit on the CPUs we may use
+static char cpuCapGroup[700] = "";
+
+// CPU limit imposed by cgroup quotas (cgroup v2 cpu.max, v1 cfs_quota_us)
+// Walks up the cgroup hierarchy since any ancestor can carry the quota.
+// Returns 0 when there is no limit.
+static int get_cgroup_cpu_limit(void) {
+    char line[512];
+    char cgPath[512] = "";
+    int limit = 0;
+
+    // cgroup v2: "0::/some/path"
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, "0::", 3) == 0) {
+                strncpy(cgPath, line + 3, sizeof(cgPath) - 1);
+                cgPath[strcspn(cgPath, "\n")] = '\0';
+                break;
+            }
+        }
+        fclose(f);
+    }
+
+    while (1) {
+        char dir[600], file[620];
+        snprintf(dir, sizeof(dir), "/sys/fs/cgroup%s", cgPath);
+        snprintf(file, sizeof(file), "%s/cpu.max", dir);
+        long long quota = 0, period = 0;
+        if (strcmp(dir, cpuCapGroup) != 0 && read_line_file(file, line, sizeof(line)) &&
+            sscanf(line, "%lld %lld", &quota, &period) == 2 && quota > 0 && period > 0) {
+            int cpus = (int)((quota + period - 1) / period);
+            if (limit == 0 || cpus < limit) limit = cpus;
+        }
+        char *slash = strrchr(cgPath, '/');
+        if (!slash || cgPath[0] == '\0') break;
+        *slash = '\0';
+    }
+    if (limit > 0) return limit;
+
+    // cgroup v1 fallback
+    long long quota = 0, period = 0;
+    if (read_line_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", line, sizeof(line))) quota = atoll(line);
+    if (read_line_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us", line, sizeof(line))) period = atoll(line);
+    if (quota > 0 && period > 0) return (int)((quota + period - 1) / period);
+    return 0;
+}
+#endif
+
+// Get the number of CPU cores this process may actually use
+// On Linux this honors the affinity mask and cgroup CPU quotas (containers)
 int get_cpu_count(void) {
 #ifdef _WIN32
+    DWORD_PTR processMask, systemMask;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) && processMask) {
+        int n = 0;
+        for (; processMask; processMask &= processMask - 1) n++;
+        return n;
+    }
     SYSTEM_INFO si;
     GetSystemInfo(&si);
     return (int)si.dwNumberOfProcessors;
 #else
-    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        int n = CPU_COUNT(&set);
+        if (n > 0) count = n;
+    }
+    int quota = get_cgroup_cpu_limit();
+    if (quota > 0 && quota < count) count = quota;
+#endif
+    return count > 0 ? count : 1;
+#endif
+}
+
+#ifdef __linux__
+// CPU pinning order: one hardware thread per physical core first, grouped by
+// NUMA node and package so consecutive workers stay node-local; SMT siblings last.
+// A worker is bound to the whole node of its CPU in that order, not to the CPU
+// itself: vips and the AV1 encoder run the image on helper threads that inherit
+// the mask and are later reused by other workers and jobs, and on one CPU they
+// would all pile up there.
+typedef struct {
+    int cpu;
+    int node;
+    int package;
+    int core;
+    int smtRank;    // 0 = first thread of its core, 1+ = siblings
+} CpuSlot;
+
+static int cpuOrder[CPU_SETSIZE];
+static int cpuOrderNode[CPU_SETSIZE];  // NUMA node of cpuOrder[i]
+static int cpuOrderCount = 0;
+static pthread_once_t cpuOrderOnce = PTHREAD_ONCE_INIT;
+
+static int compare_cpu_slots(const void *a, const void *b) {
+    const CpuSlot *x = (const CpuSlot *)a;
+    const CpuSlot *y = (const CpuSlot *)b;
+    if (x->smtRank != y->smtRank) return x->smtRank - y->smtRank;
+    if (x->node != y->node) return x->node - y->node;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+static void build_cpu_order(void) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return;
+
+    CpuSlot *slots = (CpuSlot *)malloc(CPU_SETSIZE * sizeof(CpuSlot));
+    if (!slots) return;
+    int n = 0;
+    char path[128], line[256];
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+        CpuSlot *s = &slots[n++];
+        s->cpu = cpu;
+        s->node = 0;
+        s->package = 0;
+        s->core = cpu;
+        s->smtRank = 0;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        if (read_line_file(path, line, sizeof(line))) s->core = atoi(line);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        if (read_line_file(path, line, sizeof(line))) s->package = atoi(line);
+
+        // Rank among siblings: count lower-numbered siblings ("0,8" or "0-1")
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        if (read_line_file(path, line, sizeof(line))) {
+            char *p = line;
+            while (*p) {
+                int lo = (int)strtol(p, &p, 10), hi = lo;
+                if (*p == '-') hi = (int)strtol(p + 1, &p, 10);
+                for (int c = lo; c <= hi; c++) {
+                    if (c < cpu) s->smtRank++;
+                }
+                if (*p != ',') break;
+                p++;
+            }
+        }
+
+        // NUMA node is exposed as a "nodeN" entry in the cpu directory
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+        DIR *dir = opendir(path);
+        if (dir) {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+                    s->node = atoi(entry->d_name + 4);
+                    break;
+                }
+            }
+            closedir(dir);
+        }
+    }
+
+    qsort(slots, n, sizeof(CpuSlot), compare_cpu_slots);
+    for (int i = 0; i < n; i++) {
+        cpuOrder[i] = slots[i].cpu;
+        cpuOrderNode[i] = slots[i].node;
+    }
+    cpuOrderCount = n;
+    free(slots);
+}
+#endif
+
+// Pin the calling worker thread to the NUMA node of a CPU chosen by topology
+// (see build_cpu_order)
+static void pin_worker_thread(int workerIndex) {
+#ifdef _WIN32
+    DWORD_PTR processMask, systemMask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) || !processMask) return;
+    int count = 0;
+    for (DWORD_PTR m = processMask; m; m &= m - 1) count++;
+    int target = workerIndex % count;
+    for (int bit = 0; bit < (int)(sizeof(DWORD_PTR) * 8); bit++) {
+        if (!(processMask & ((DWORD_PTR)1 << bit))) continue;
+        if (target-- == 0) {
+            UCHAR node = 0;
+            ULONGLONG nodeMask = 0;
+            DWORD_PTR mask = processMask;
+            if (GetNumaProcessorNode((UCHAR)bit, &node) && GetNumaNodeProcessorMask(node, &nodeMask) &&
+                (processMask & (DWORD_PTR)nodeMask)) {
+                mask = processMask & (DWORD_PTR)nodeMask;
+            }
+            SetThreadAffinityMask(GetCurrentThread(), mask);
+            break;
+        }
+    }
+#elif defined(__linux__)
+    pthread_once(&cpuOrderOnce, build_cpu_order);
+    if (cpuOrderCount == 0) return;
+    int node = cpuOrderNode[workerIndex % cpuOrderCount];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < cpuOrderCount; i++) {
+        if (cpuOrderNode[i] == node) CPU_SET(cpuOrder[i], &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)workerIndex;
+#endif
+}
+
+// Lower the calling job thread (worker, decoder, read-ahead, writer) to
+// background priority (CPU and I/O). Only affects this thread, so the UI
+// thread and other jobs keep normal priority.
+static void set_worker_background_priority(void) {
+#ifdef _WIN32
+    // Lowers CPU, I/O and memory priority for this thread
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(__linux__)
+    // SCHED_IDLE only runs when nothing else wants the CPU; fall back to nice 19
+    struct sched_param param = { 0 };
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) {
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+    }
+#ifdef SYS_ioprio_set
+    // ioprio_set(IOPRIO_WHO_PROCESS, tid, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0))
+    const int ioprioWhoProcess = 1;
+    const int ioprioClassIdle = 3;
+    syscall(SYS_ioprio_set, ioprioWhoProcess, (int)syscall(SYS_gettid), ioprioClassIdle << 13);
+#endif
+#else
+    // Other POSIX: per-thread nice is not portable, lower the thread's scheduling priority
+    struct sched_param param;
+    int policy;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+        param.sched_priority = sched_get_priority_min(policy);
+        pthread_setschedparam(pthread_self(), policy, &param);
+    }
+#endif
+}
+
+// Monotonic clock in nanoseconds (for measuring intervals)
+static long long get_monotonic_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (long long)((double)counter.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+// Wall-clock milliseconds since the Unix epoch
+static long long get_unix_ms(void) {
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    ULARGE_INTEGER t;
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    return (long long)(t.QuadPart / 10000ULL) - 11644473600000LL;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 #endif
 }
 
@@ -188,104 +542,3617 @@ static long get_file_size(const char *path) {
     return size;
 }
 
-// Copy file (for cases where compression doesn't help)
-static int copy_file(const char *src, const char *dst) {
-    FILE *in = fopen(src, "rb");
-    if (!in) return -1;
-    
-    FILE *out = fopen(dst, "wb");
-    if (!out) {
-        fclose(in);
-        return -1;
+// Append a file's contents to an open stream
+static int copy_into(const char *src, FILE *out) {
+    FILE *in = fopen(src, "rb");
+    if (!in) return -1;
+    
+    char buffer[8192];
+    size_t bytes;
+    int result = 0;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, bytes, out) != bytes) {
+            result = -1;
+            break;
+        }
+    }
+    
+    fclose(in);
+    return result;
+}
+
+// Copy file (for cases where compression doesn't help)
+static int copy_file(const char *src, const char *dst) {
+    FILE *out = fopen(dst, "wb");
+    if (!out) return -1;
+    
+    int result = copy_into(src, out);
+    fclose(out);
+    return result;
+}
+
+// Flush a stream's data to the disk
+static int sync_file(FILE *f) {
+    if (fflush(f) != 0) return -1;
+#ifdef _WIN32
+    return _commit(_fileno(f));
+#else
+    return fsync(fileno(f));
+#endif
+}
+
+// Make renames inside a folder durable (no-op on Windows)
+static void sync_dir(const char *path) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+#else
+    (void)path;
+#endif
+}
+
+// ---- Page-cache hygiene (config.dropCache / config.directIO) ----
+// Huge batches otherwise push every source and output through the page cache
+// and evict everything else on the host. With dropCache each file is dropped
+// from the cache as soon as we're done with it. Outputs are written back
+// first (just that file's data, no fsync) so their pages can be dropped too.
+// Not available on Windows or macOS (no posix_fadvise).
+#define DIRECT_COPY_MIN_BYTES (8LL * 1024 * 1024)
+#define DIRECT_COPY_CHUNK     (1024 * 1024)
+#define DIRECT_ALIGN          4096
+
+// Drop a file's pages from the page cache; written = flush its dirty pages first
+static void drop_file_cache(const char *path, int written) {
+#ifdef POSIX_FADV_DONTNEED
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    if (written) {
+#ifdef __linux__
+        sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+        fdatasync(fd);
+#endif
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+#else
+    (void)path;
+    (void)written;
+#endif
+}
+
+#ifdef __linux__
+// Copy with O_DIRECT on both ends so neither file goes through the page cache
+// Returns: 0 on success, -1 on error (also when the filesystem has no O_DIRECT)
+static int copy_file_direct(const char *src, const char *dst, int sync) {
+    int in = open(src, O_RDONLY | O_DIRECT);
+    if (in < 0) return -1;
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, DIRECT_ALIGN, DIRECT_COPY_CHUNK) != 0) {
+        close(in);
+        close(out);
+        return -1;
+    }
+    
+    long long total = 0;
+    int result = 0;
+    int eof = 0;
+    while (!eof && result == 0) {
+        // Fill the whole chunk: read() may return less before EOF, and only
+        // the last block may be padded to the alignment (trimmed below)
+        size_t filled = 0;
+        while (filled < DIRECT_COPY_CHUNK) {
+            ssize_t n = read(in, (char *)buffer + filled, DIRECT_COPY_CHUNK - filled);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                result = -1;
+                break;
+            }
+            if (n == 0) {
+                eof = 1;
+                break;
+            }
+            filled += (size_t)n;
+        }
+        if (result != 0 || filled == 0) break;
+        
+        size_t padded = (filled + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+        if (padded != filled) memset((char *)buffer + filled, 0, padded - filled);
+        size_t written = 0;
+        while (written < padded) {
+            ssize_t n = write(out, (char *)buffer + written, padded - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                result = -1;
+                break;
+            }
+            written += (size_t)n;
+        }
+        total += (long long)filled;
+    }
+    if (result == 0 && ftruncate(out, total) != 0) result = -1;
+    if (result == 0 && sync && fsync(out) != 0) result = -1;
+    
+    free(buffer);
+    close(in);
+    close(out);
+    return result;
+}
+#endif
+
+// Copy a kept original; large files bypass the page cache with config.directIO
+static int copy_original(const char *src, const char *dst, const CompressionConfig *config, long long size) {
+#ifdef __linux__
+    if (config->directIO && size >= DIRECT_COPY_MIN_BYTES && copy_file_direct(src, dst, 0) == 0) return 0;
+#else
+    (void)config;
+    (void)size;
+#endif
+    return copy_file(src, dst);
+}
+
+// Read a whole file into a malloc'd buffer (read-ahead stage)
+// dropCache: drop its pages once read (we keep the copy)
+// Returns: buffer, or NULL on error
+static char* read_whole_file(const char *path, size_t *size, int dropCache) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buffer = length > 0 ? (char *)malloc((size_t)length) : NULL;
+    if (!buffer || fread(buffer, 1, (size_t)length, f) != (size_t)length) {
+        free(buffer);
+        fclose(f);
+        return NULL;
+    }
+#ifdef POSIX_FADV_DONTNEED
+    if (dropCache) posix_fadvise(fileno(f), 0, 0, POSIX_FADV_DONTNEED);
+#else
+    (void)dropCache;
+#endif
+    fclose(f);
+    *size = (size_t)length;
+    return buffer;
+}
+
+// Check if a file exists (handles unicode paths on Windows)
+static int file_exists(const char *path) {
+#ifdef _WIN32
+    wchar_t widePath[520];
+    if (utf8_to_wide(path, widePath, 520) == 0) return 0;
+    return GetFileAttributesW(widePath) != INVALID_FILE_ATTRIBUTES;
+#else
+    struct stat st;
+    return stat(path, &st) == 0;
+#endif
+}
+
+// Atomically move a finished file into place (handles unicode paths on Windows)
+static int rename_file(const char *src, const char *dst) {
+#ifdef _WIN32
+    wchar_t wideSrc[520], wideDst[520];
+    if (utf8_to_wide(src, wideSrc, 520) == 0 || utf8_to_wide(dst, wideDst, 520) == 0) return -1;
+    return MoveFileExW(wideSrc, wideDst, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+    return rename(src, dst);
+#endif
+}
+
+// Outputs are written to "<path>.<host>.<pid>.<tid>.part" and renamed when
+// complete, so an interrupted writer never leaves a file that looks finished.
+// The name is unique per thread, process and host: writers sharing a folder
+// (several processes, machines on one NFS share) never write the same file.
+static char partHost[64] = "host";
+static pthread_once_t partHostOnce = PTHREAD_ONCE_INIT;
+
+static void init_part_host(void) {
+#ifdef _WIN32
+    DWORD length = sizeof(partHost);
+    if (!GetComputerNameA(partHost, &length)) strcpy(partHost, "host");
+#else
+    if (gethostname(partHost, sizeof(partHost)) != 0) strcpy(partHost, "host");
+    partHost[sizeof(partHost) - 1] = '\0';
+#endif
+}
+
+// Temporary name for path as written by thread tid of process pid on this host
+static void get_part_path_of(char *partPath, size_t size, const char *path, long pid, long tid) {
+    pthread_once(&partHostOnce, init_part_host);
+    snprintf(partPath, size, "%s.%s.%ld.%ld.part", path, partHost, pid, tid);
+}
+
+static void get_part_path(char *partPath, size_t size, const char *path) {
+#ifdef _WIN32
+    get_part_path_of(partPath, size, path, (long)GetCurrentProcessId(), (long)GetCurrentThreadId());
+#elif defined(__linux__)
+    get_part_path_of(partPath, size, path, (long)getpid(), (long)syscall(SYS_gettid));
+#else
+    get_part_path_of(partPath, size, path, (long)getpid(), (long)(size_t)pthread_self());
+#endif
+}
+
+// Path of the copy made when the original is kept instead of the AVIF
+static void get_kept_original_path(char *keptPath, size_t size, const char *outputPath, const char *originalName) {
+    char outputDir[1024];
+    strncpy(outputDir, outputPath, sizeof(outputDir) - 1);
+    outputDir[sizeof(outputDir) - 1] = '\0';
+    char *lastSlash = strrchr(outputDir, PATH_SEP);
+    if (lastSlash) *lastSlash = '\0';
+    snprintf(keptPath, size, "%s%s%s", outputDir, PATH_SEP_STR, originalName);
+}
+
+// Outputs of an image split into segments (see compress_segments): the AVIF
+// path without ".avif", plus "_seg001.avif"... or ".segments" for the manifest
+static void get_segment_path(char *path, size_t size, const char *outputPath, const char *suffix) {
+    size_t length = strlen(outputPath);
+    if (length >= 5 && strcmp(outputPath + length - 5, ".avif") == 0) length -= 5;
+    snprintf(path, size, "%.*s%s", (int)length, outputPath, suffix);
+}
+
+// An image is done if its AVIF, the kept original or its segment manifest exists in the output
+static int is_image_done(const char *outputPath, const char *originalName) {
+    if (file_exists(outputPath)) return 1;
+    char keptPath[1100];
+    get_kept_original_path(keptPath, sizeof(keptPath), outputPath, originalName);
+    if (file_exists(keptPath)) return 1;
+    get_segment_path(keptPath, sizeof(keptPath), outputPath, ".segments");
+    return file_exists(keptPath);
+}
+
+// Speed mapping: UI (0=slow, 10=fast) -> libvips effort (0=slow/best, 9=fast/worst)
+static int speed_to_effort(int speed) {
+    return speed > 9 ? 9 : speed;
+}
+
+// ---- AV1 encoder backends ----
+static const char *encoderNames[ENCODER_COUNT] = { "auto", "aom", "rav1e", "svt" };
+
+const char* processor_encoder_name(int encoder) {
+    return encoder >= 0 && encoder < ENCODER_COUNT ? encoderNames[encoder] : "?";
+}
+
+int processor_encoder_from_name(const char *name) {
+    for (int i = 0; i < ENCODER_COUNT; i++) {
+        if (strcmp(name, encoderNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// ---- Loading, with optional downscaling (config.maxWidth/maxHeight/maxMegapixels) ----
+// Images over the limits are loaded through vips_thumbnail, which has the
+// loader shrink while decoding (JPEG DCT-domain scaling, WebP and HEIF scaled
+// decode, PDF/SVG rendered at the target size), so the pixels that would be
+// thrown away are mostly never decoded. The source size is kept on the image
+// (SOURCE_WIDTH/HEIGHT_FIELD) for the job report.
+#define SOURCE_WIDTH_FIELD  "compressor-source-width"
+#define SOURCE_HEIGHT_FIELD "compressor-source-height"
+
+// Box a width x height image must fit in under config's limits
+// Returns: 1 if it must shrink (*targetWidth/*targetHeight set), 0 if it fits
+static int get_shrink_size(const CompressionConfig *config, int width, int height, int *targetWidth, int *targetHeight) {
+    double scale = 1.0;
+    if (config->maxWidth > 0 && width > config->maxWidth) {
+        scale = (double)config->maxWidth / width;
+    }
+    if (config->maxHeight > 0 && height > config->maxHeight && (double)config->maxHeight / height < scale) {
+        scale = (double)config->maxHeight / height;
+    }
+    double pixels = (double)width * height;
+    if (config->maxMegapixels > 0 && pixels > config->maxMegapixels * 1e6 &&
+        sqrt(config->maxMegapixels * 1e6 / pixels) < scale) {
+        scale = sqrt(config->maxMegapixels * 1e6 / pixels);
+    }
+    if (scale >= 1.0) return 0;
+    *targetWidth = (int)(width * scale) > 0 ? (int)(width * scale) : 1;
+    *targetHeight = (int)(height * scale) > 0 ? (int)(height * scale) : 1;
+    return 1;
+}
+
+// Open an image from a file, or from its bytes in memory, for sequential reading
+// Returns: the image (shrunk on load if over the limits), NULL on error
+static VipsImage* load_image(const char *path, const void *buffer, size_t size, const CompressionConfig *config) {
+    // A source per image: the operation cache can never match a freed buffer
+    VipsSource *source = NULL;
+    VipsImage *image = NULL;
+    if (buffer) {
+        source = vips_source_new_from_memory(buffer, size);
+        if (!source) return NULL;
+        image = vips_image_new_from_source(source, "", "access", VIPS_ACCESS_SEQUENTIAL, NULL);
+    } else {
+        image = vips_image_new_from_file(path, "access", VIPS_ACCESS_SEQUENTIAL, NULL);
+    }
+    
+    // Only the header has been read so far
+    int targetWidth, targetHeight;
+    if (image && get_shrink_size(config, vips_image_get_width(image), vips_image_get_height(image),
+                                 &targetWidth, &targetHeight)) {
+        int width = vips_image_get_width(image);
+        int height = vips_image_get_height(image);
+        g_object_unref(image);
+        image = NULL;
+        
+        VipsImage *shrunk = NULL;
+        int result = source
+            ? vips_thumbnail_source(source, &shrunk, targetWidth, "height", targetHeight,
+                                    "size", VIPS_SIZE_DOWN, "no_rotate", TRUE, NULL)
+            : vips_thumbnail(path, &shrunk, targetWidth, "height", targetHeight,
+                             "size", VIPS_SIZE_DOWN, "no_rotate", TRUE, NULL);
+        if (result == 0) {
+            vips_image_set_int(shrunk, SOURCE_WIDTH_FIELD, width);
+            vips_image_set_int(shrunk, SOURCE_HEIGHT_FIELD, height);
+            image = shrunk;
+        }
+    }
+    if (source) g_object_unref(source);
+    return image;
+}
+
+// Pixels of the source an image was loaded from (before any shrink-on-load)
+static long long get_source_pixels(VipsImage *image) {
+    int width, height;
+    if (vips_image_get_typeof(image, SOURCE_WIDTH_FIELD) &&
+        vips_image_get_int(image, SOURCE_WIDTH_FIELD, &width) == 0 &&
+        vips_image_get_int(image, SOURCE_HEIGHT_FIELD, &height) == 0) {
+        return (long long)width * height;
+    }
+    return (long long)vips_image_get_width(image) * vips_image_get_height(image);
+}
+
+// libvips 8.13 added the "encoder" option (and its VIPS_FOREIGN_HEIF_ENCODER_* enum)
+#if VIPS_MAJOR_VERSION > 8 || (VIPS_MAJOR_VERSION == 8 && VIPS_MINOR_VERSION >= 13)
+    #define VIPS_HAS_HEIF_ENCODER 1
+#endif
+
+// Encode to AVIF with the given settings, into a file (path) or into memory (buffer/size)
+// The "encoder" option is only passed when a backend is chosen; before
+// libvips 8.13 there is no way to choose one and libheif's default is used
+static int save_avif(VipsImage *image, const char *path, void **buffer, size_t *size, const CompressionConfig *config) {
+    int effort = speed_to_effort(config->speed);
+#ifdef VIPS_HAS_HEIF_ENCODER
+    if (config->encoder <= ENCODER_AUTO || config->encoder >= ENCODER_COUNT) {
+#endif
+        if (path) {
+            return vips_heifsave(image, path, "Q", config->quality, "effort", effort,
+                                 "compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1, NULL);
+        }
+        return vips_heifsave_buffer(image, buffer, size, "Q", config->quality, "effort", effort,
+                                    "compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1, NULL);
+#ifdef VIPS_HAS_HEIF_ENCODER
+    }
+    
+    VipsForeignHeifEncoder backend = config->encoder == ENCODER_AOM ? VIPS_FOREIGN_HEIF_ENCODER_AOM
+                                   : config->encoder == ENCODER_RAV1E ? VIPS_FOREIGN_HEIF_ENCODER_RAV1E
+                                   : VIPS_FOREIGN_HEIF_ENCODER_SVT;
+    if (path) {
+        return vips_heifsave(image, path, "Q", config->quality, "effort", effort,
+                             "compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1, "encoder", backend, NULL);
+    }
+    return vips_heifsave_buffer(image, buffer, size, "Q", config->quality, "effort", effort,
+                                "compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1, "encoder", backend, NULL);
+#endif
+}
+
+// ---- AV1 encoder list ----
+// Only the libheif libvips encodes with can tell which plugins it has (a
+// trial encode can't: vips silently falls back to the default encoder when
+// the chosen one is missing). That can be a system libheif or the one bundled
+// inside libvips (sharp-libvips), so it is never linked here: its
+// heif_get_encoder_descriptors is looked up in what the process has loaded.
+// If it isn't found, only "auto" is offered.
+typedef struct { int code; int subcode; const char *message; } HeifError;  // struct heif_error
+typedef HeifError (*HeifInitFn)(void *params);
+typedef int (*HeifGetEncoderDescriptorsFn)(int format, const char *name, const void **descriptors, int count);
+#define HEIF_COMPRESSION_AV1 4  // enum heif_compression_format
+
+#ifdef _WIN32
+// Find a symbol in a loaded libheif DLL (libheif.dll, libheif-1.dll...)
+static void* find_libheif_symbol(const char *symbol) {
+    HMODULE modules[512];
+    DWORD needed = 0;
+    if (!EnumProcessModules(GetCurrentProcess(), modules, sizeof(modules), &needed)) return NULL;
+    int count = (int)(needed / sizeof(HMODULE));
+    if (count > 512) count = 512;
+    for (int i = 0; i < count; i++) {
+        char path[MAX_PATH];
+        if (!GetModuleFileNameA(modules[i], path, sizeof(path))) continue;
+        const char *name = path_basename(path);
+        if (_strnicmp(name, "libheif", 7) != 0) continue;
+        FARPROC proc = GetProcAddress(modules[i], symbol);
+        if (proc) return (void *)proc;
+    }
+    return NULL;
+}
+#else
+#ifdef __linux__
+typedef struct {
+    const char *symbol;
+    void *address;
+} HeifSymbolSearch;
+
+static int find_heif_object(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void)size;
+    HeifSymbolSearch *search = (HeifSymbolSearch *)arg;
+    if (!info->dlpi_name || !strstr(path_basename(info->dlpi_name), "libheif")) return 0;
+    // Already loaded: this only takes a reference to it
+    void *handle = dlopen(info->dlpi_name, RTLD_LAZY | RTLD_NOLOAD);
+    if (!handle) return 0;
+    search->address = dlsym(handle, search->symbol);
+    dlclose(handle);
+    return search->address != NULL;
+}
+#endif
+
+// Find a symbol in the libheif already loaded (exported globally, or a
+// libheif shared object loaded locally, e.g. by a libvips module)
+static void* find_libheif_symbol(const char *symbol) {
+    void *address = dlsym(RTLD_DEFAULT, symbol);
+#ifdef __linux__
+    if (!address) {
+        HeifSymbolSearch search = { symbol, NULL };
+        dl_iterate_phdr(find_heif_object, &search);
+        address = search.address;
+    }
+#endif
+    return address;
+}
+#endif
+
+int processor_available_encoders(void) {
+    static int available = -1;
+    static pthread_mutex_t probeLock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&probeLock);
+    if (available < 0) {
+        available = 1 << ENCODER_AUTO;
+#ifdef VIPS_HAS_HEIF_ENCODER
+        HeifGetEncoderDescriptorsFn getDescriptors =
+            (HeifGetEncoderDescriptorsFn)find_libheif_symbol("heif_get_encoder_descriptors");
+        HeifInitFn init = (HeifInitFn)find_libheif_symbol("heif_init");  // libheif >= 1.13
+        if (getDescriptors) {
+            if (init) init(NULL);   // Loads the plugins; reference counted, never undone
+            for (int i = ENCODER_AUTO + 1; i < ENCODER_COUNT; i++) {
+                const void *descriptor = NULL;
+                if (getDescriptors(HEIF_COMPRESSION_AV1, encoderNames[i], &descriptor, 1) > 0) {
+                    available |= 1 << i;
+                }
+            }
+        } else {
+            fprintf(stderr, "Warning: libheif not found in the process, only the default AV1 encoder is offered\n");
+        }
+#endif
+        
+        printf("AV1 encoders:");
+        for (int i = ENCODER_AUTO + 1; i < ENCODER_COUNT; i++) {
+            if (available & (1 << i)) printf(" %s", encoderNames[i]);
+        }
+        printf("%s\n", available == (1 << ENCODER_AUTO) ? " libheif default only" : "");
+    }
+    int result = available;
+    pthread_mutex_unlock(&probeLock);
+    return result;
+}
+
+// ---- Encoder setup cost ----
+// Every vips_heifsave call builds a new libheif context and AV1 encoder, and
+// vips has no way to keep them across images, so encoder contexts are not
+// reused from one image to the next. Going around vips wouldn't help either:
+// libheif's aom and SVT plugins create the codec inside every
+// heif_context_encode_image, even with a heif_encoder that's kept. What can be
+// done is to pay the one-time costs (plugin loading, codec tables) before the
+// first real image, and to measure the fixed part every image pays: a 16x16
+// encode is little else.
+// Measured once per process for each setting, by the first worker that needs it.
+#define SETUP_PROBE_SIZE   16
+#define SETUP_CACHE_SIZE   8
+
+typedef struct {
+    int quality;
+    int effort;
+    int encoder;
+    long long coldNs;           // First encode with these settings in this process
+    long long warmNs;           // Any later one: the fixed cost per image
+} EncoderSetup;
+
+static EncoderSetup encoderSetups[SETUP_CACHE_SIZE];
+static int encoderSetupCount = 0;
+static pthread_mutex_t encoderSetupLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Warm the encoder up for these settings and return its fixed cost per image
+// Returns: nanoseconds, -1 if it could not be measured
+static long long get_encoder_setup_ns(const CompressionConfig *config) {
+    int effort = speed_to_effort(config->speed);
+    pthread_mutex_lock(&encoderSetupLock);
+    for (int i = 0; i < encoderSetupCount; i++) {
+        if (encoderSetups[i].quality == config->quality && encoderSetups[i].effort == effort &&
+            encoderSetups[i].encoder == config->encoder) {
+            long long ns = encoderSetups[i].warmNs;
+            pthread_mutex_unlock(&encoderSetupLock);
+            return ns;
+        }
+    }
+    
+    // Measured under the lock: other workers wait for the warm-up instead of all paying it at once
+    long long times[2] = { -1, -1 };
+    VipsImage *probe = NULL;
+    if (vips_black(&probe, SETUP_PROBE_SIZE, SETUP_PROBE_SIZE, "bands", 3, NULL) == 0) {
+        for (int pass = 0; pass < 2; pass++) {
+            void *encoded = NULL;
+            size_t encodedSize = 0;
+            long long startNs = get_monotonic_ns();
+            int result = save_avif(probe, NULL, &encoded, &encodedSize, config);
+            g_free(encoded);
+            if (result != 0) break;
+            times[pass] = get_monotonic_ns() - startNs;
+        }
+        g_object_unref(probe);
+    }
+    vips_error_clear();
+    if (times[1] >= 0) printf("Encoder setup (%s, Q%d, effort %d): %.1f ms cold, %.1f ms per image\n",
+                             processor_encoder_name(config->encoder), config->quality, effort,
+                             (double)times[0] / 1e6, (double)times[1] / 1e6);
+    
+    if (encoderSetupCount < SETUP_CACHE_SIZE) {
+        EncoderSetup *setup = &encoderSetups[encoderSetupCount++];
+        setup->quality = config->quality;
+        setup->effort = effort;
+        setup->encoder = config->encoder;
+        setup->coldNs = times[0];
+        setup->warmNs = times[1];
+    }
+    pthread_mutex_unlock(&encoderSetupLock);
+    return times[1];
+}
+
+// ---- Live stats in shared memory (see stats.h) ----
+static StatsRegion *statsRegion = NULL;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;   // Slot allocation
+static __thread int currentStatsWorker = -1;                     // This thread's worker slot
+static __thread int untrackedStatsJob = -1;                      // Job slot counting us in untrackedWorkers
+#ifdef _WIN32
+static HANDLE statsMapping = NULL;
+#else
+static char statsName[64];
+#endif
+
+// Seqlock writer side: odd while the slot is being updated
+static void stats_write_begin(volatile unsigned int *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void stats_write_end(volatile unsigned int *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __linux__
+// Remove the segments of compressors that died without unpublishing
+// (compressor-top only reads them)
+static void remove_stale_stats_segments(void) {
+    DIR *dir = opendir("/dev/shm");
+    if (!dir) return;
+    struct dirent *entry;
+    size_t prefixLen = strlen(STATS_SHM_PREFIX);
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, STATS_SHM_PREFIX, prefixLen) != 0) continue;
+        int pid = atoi(entry->d_name + prefixLen);
+        if (pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH) continue;
+        char name[300];
+        snprintf(name, sizeof(name), "/%s", entry->d_name);
+        shm_unlink(name);
+    }
+    closedir(dir);
+}
+#endif
+
+int processor_stats_publish(void) {
+    if (statsRegion) return 1;
+#ifdef __linux__
+    remove_stale_stats_segments();
+#endif
+#ifdef _WIN32
+    char name[96];
+    snprintf(name, sizeof(name), "Local\\%s%lu", STATS_SHM_PREFIX, (unsigned long)GetCurrentProcessId());
+    statsMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(StatsRegion), name);
+    if (!statsMapping) return 0;
+    StatsRegion *region = (StatsRegion *)MapViewOfFile(statsMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(StatsRegion));
+    if (!region) {
+        CloseHandle(statsMapping);
+        statsMapping = NULL;
+        return 0;
+    }
+#else
+    snprintf(statsName, sizeof(statsName), "/%s%d", STATS_SHM_PREFIX, (int)getpid());
+    int fd = shm_open(statsName, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) return 0;
+    if (ftruncate(fd, sizeof(StatsRegion)) != 0) {
+        close(fd);
+        shm_unlink(statsName);
+        return 0;
+    }
+    void *mapped = mmap(NULL, sizeof(StatsRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        shm_unlink(statsName);
+        return 0;
+    }
+    StatsRegion *region = (StatsRegion *)mapped;
+#endif
+    memset(region, 0, sizeof(StatsRegion));
+    region->version = STATS_VERSION;
+    region->size = sizeof(StatsRegion);
+#ifdef _WIN32
+    region->pid = (int)GetCurrentProcessId();
+#else
+    region->pid = (int)getpid();
+#endif
+    // Magic last: readers ignore the segment until it is fully initialized
+    __atomic_store_n(&region->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+    statsRegion = region;
+    return 1;
+}
+
+void processor_stats_unpublish(void) {
+    if (!statsRegion) return;
+    StatsRegion *region = statsRegion;
+    statsRegion = NULL;
+#ifdef _WIN32
+    UnmapViewOfFile(region);
+    CloseHandle(statsMapping);
+    statsMapping = NULL;
+#else
+    munmap(region, sizeof(StatsRegion));
+    shm_unlink(statsName);
+#endif
+}
+
+// Take a job slot (the least recently started free one)
+static void stats_job_begin(FolderJob *job) {
+    job->statsSlot = 0;
+    if (!statsRegion) return;
+    
+    pthread_mutex_lock(&statsLock);
+    int best = -1;
+    for (int i = 0; i < STATS_MAX_JOBS; i++) {
+        StatsJob *j = &statsRegion->jobs[i];
+        if (!j->inUse && (best < 0 || j->startedMs < statsRegion->jobs[best].startedMs)) best = i;
+    }
+    if (best >= 0) {
+        StatsJob *j = &statsRegion->jobs[best];
+        stats_write_begin(&j->seq);
+        j->inUse = 1;
+        j->status = job->status;
+        j->total = job->totalFiles;
+        j->done = j->failed = j->activeThreads = 0;
+        j->queued = job->totalFiles;
+        j->bytesIn = j->bytesOut = 0;
+        j->writerActive = job->config.serialWrites || job->config.syncWrites;
+        j->writeQueued = 0;
+        j->writeQueuedBytes = j->bytesWritten = 0;
+        j->untrackedWorkers = 0;
+        j->startedMs = j->updatedMs = get_unix_ms();
+        strncpy(j->folder, job->sourcePath, sizeof(j->folder) - 1);
+        j->folder[sizeof(j->folder) - 1] = '\0';
+        stats_write_end(&j->seq);
+        job->statsSlot = best + 1;
+    }
+    pthread_mutex_unlock(&statsLock);
+}
+
+// Refresh a job's counters (call with the job lock held); queued < 0 keeps the last value
+static void stats_job_update(FolderJob *job, int queued, long long bytesIn, long long bytesOut) {
+    if (!statsRegion || job->statsSlot <= 0) return;
+    StatsJob *j = &statsRegion->jobs[job->statsSlot - 1];
+    stats_write_begin(&j->seq);
+    j->status = job->status;
+    j->total = job->totalFiles;
+    j->done = job->doneFiles;
+    j->failed = job->failedFiles;
+    j->activeThreads = job->activeThreads;
+    if (queued >= 0) j->queued = queued;
+    j->bytesIn += bytesIn;
+    j->bytesOut += bytesOut;
+    j->updatedMs = get_unix_ms();
+    stats_write_end(&j->seq);
+    statsRegion->updatedMs = j->updatedMs;
+}
+
+// Writer stage counters (call with the job lock held)
+static void stats_job_writer(FolderJob *job, int queued, long long queuedBytes, long long bytesWritten) {
+    if (!statsRegion || job->statsSlot <= 0) return;
+    StatsJob *j = &statsRegion->jobs[job->statsSlot - 1];
+    stats_write_begin(&j->seq);
+    j->writeQueued = queued;
+    j->writeQueuedBytes = queuedBytes;
+    j->bytesWritten = bytesWritten;
+    j->updatedMs = get_unix_ms();
+    stats_write_end(&j->seq);
+}
+
+static void stats_job_end(FolderJob *job) {
+    if (!statsRegion || job->statsSlot <= 0) return;
+    pthread_mutex_lock(&statsLock);
+    stats_job_update(job, 0, 0, 0);
+    StatsJob *j = &statsRegion->jobs[job->statsSlot - 1];
+    stats_write_begin(&j->seq);
+    j->inUse = 0;
+    stats_write_end(&j->seq);
+    pthread_mutex_unlock(&statsLock);
+    job->statsSlot = 0;
+}
+
+// Set the calling worker's state; file NULL keeps the current one
+static void stats_worker_state(int state, const char *file) {
+    int slot = currentStatsWorker;
+    if (!statsRegion || slot < 0) return;
+    StatsWorker *w = &statsRegion->workers[slot];
+    stats_write_begin(&w->seq);
+    w->state = state;
+    w->stateSinceMs = get_unix_ms();
+    if (file) {
+        strncpy(w->file, file, sizeof(w->file) - 1);
+        w->file[sizeof(w->file) - 1] = '\0';
+    }
+    stats_write_end(&w->seq);
+}
+
+static void stats_worker_begin(FolderJob *job) {
+    currentStatsWorker = -1;
+    if (!statsRegion || job->statsSlot <= 0) return;
+    pthread_mutex_lock(&statsLock);
+    for (int i = 0; i < STATS_MAX_WORKERS; i++) {
+        StatsWorker *w = &statsRegion->workers[i];
+        if (w->state == STATS_WORKER_FREE) {
+            stats_write_begin(&w->seq);
+            w->job = job->statsSlot - 1;
+            w->state = STATS_WORKER_IDLE;
+            stats_write_end(&w->seq);
+            currentStatsWorker = i;
+            break;
+        }
+    }
+    
+    // All slots taken (more than STATS_MAX_WORKERS threads): at least count it
+    if (currentStatsWorker < 0) {
+        StatsJob *j = &statsRegion->jobs[job->statsSlot - 1];
+        stats_write_begin(&j->seq);
+        j->untrackedWorkers++;
+        stats_write_end(&j->seq);
+        untrackedStatsJob = job->statsSlot - 1;
+    }
+    pthread_mutex_unlock(&statsLock);
+    stats_worker_state(STATS_WORKER_IDLE, "");
+}
+
+static void stats_worker_end(void) {
+    if (!statsRegion) return;
+    if (untrackedStatsJob >= 0) {
+        pthread_mutex_lock(&statsLock);
+        StatsJob *j = &statsRegion->jobs[untrackedStatsJob];
+        stats_write_begin(&j->seq);
+        j->untrackedWorkers--;
+        stats_write_end(&j->seq);
+        pthread_mutex_unlock(&statsLock);
+        untrackedStatsJob = -1;
+    }
+    if (currentStatsWorker < 0) return;
+    pthread_mutex_lock(&statsLock);
+    stats_worker_state(STATS_WORKER_FREE, "");
+    pthread_mutex_unlock(&statsLock);
+    currentStatsWorker = -1;
+}
+
+// Event stream (defined below, used by the writer stage)
+static const char* json_quote(char *dst, size_t size, const char *s);
+static void emit_event(FolderJob *job, const char *event, const char *fields, ...);
+
+// ---- Writer stage: one thread per job writes every output ----
+// With config.serialWrites the encoders encode to memory and queue the result,
+// and the writer writes the outputs one after another. Without it, each worker
+// writes its own file. On spinning disks and SMR drives the seeks between
+// those interleaved writes cost most of the throughput. With config.syncWrites
+// a batch is written, fsynced and renamed together, and each output folder is
+// synced once per batch rather than once per file. Encoders wait while the
+// backlog is above writeQueueMB.
+#define WRITER_DEFAULT_QUEUE_MB 128
+#define WRITER_BATCH            16
+
+// Outputs that only make sense together: the segments of a split image and
+// then their manifest, closed by the last item queued. The closing item is
+// only written if every other one was; if any fails (or the group is closed
+// with an empty path, cancelling it) the ones already in place are removed.
+// Once created, only the writer thread touches a group, and frees it when it
+// reaches the closing item.
+typedef struct {
+    int failed;
+    int writtenCount;
+    int capacity;
+    char (*written)[1100];      // Final paths of the items in place so far
+} WriteGroup;
+
+typedef struct WriteItem {
+    struct WriteItem *next;
+    char path[1100];            // Final path (written to "<path>.part", then renamed), "" = cancel group
+    void *data;                 // Encoded AVIF (vips allocation), NULL = copy copyFrom
+    char copyFrom[1024];        // Kept original to copy
+    long long size;
+    char name[260];             // For error reports
+    WriteGroup *group;          // NULL if the output stands alone
+    int closesGroup;
+} WriteItem;
+
+typedef struct {
+    FolderJob *job;
+    pthread_mutex_t *jobLock;
+    WriteItem *head;
+    WriteItem *tail;
+    int queued;                 // Items not written yet (including the batch in progress)
+    long long queuedBytes;
+    long long limitBytes;
+    long long bytesWritten;     // Guarded by lock (read by the workers for the stats)
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t queuedCond;  // An item was queued or the writer is stopping
+    pthread_cond_t spaceCond;   // A batch was written, the backlog shrank
+    pthread_t thread;
+    int running;                // Guarded by lock
+} Writer;
+
+// A queued output could not be written: the image was already counted as
+// done, so count it as failed now and report it on the event stream
+static void writer_report_failure(Writer *w, WriteItem *item, const char *error) {
+    fprintf(stderr, "Error writing %s: %s\n", item->path, error);
+    w->failed++;
+    pthread_mutex_lock(w->jobLock);
+    w->job->failedFiles++;
+    stats_job_update(w->job, -1, 0, 0);
+    pthread_mutex_unlock(w->jobLock);
+    
+    char quotedFile[600], quotedError[64];
+    emit_event(w->job, "image_error", "\"file\":%s,\"error\":%s,\"ms\":0",
+               json_quote(quotedFile, sizeof(quotedFile), item->name),
+               json_quote(quotedError, sizeof(quotedError), error));
+}
+
+// Group for count outputs plus the closing one. Returns: NULL if out of memory
+static WriteGroup* writer_new_group(int count) {
+    WriteGroup *group = (WriteGroup *)calloc(1, sizeof(WriteGroup));
+    if (!group) return NULL;
+    group->written = calloc((size_t)count, sizeof(*group->written));
+    if (!group->written) {
+        free(group);
+        return NULL;
+    }
+    group->capacity = count;
+    return group;
+}
+
+// The closing item was reached: undo a failed group, then free it
+static void writer_end_group(WriteGroup *group) {
+    if (group->failed) {
+        for (int i = 0; i < group->writtenCount; i++) remove(group->written[i]);
+    }
+    free(group->written);
+    free(group);
+}
+
+static void writer_write_batch(Writer *w, WriteItem **items, int count) {
+    FILE *files[WRITER_BATCH];
+    const char *errors[WRITER_BATCH];
+    char partPath[1200];
+    int sync = w->job->config.syncWrites;
+    
+    // Write every file of the batch back to back
+    for (int i = 0; i < count; i++) {
+        errors[i] = NULL;
+        files[i] = NULL;
+        if (items[i]->group && (items[i]->group->failed || !items[i]->path[0])) continue;   // Dropped below
+        get_part_path(partPath, sizeof(partPath), items[i]->path);
+#ifdef __linux__
+        // Large kept originals with O_DIRECT: copied (and synced) in one go
+        if (!items[i]->data && w->job->config.directIO && items[i]->size >= DIRECT_COPY_MIN_BYTES &&
+            copy_file_direct(items[i]->copyFrom, partPath, sync) == 0) {
+            files[i] = NULL;
+            continue;
+        }
+#endif
+        files[i] = fopen(partPath, "wb");
+        if (!files[i]) {
+            errors[i] = "cannot create output";
+            continue;
+        }
+        int ok = items[i]->data
+            ? fwrite(items[i]->data, 1, (size_t)items[i]->size, files[i]) == (size_t)items[i]->size
+            : copy_into(items[i]->copyFrom, files[i]) == 0;
+        if (!ok || fflush(files[i]) != 0) errors[i] = "write failed";
+    }
+    // files[i] is also NULL for direct copies, which are complete already
+    
+    // One pass of fsyncs for the whole batch
+    if (sync) {
+        for (int i = 0; i < count; i++) {
+            if (files[i] && !errors[i] && sync_file(files[i]) != 0) errors[i] = "fsync failed";
+        }
+    }
+    
+    char lastDir[1100] = "";
+    for (int i = 0; i < count; i++) {
+        WriteGroup *group = items[i]->group;
+        get_part_path(partPath, sizeof(partPath), items[i]->path);
+        if (files[i] && fclose(files[i]) != 0 && !errors[i]) errors[i] = "write failed";
+        
+        // Cancelled group, or an earlier output of it failed (already reported)
+        if (group && (group->failed || !items[i]->path[0])) {
+            if (items[i]->path[0]) remove(partPath);
+            group->failed = 1;
+            if (items[i]->closesGroup) writer_end_group(group);
+            continue;
+        }
+        
+        if (!errors[i] && rename_file(partPath, items[i]->path) != 0) errors[i] = "cannot move output into place";
+        if (errors[i]) {
+            remove(partPath);
+            writer_report_failure(w, items[i], errors[i]);
+            if (group) {
+                group->failed = 1;
+                if (items[i]->closesGroup) writer_end_group(group);
+            }
+            continue;
+        }
+        if (group) {
+            if (items[i]->closesGroup) {
+                writer_end_group(group);
+            } else if (group->writtenCount < group->capacity) {
+                strcpy(group->written[group->writtenCount++], items[i]->path);
+            }
+        }
+        pthread_mutex_lock(&w->lock);
+        w->bytesWritten += items[i]->size;
+        pthread_mutex_unlock(&w->lock);
+        if (w->job->config.dropCache) {
+            drop_file_cache(items[i]->path, !sync);
+            if (!items[i]->data) drop_file_cache(items[i]->copyFrom, 0);
+        }
+
+        // Sync each output folder once (a batch is almost always one folder)
+        if (sync) {
+            char dir[1100];
+            size_t dirLen = (size_t)(path_basename(items[i]->path) - items[i]->path);
+            if (dirLen > 0) dirLen--;
+            memcpy(dir, items[i]->path, dirLen);
+            dir[dirLen] = '\0';
+            if (dirLen == 0) strcpy(dir, ".");
+            if (strcmp(lastDir, dir) != 0) {
+                sync_dir(dir);
+                strcpy(lastDir, dir);
+            }
+        }
+    }
+}
+
+static void* writer_thread(void *arg) {
+    Writer *w = (Writer *)arg;
+    WriteItem *batch[WRITER_BATCH];
+    if (w->job->config.background) {
+        set_worker_background_priority();
+    }
+    
+    while (1) {
+        pthread_mutex_lock(&w->lock);
+        while (!w->head && w->running) {
+            pthread_cond_wait(&w->queuedCond, &w->lock);
+        }
+        int count = 0;
+        while (w->head && count < WRITER_BATCH) {
+            batch[count++] = w->head;
+            w->head = w->head->next;
+        }
+        if (!w->head) w->tail = NULL;
+        pthread_mutex_unlock(&w->lock);
+        if (count == 0) break;      // Stopping and nothing left
+        
+        writer_write_batch(w, batch, count);
+        
+        long long bytes = 0;
+        for (int i = 0; i < count; i++) {
+            bytes += batch[i]->size;
+            if (batch[i]->data) g_free(batch[i]->data);
+            free(batch[i]);
+        }
+        pthread_mutex_lock(&w->lock);
+        w->queued -= count;
+        w->queuedBytes -= bytes;
+        int queued = w->queued;
+        long long queuedBytes = w->queuedBytes;
+        long long bytesWritten = w->bytesWritten;
+        pthread_cond_broadcast(&w->spaceCond);
+        pthread_mutex_unlock(&w->lock);
+        
+        pthread_mutex_lock(w->jobLock);
+        stats_job_writer(w->job, queued, queuedBytes, bytesWritten);
+        pthread_mutex_unlock(w->jobLock);
+    }
+    return NULL;
+}
+
+// Start the writer for a job (NULL when the workers write their own outputs)
+// Isolated encoders write from the child process, so the writer is skipped there
+static Writer* start_writer(FolderJob *job, pthread_mutex_t *jobLock) {
+    if (!(job->config.serialWrites || job->config.syncWrites) || job->config.isolate) return NULL;
+    
+    Writer *w = (Writer *)calloc(1, sizeof(Writer));
+    if (!w) return NULL;
+    w->job = job;
+    w->jobLock = jobLock;
+    w->limitBytes = (long long)(job->config.writeQueueMB > 0 ? job->config.writeQueueMB : WRITER_DEFAULT_QUEUE_MB) * 1024 * 1024;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->queuedCond, NULL);
+    pthread_cond_init(&w->spaceCond, NULL);
+    
+    w->running = 1;
+    if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+        pthread_cond_destroy(&w->spaceCond);
+        pthread_cond_destroy(&w->queuedCond);
+        pthread_mutex_destroy(&w->lock);
+        free(w);
+        return NULL;
+    }
+    printf("Writer: serial writes, %d MB queue%s\n", (int)(w->limitBytes / (1024 * 1024)),
+           job->config.syncWrites ? ", fsync per batch" : "");
+    return w;
+}
+
+// Write everything still queued, then stop the writer
+static void stop_writer(Writer *w) {
+    if (!w) return;
+    pthread_mutex_lock(&w->lock);
+    w->running = 0;
+    pthread_cond_signal(&w->queuedCond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+    printf("Writer: %.1f MB written, %d failed\n", (double)w->bytesWritten / (1024.0 * 1024.0), w->failed);
+    pthread_cond_destroy(&w->spaceCond);
+    pthread_cond_destroy(&w->queuedCond);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+}
+
+// Queue an output that's part of a group (see WriteGroup); closes: it's the
+// group's last item. Same rules as writer_add.
+static int writer_add_grouped(Writer *w, const char *path, void *data, const char *copyFrom, long long size,
+                              const char *name, WriteGroup *group, int closes) {
+    WriteItem *item = (WriteItem *)calloc(1, sizeof(WriteItem));
+    if (!item) {
+        if (data) g_free(data);
+        return -1;
+    }
+    snprintf(item->path, sizeof(item->path), "%s", path);
+    snprintf(item->copyFrom, sizeof(item->copyFrom), "%s", copyFrom ? copyFrom : "");
+    snprintf(item->name, sizeof(item->name), "%s", name);
+    item->data = data;
+    item->size = size;
+    item->group = group;
+    item->closesGroup = closes;
+    
+    pthread_mutex_lock(&w->lock);
+    while (w->queued > 0 && w->queuedBytes + size > w->limitBytes) {
+        pthread_cond_wait(&w->spaceCond, &w->lock);
+    }
+    if (w->tail) w->tail->next = item;
+    else w->head = item;
+    w->tail = item;
+    w->queued++;
+    w->queuedBytes += size;
+    int queued = w->queued;
+    long long queuedBytes = w->queuedBytes;
+    long long bytesWritten = w->bytesWritten;
+    pthread_cond_signal(&w->queuedCond);
+    pthread_mutex_unlock(&w->lock);
+    
+    pthread_mutex_lock(w->jobLock);
+    stats_job_writer(w->job, queued, queuedBytes, bytesWritten);
+    pthread_mutex_unlock(w->jobLock);
+    return 0;
+}
+
+// Queue an output; data (a vips allocation) is owned by the writer from here
+// on. copyFrom: file to copy instead of data (kept originals)
+// Waits while the backlog is over the limit
+// Returns: 0 on success, -1 on error
+static int writer_add(Writer *w, const char *path, void *data, const char *copyFrom, long long size, const char *name) {
+    return writer_add_grouped(w, path, data, copyFrom, size, name, NULL, 0);
+}
+
+// Outcome of one image, reported on the event stream
+typedef struct {
+    long long inputBytes;
+    long long outputBytes;      // AVIF size, or the original's when it was kept
+    int keptOriginal;
+    int segments;               // AVIF segments a tall image was split into, 0 = not split
+    long long sourcePixels;     // Before shrink-on-load
+    long long encodedPixels;
+    char error[128];            // Set when compression failed
+} ImageResult;
+
+// ---- Tall strips: split into segments (config.segmentHeight) ----
+// Webtoon strips (800x60000 and more) go past what AV1/HEIF encoders accept,
+// or need a frame buffer for the whole strip. Taller images are cut into
+// fixed-height bands from the top, each encoded as its own AVIF named
+// "<name>_seg001.avif", "<name>_seg002.avif"... Then "<name>.segments" lists
+// them for readers that stitch them back; it is written last, so it also
+// marks the image as done.
+// The image is read sequentially and each band is copied to memory just
+// before it is encoded, so only the bands in flight are ever decoded.
+#define SEGMENT_AUTO_LIMIT     16384   // Split above this height by default
+#define SEGMENT_DEFAULT_HEIGHT 8192
+#define SEGMENT_MAX_PARALLEL   4
+
+// Segment height for an image, 0 = encode it whole
+static int get_segment_height(const CompressionConfig *config, int height) {
+    if (config->segmentHeight < 0) return 0;
+    if (config->segmentHeight > 0) return height > config->segmentHeight ? config->segmentHeight : 0;
+    return height > SEGMENT_AUTO_LIMIT ? SEGMENT_DEFAULT_HEIGHT : 0;
+}
+
+typedef struct {
+    VipsImage *band;
+    char path[1100];
+    const char *name;
+    const CompressionConfig *config;
+    Writer *writer;
+    WriteGroup *group;          // With writer: the image's segments and manifest
+    long long bytes;
+    int result;
+    int running;                // Encoded in its own thread (not joined yet)
+    pthread_t thread;
+} SegmentTask;
+
+static void segment_encode(SegmentTask *task) {
+    if (task->writer) {
+        void *encoded = NULL;
+        size_t encodedSize = 0;
+        task->result = save_avif(task->band, NULL, &encoded, &encodedSize, task->config);
+        if (task->result == 0) {
+            task->bytes = (long long)encodedSize;
+            task->result = writer_add_grouped(task->writer, task->path, encoded, NULL, task->bytes, task->name,
+                                              task->group, 0);
+        }
+    } else {
+        char partPath[1200];
+        get_part_path(partPath, sizeof(partPath), task->path);
+        task->result = save_avif(task->band, partPath, NULL, NULL, task->config);
+        if (task->result == 0) {
+            task->bytes = get_file_size(partPath);
+            task->result = rename_file(partPath, task->path);
+        }
+        if (task->result != 0) remove(partPath);
+    }
+    g_object_unref(task->band);
+    task->band = NULL;
+}
+
+static void* segment_thread(void *arg) {
+    segment_encode((SegmentTask *)arg);
+    vips_thread_shutdown();
+    return NULL;
+}
+
+// Wait for a segment started in its own thread
+// Returns: its result
+static int segment_finish(SegmentTask *task, ImageResult *res) {
+    if (task->running) {
+        pthread_join(task->thread, NULL);
+        task->running = 0;
+    }
+    if (task->result == 0) res->outputBytes += task->bytes;
+    return task->result;
+}
+
+// Remove the segments of a failed image ("<name>_seg001.avif" up to count)
+static void remove_segments(const char *outputPath, int count) {
+    char path[1100], suffix[32];
+    for (int i = 0; i < count; i++) {
+        snprintf(suffix, sizeof(suffix), "_seg%03d.avif", i + 1);
+        get_segment_path(path, sizeof(path), outputPath, suffix);
+        remove(path);
+    }
+}
+
+// Encode an image as segments of segmentHeight pixels (image is unref'd by the caller)
+// Up to SEGMENT_MAX_PARALLEL segments are encoded at once, in threads of their
+// own, when the worker's share of the CPUs allows it
+// Returns: 0 on success, -1 on error (res->error set)
+static int compress_segments(VipsImage *image, int segmentHeight, const char *outputPath, const char *originalName,
+                             const CompressionConfig *config, Writer *writer, ImageResult *res) {
+    int width = vips_image_get_width(image);
+    int height = vips_image_get_height(image);
+    int count = (height + segmentHeight - 1) / segmentHeight;
+    
+    int parallel = get_cpu_count() / (config->threads > 0 ? config->threads : 1);
+    if (parallel > SEGMENT_MAX_PARALLEL) parallel = SEGMENT_MAX_PARALLEL;
+    if (parallel > count) parallel = count;
+    if (parallel < 1) parallel = 1;
+    
+    // Manifest: a header, then "<file> <top> <height>" per segment, top to bottom
+    size_t manifestSize = 128 + (size_t)count * 320;
+    char *manifest = (char *)g_malloc(manifestSize);
+    size_t manifestLength = (size_t)snprintf(manifest, manifestSize, "image-compressor segments 1\nsize %d %d\ncount %d\n",
+                                             width, height, count);
+    
+    // With the writer stage the segments land later: grouped, so the manifest
+    // is only written once they all are, and a failure removes the rest
+    WriteGroup *group = NULL;
+    if (writer) {
+        group = writer_new_group(count);
+        if (!group) {
+            g_free(manifest);
+            snprintf(res->error, sizeof(res->error), "out of memory");
+            return -1;
+        }
+    }
+    
+    SegmentTask tasks[SEGMENT_MAX_PARALLEL];
+    memset(tasks, 0, sizeof(tasks));
+    int failed = -1;
+    for (int i = 0; i < count && failed < 0; i++) {
+        // Reuse the slot of the segment started `parallel` segments ago
+        SegmentTask *task = &tasks[i % parallel];
+        if (i >= parallel && segment_finish(task, res) != 0) {
+            failed = i - parallel;
+            break;
+        }
+        
+        int top = i * segmentHeight;
+        int bandHeight = height - top < segmentHeight ? height - top : segmentHeight;
+        VipsImage *cropped = NULL;
+        if (vips_crop(image, &cropped, 0, top, width, bandHeight, NULL) != 0) {
+            failed = i;
+            break;
+        }
+        task->band = vips_image_copy_memory(cropped);
+        g_object_unref(cropped);
+        if (!task->band) {
+            failed = i;
+            break;
+        }
+        
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "_seg%03d.avif", i + 1);
+        get_segment_path(task->path, sizeof(task->path), outputPath, suffix);
+        task->name = originalName;
+        task->config = config;
+        task->writer = writer;
+        task->group = group;
+        task->bytes = 0;
+        task->result = 0;
+        manifestLength += (size_t)snprintf(manifest + manifestLength, manifestSize - manifestLength, "%s %d %d\n",
+                                           path_basename(task->path), top, bandHeight);
+        
+        task->running = parallel > 1 && pthread_create(&task->thread, NULL, segment_thread, task) == 0;
+        if (!task->running) segment_encode(task);
+    }
+    for (int i = 0; i < parallel; i++) {
+        if (segment_finish(&tasks[i], res) != 0 && failed < 0) failed = i;
+        if (tasks[i].band) g_object_unref(tasks[i].band);
+    }
+    
+    if (failed >= 0) {
+        snprintf(res->error, sizeof(res->error), "segment encode failed: %s", vips_error_buffer());
+        fprintf(stderr, "Error saving AVIF segments: %s - %s\n", outputPath, res->error);
+        g_free(manifest);
+        // Without a manifest the finished segments are just clutter
+        if (writer) writer_add_grouped(writer, "", NULL, NULL, 0, originalName, group, 1);
+        else remove_segments(outputPath, count);
+        return -1;
+    }
+    
+    stats_worker_state(STATS_WORKER_WRITING, NULL);
+    char manifestPath[1100];
+    get_segment_path(manifestPath, sizeof(manifestPath), outputPath, ".segments");
+    if (writer) {
+        if (writer_add_grouped(writer, manifestPath, manifest, NULL, (long long)manifestLength, originalName, group, 1) != 0) {
+            writer_add_grouped(writer, "", NULL, NULL, 0, originalName, group, 1);
+            snprintf(res->error, sizeof(res->error), "cannot queue output");
+            return -1;
+        }
+    } else {
+        char partPath[1200];
+        get_part_path(partPath, sizeof(partPath), manifestPath);
+        FILE *f = fopen(partPath, "wb");
+        int result = f && fwrite(manifest, 1, manifestLength, f) == manifestLength ? 0 : -1;
+        if (f && fclose(f) != 0) result = -1;
+        if (result == 0) result = rename_file(partPath, manifestPath);
+        g_free(manifest);
+        if (result != 0) {
+            remove(partPath);
+            remove_segments(outputPath, count);
+            snprintf(res->error, sizeof(res->error), "cannot write segment list");
+            return -1;
+        }
+    }
+    
+    res->segments = count;
+    res->outputBytes += (long long)manifestLength;
+    printf("Split into %d segments (%.0f%%): %s\n", count,
+           res->inputBytes > 0 ? (double)res->outputBytes * 100.0 / (double)res->inputBytes : 0.0, originalName);
+    return 0;
+}
+
+// Compress a single image to AVIF
+// inputBuffer: the file's bytes if the read-ahead stage loaded it, NULL to read inputPath
+// decoded: the image if the decode stage already loaded it (unref'd here); inputSize is then the file size
+// writer: queue the output there instead of writing it from this thread (may be NULL)
+static int compress_image_to_avif(const char *inputPath, const void *inputBuffer, size_t inputSize, VipsImage *decoded,
+                                   const char *outputPath, const char *originalName,
+                                   CompressionConfig *config, Writer *writer, ImageResult *res) {
+    VipsImage *image = NULL;
+    memset(res, 0, sizeof(*res));
+    
+    // Load the image (using sequential access for low memory)
+    image = decoded ? decoded : load_image(inputPath, inputBuffer, inputSize, config);
+    if (!image) {
+        fprintf(stderr, "Error loading: %s\n", inputPath);
+        snprintf(res->error, sizeof(res->error), "load failed: %s", vips_error_buffer());
+        vips_error_clear();
+        return -1;
+    }
+    
+    // Original size for comparison
+    long originalSize = (inputBuffer || decoded) ? (long)inputSize : get_file_size(inputPath);
+    res->inputBytes = originalSize;
+    res->sourcePixels = get_source_pixels(image);
+    res->encodedPixels = (long long)vips_image_get_width(image) * vips_image_get_height(image);
+    stats_worker_state(STATS_WORKER_ENCODING, NULL);
+    
+    // Too tall for one AVIF: segments (never the original, it is as tall)
+    int segmentHeight = get_segment_height(config, vips_image_get_height(image));
+    if (segmentHeight > 0) {
+        int result = compress_segments(image, segmentHeight, outputPath, originalName, config, writer, res);
+        g_object_unref(image);
+        vips_error_clear();
+        return result;
+    }
+    
+    char partPath[1200];
+    get_part_path(partPath, sizeof(partPath), outputPath);
+    
+    // Save as AVIF with specified quality (to memory when the writer stage writes it)
+    void *encoded = NULL;
+    size_t encodedSize = 0;
+    int result = writer ? save_avif(image, NULL, &encoded, &encodedSize, config)
+                        : save_avif(image, partPath, NULL, NULL, config);
+    if (result != 0) {
+        snprintf(res->error, sizeof(res->error), "encode failed: %s", vips_error_buffer());
+    } else {
+        stats_worker_state(STATS_WORKER_WRITING, NULL);
+    }
+    
+    g_object_unref(image);
+    vips_error_clear();
+    
+#ifdef _WIN32
+    // Small delay after processing each image to allow Windows to close file handles
+    // Since cache is disabled, we don't need to call vips_cache_drop_all() here
+    Sleep(10);
+#endif
+    
+    if (result != 0) {
+        fprintf(stderr, "Error saving AVIF: %s - %s\n", outputPath, res->error);
+        vips_error_clear();
+        remove(partPath);
+        return -1;
+    }
+    
+    // Check if compression was worthwhile (>15% reduction). Not for images
+    // shrunk on load: the AVIF is smaller in pixels, and the original is the
+    // full-size image the limits asked not to write.
+    long compressedSize = writer ? (long)encodedSize : get_file_size(partPath);
+    int shrunk = res->encodedPixels < res->sourcePixels;
+    if (compressedSize > 0 && originalSize > 0) {
+        double ratio = (double)compressedSize / (double)originalSize;
+        if (ratio > 0.85 && !shrunk) {
+            // Compression didn't help much, keep original format
+            char originalDest[1100];
+            get_kept_original_path(originalDest, sizeof(originalDest), outputPath, originalName);
+            if (writer) {
+                g_free(encoded);
+                if (writer_add(writer, originalDest, NULL, inputPath, originalSize, originalName) != 0) {
+                    snprintf(res->error, sizeof(res->error), "cannot queue output");
+                    return -1;
+                }
+            } else {
+                remove(partPath);
+                get_part_path(partPath, sizeof(partPath), originalDest);
+                if (copy_original(inputPath, partPath, config, originalSize) == 0) {
+                    rename_file(partPath, originalDest);
+                }
+            }
+            printf("Kept original (%.0f%%): %s\n", ratio * 100, originalName);
+            res->keptOriginal = 1;
+            res->outputBytes = originalSize;
+            return 0;
+        }
+        printf("Compressed to %.0f%%: %s\n", ratio * 100, originalName);
+    }
+    
+    if (writer) {
+        if (writer_add(writer, outputPath, encoded, NULL, compressedSize, originalName) != 0) {
+            snprintf(res->error, sizeof(res->error), "cannot queue output");
+            return -1;
+        }
+    } else if (rename_file(partPath, outputPath) != 0) {
+        fprintf(stderr, "Error moving AVIF into place: %s\n", outputPath);
+        snprintf(res->error, sizeof(res->error), "cannot move output into place");
+        remove(partPath);
+        return -1;
+    }
+    res->outputBytes = compressedSize;
+    return 0;
+}
+
+int processor_compress_buffer(const void *input, size_t inputSize, const CompressionConfig *config,
+                              void *(*allocFn)(size_t size, void *allocData), void *allocData,
+                              void **output, size_t *outputSize) {
+    *output = NULL;
+    *outputSize = 0;
+    
+    VipsImage *image = load_image(NULL, input, inputSize, config);
+    if (!image) {
+        fprintf(stderr, "Error loading image from memory: %s\n", vips_error_buffer());
+        vips_error_clear();
+        return -1;
+    }
+    
+    void *encoded = NULL;
+    size_t encodedSize = 0;
+    int result = save_avif(image, NULL, &encoded, &encodedSize, config);
+    g_object_unref(image);
+    
+    if (result != 0) {
+        fprintf(stderr, "Error encoding AVIF in memory: %s\n", vips_error_buffer());
+        vips_error_clear();
+        return -1;
+    }
+    
+    // Hand the caller memory from their own allocator (vips uses GLib's)
+    void *copy = allocFn ? allocFn(encodedSize, allocData) : malloc(encodedSize);
+    if (!copy) {
+        g_free(encoded);
+        return -1;
+    }
+    memcpy(copy, encoded, encodedSize);
+    g_free(encoded);
+    
+    *output = copy;
+    *outputSize = encodedSize;
+    return 0;
+}
+
+// ---- Encoder comparison (processor_benchmark_encoders) ----
+// Each sampled image is decoded once into memory, then encoded with every
+// available backend in turn, so only encode time is compared.
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+// Supported images directly in a folder, sorted by name
+// Returns: count (*files malloc'd, free each entry and the array), -1 on error
+static int list_folder_images(const char *folder, char ***files) {
+    int count = 0, capacity = 64;
+    char **list = (char **)malloc(capacity * sizeof(char *));
+    if (!list) return -1;
+#ifdef _WIN32
+    wchar_t wideSearchPath[520];
+    if (utf8_to_wide(folder, wideSearchPath, 510) == 0) {
+        free(list);
+        return -1;
+    }
+    wcscat(wideSearchPath, L"\\*");
+    WIN32_FIND_DATAW findData;
+    HANDLE hFind = FindFirstFileW(wideSearchPath, &findData);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        free(list);
+        return -1;
+    }
+    do {
+        char name[260];
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        wide_to_utf8(findData.cFileName, name, sizeof(name));
+#else
+    DIR *dir = opendir(folder);
+    if (!dir) {
+        free(list);
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (entry->d_type != DT_REG) continue;
+#endif
+        if (!is_supported_image(name)) continue;
+        if (count >= capacity) {
+            char **grown = (char **)realloc(list, capacity * 2 * sizeof(char *));
+            if (!grown) break;
+            list = grown;
+            capacity *= 2;
+        }
+        list[count++] = strdup(name);
+#ifdef _WIN32
+    } while (FindNextFileW(hFind, &findData));
+    FindClose(hFind);
+#else
+    }
+    closedir(dir);
+#endif
+    qsort(list, count, sizeof(char *), compare_names);
+    *files = list;
+    return count;
+}
+
+int processor_benchmark_encoders(const char *folder, const CompressionConfig *config, int sampleCount) {
+    char **files = NULL;
+    int fileCount = list_folder_images(folder, &files);
+    if (fileCount <= 0) {
+        fprintf(stderr, "Error: no images in %s\n", folder);
+        if (fileCount == 0) free(files);
+        return -1;
+    }
+    if (sampleCount < 1) sampleCount = 1;
+    if (sampleCount > fileCount) sampleCount = fileCount;
+    
+    int available = processor_available_encoders();
+    long long timeNs[ENCODER_COUNT] = { 0 };
+    long long outBytes[ENCODER_COUNT] = { 0 };
+    int encoded[ENCODER_COUNT] = { 0 };
+    long long inBytes = 0;
+    int sampled = 0;
+    
+    printf("Benchmark: %d of %d images from %s, Q%d, effort %d\n", sampleCount, fileCount, folder,
+           config->quality, speed_to_effort(config->speed));
+    
+    // Plugin loading and codec setup are paid by the first encode with each
+    // backend: pay them before timing, or the first backend looks slower
+    CompressionConfig trial = *config;
+    for (int e = 0; e < ENCODER_COUNT; e++) {
+        if (!(available & (1 << e))) continue;
+        trial.encoder = e;
+        get_encoder_setup_ns(&trial);
+    }
+    
+    for (int s = 0; s < sampleCount; s++) {
+        // Spread the sample over the whole folder
+        const char *name = files[(int)((long long)s * fileCount / sampleCount)];
+        char path[1100];
+        snprintf(path, sizeof(path), "%s%s%s", folder, PATH_SEP_STR, name);
+        VipsImage *loaded = load_image(path, NULL, 0, config);
+        VipsImage *image = loaded ? vips_image_copy_memory(loaded) : NULL;
+        if (loaded) g_object_unref(loaded);
+        if (!image) {
+            fprintf(stderr, "Skipping %s: %s\n", name, vips_error_buffer());
+            vips_error_clear();
+            continue;
+        }
+        inBytes += get_file_size(path);
+        sampled++;
+        
+        for (int e = 0; e < ENCODER_COUNT; e++) {
+            if (!(available & (1 << e))) continue;
+            trial.encoder = e;
+            void *output = NULL;
+            size_t outputSize = 0;
+            long long startNs = get_monotonic_ns();
+            if (save_avif(image, NULL, &output, &outputSize, &trial) == 0) {
+                timeNs[e] += get_monotonic_ns() - startNs;
+                outBytes[e] += (long long)outputSize;
+                encoded[e]++;
+            }
+            g_free(output);
+            vips_error_clear();
+        }
+        g_object_unref(image);
+    }
+    for (int i = 0; i < fileCount; i++) free(files[i]);
+    free(files);
+    if (sampled == 0) return -1;
+    
+    printf("\nENCODER  IMAGES  MS/IMAGE      OUTPUT  OF INPUT\n");
+    for (int e = 0; e < ENCODER_COUNT; e++) {
+        if (!(available & (1 << e))) continue;
+        if (encoded[e] == 0) {
+            printf("%-7s  %6d  %8s  %10s  %8s\n", encoderNames[e], 0, "-", "failed", "-");
+            continue;
+        }
+        printf("%-7s  %6d  %8.1f  %7.1f KB  %7.1f%%\n", encoderNames[e], encoded[e],
+               (double)timeNs[e] / encoded[e] / 1e6, (double)outBytes[e] / 1024.0,
+               inBytes > 0 ? (double)outBytes[e] * 100.0 / (double)inBytes : 0.0);
+    }
+    return 0;
+}
+
+// ---- Memory pressure: throttle admission of new images ----
+// Sampled at most every PRESSURE_SAMPLE_MS by whichever worker asks for work.
+// Under pressure the allowed worker count is halved (workers finishing an image
+// park instead of taking a new one); once pressure clears it ramps back up by one
+// worker per sample. PSI avg10 decays slowly, so separate high/clear thresholds
+// give some hysteresis.
+#define PRESSURE_SAMPLE_MS         500
+#define PRESSURE_SOME_AVG10_HIGH   10.0
+#define PRESSURE_SOME_AVG10_CLEAR  5.0
+#define PRESSURE_FULL_AVG10_HIGH   2.0
+#define PRESSURE_MEMLOAD_HIGH      90    // % (Windows / no-PSI fallback)
+#define PRESSURE_MEMLOAD_CLEAR     80
+
+typedef struct {
+    int maxWorkers;
+    int allowedWorkers;
+    long long rssLimit;         // Bytes, RSS above this counts as pressure
+    long long lastSampleNs;
+} MemoryThrottle;
+
+// Total physical RAM in bytes (0 if unknown)
+static long long get_total_ram(void) {
+#ifdef _WIN32
+    MEMORYSTATUSEX ms;
+    ms.dwLength = sizeof(ms);
+    if (GlobalMemoryStatusEx(&ms)) return (long long)ms.ullTotalPhys;
+    return 0;
+#else
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    return (pages > 0 && pageSize > 0) ? (long long)pages * pageSize : 0;
+#endif
+}
+
+static void memory_throttle_init(MemoryThrottle *mt, FolderJob *job, int numThreads) {
+    mt->maxWorkers = numThreads;
+    mt->allowedWorkers = numThreads;
+    mt->lastSampleNs = 0;
+    if (job->config.memoryLimitMB > 0) {
+        mt->rssLimit = (long long)job->config.memoryLimitMB * 1024 * 1024;
+    } else {
+        mt->rssLimit = get_total_ram() / 2;  // Auto: half of physical RAM
+    }
+    job->allowedThreads = 0;
+}
+
+// Returns 1 = under pressure, 0 = elevated (hold), -1 = clear
+static int sample_memory_pressure(const MemoryThrottle *mt) {
+    if (mt->rssLimit > 0 && get_process_ram_usage() > mt->rssLimit) return 1;
+    
+#ifdef _WIN32
+    MEMORYSTATUSEX ms;
+    ms.dwLength = sizeof(ms);
+    if (!GlobalMemoryStatusEx(&ms)) return -1;
+    if (ms.dwMemoryLoad >= PRESSURE_MEMLOAD_HIGH) return 1;
+    return ms.dwMemoryLoad < PRESSURE_MEMLOAD_CLEAR ? -1 : 0;
+#else
+    char line[256];
+    double someAvg10 = -1, fullAvg10 = -1;
+    FILE *f = fopen("/proc/pressure/memory", "r");
+    if (f) {
+        // "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, "some", 4) == 0) sscanf(line, "some avg10=%lf", &someAvg10);
+            else if (strncmp(line, "full", 4) == 0) sscanf(line, "full avg10=%lf", &fullAvg10);
+        }
+        fclose(f);
+    }
+    if (someAvg10 >= 0) {
+        if (someAvg10 >= PRESSURE_SOME_AVG10_HIGH || fullAvg10 >= PRESSURE_FULL_AVG10_HIGH) return 1;
+        return someAvg10 < PRESSURE_SOME_AVG10_CLEAR ? -1 : 0;
+    }
+    
+    // No PSI (old kernel or not Linux): fall back to MemAvailable/MemTotal
+    long long memTotal = 0, memAvailable = -1;
+    f = fopen("/proc/meminfo", "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            sscanf(line, "MemTotal: %lld kB", &memTotal);
+            sscanf(line, "MemAvailable: %lld kB", &memAvailable);
+        }
+        fclose(f);
+    }
+    if (memTotal <= 0 || memAvailable < 0) return -1;
+    int load = (int)(100 - memAvailable * 100 / memTotal);
+    if (load >= PRESSURE_MEMLOAD_HIGH) return 1;
+    return load < PRESSURE_MEMLOAD_CLEAR ? -1 : 0;
+#endif
+}
+
+// Called with the job lock held before a worker takes a new image.
+// Returns 1 if the worker may start another image now; it then counts itself
+// in job->activeThreads before releasing the lock.
+static int memory_throttle_admit(MemoryThrottle *mt, FolderJob *job) {
+    long long now = get_monotonic_ns();
+    if (now - mt->lastSampleNs >= PRESSURE_SAMPLE_MS * 1000000LL) {
+        mt->lastSampleNs = now;
+        int pressure = sample_memory_pressure(mt);
+        int allowed = mt->allowedWorkers;
+        if (pressure > 0) {
+            allowed = allowed / 2 > 0 ? allowed / 2 : 1;
+        } else if (pressure < 0 && allowed < mt->maxWorkers) {
+            allowed++;
+        }
+        if (allowed != mt->allowedWorkers) {
+            printf("Memory pressure: %d/%d workers allowed\n", allowed, mt->maxWorkers);
+            mt->allowedWorkers = allowed;
+            job->allowedThreads = allowed < mt->maxWorkers ? allowed : 0;
+        }
+    }
+    return job->activeThreads < mt->allowedWorkers;
+}
+
+typedef struct CpuGovernor CpuGovernor;
+typedef struct ReadAhead ReadAhead;
+typedef struct Decoder Decoder;
+
+// Isolated encoder child process owned by one worker thread (Linux only)
+typedef struct {
+    int pid;                    // 0 = not running
+    int fd;                     // Our end of the socketpair
+    int imagesDone;
+} EncoderProcess;
+
+// Input fed while the job runs (process_file_stream): full paths appended by
+// the reader under the job lock; the strings never move, the array may
+typedef struct {
+    char **paths;
+    int count;
+    int capacity;
+    int closed;                 // No more entries will arrive
+    char **outputNames;         // Per entry: AVIF base name if the default one was taken, else NULL
+    const char *outputDir;      // NULL = "<folder> (compressed)" next to each input
+    const char *mirrorPrefix;   // With outputDir: keep the subfolders below this prefix
+} FileStream;
+
+// Data passed to image processing threads
+typedef struct {
+    FolderJob *job;
+    char **imageFiles;
+    int imageCount;
+    FileStream *stream;         // Streamed input instead of imageFiles, NULL for folders
+    int *nextImageIndex;
+    int *deferred;              // Images leased by other processes, retried at the end
+    int *deferredCount;
+    pthread_mutex_t *lock;
+    int workerIndex;
+    char leasePath[1100];       // Lease currently held (guarded by lock), "" if none
+    MemoryThrottle *throttle;
+    CpuGovernor *governor;      // NULL when the job has no CPU cap
+    ReadAhead *readAhead;       // NULL when read-ahead is off
+    Decoder *decoder;           // NULL when each worker decodes its own images
+    Writer *writer;             // NULL when each worker writes its own outputs
+    volatile int running;       // Registered with the governor (guarded by governor->lock)
+    long long lastCpuNs;        // Governor bookkeeping: encoder process CPU, -1 until first sample
+    EncoderProcess encoder;     // Used when config.isolate is set (pid guarded by governor->lock)
+    long long encoderSetupNs;   // Fixed encoder cost per image, -1 if unknown (isolated encoders)
+    long long encodeNs;         // Time spent in compress_image_to_avif on images that succeeded
+    int encoded;
+    int shrunk;                 // Images downscaled on load, and pixels before/after
+    long long sourcePixels;
+    long long encodedPixels;
+    int workerCount;            // Workers of the job (tail detection)
+    int stoppedPid;             // Encoder process SIGSTOPped by the governor (Linux)
+} ParallelJobData;
+
+// ---- CPU cap (config.cpuLimit) ----
+// The cap has to hold for every thread doing the job's work: workers,
+// libvips' pools, the AV1 encoder's own threads, decoders and segment threads.
+// Stopping some threads doesn't do it (the others keep encoding), and stopping
+// a thread at an arbitrary point can leave a malloc arena or a vips lock held
+// for everyone else. So whole processes are capped:
+// - Linux: a cgroup v2 cpu.max, when the process can move itself into a
+//   cgroup of its own (a delegated, writable hierarchy).
+// - Windows: a job object with a hard CPU rate cap (Windows 8 and later).
+// - Otherwise, on Linux, the job encodes in isolated child processes and a
+//   governor measures the CPU time used every period; any excess is paid back
+//   by SIGSTOPping the children for a short slice, which stops all their
+//   threads at once.
+// The first two cover the UI thread too, which uses little; the short cgroup
+// period keeps it from waiting long. If several capped jobs share a process
+// (the embedding library), the lowest cap applies. A host program without
+// either gets a warning and an uncapped job: children can't be started there.
+#define GOVERNOR_PERIOD_MS    100
+#define GOVERNOR_MAX_STALL_MS 250
+#define GOVERNOR_MAX_DEBT_MS  1000      // Excess remembered at most, in ms at the capped rate
+#define CPU_CAP_PERIOD_US     20000     // cpu.max period: a throttled process waits less than this
+
+struct CpuGovernor {
+    pthread_mutex_t lock;
+    pthread_t thread;
+    volatile int stop;
+    int dutyCycle;              // 1 = governor thread stopping encoder processes, 0 = process-wide cap
+    double cpuRate;             // Allowed CPU-ns per wall-ns
+    ParallelJobData *workers;
+    int workerCount;
+    struct CpuGovernor *nextCapped;     // Jobs under the process-wide cap (cpuCapLock)
+};
+
+static pthread_mutex_t cpuCapLock = PTHREAD_MUTEX_INITIALIZER;
+static CpuGovernor *cappedJobs = NULL;
+
+#ifdef __linux__
+static char cpuCapParent[600] = "";     // Our cgroup before moving into cpuCapGroup
+static int cpuCapAddedController = 0;   // We handed the cpu controller down from cpuCapParent
+
+static int write_text_file(const char *path, const char *text) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) return -1;
+    size_t length = strlen(text);
+    ssize_t written = write(fd, text, length);
+    close(fd);
+    return written == (ssize_t)length ? 0 : -1;
+}
+
+// Move the process into a child of its cgroup where cpu.max can be set. The
+// cpu controller may have to be handed down first, which only works once no
+// other process is left in our cgroup (one that hands controllers to its
+// children can't hold processes itself).
+// Returns: 0 on success, -1 if not possible (we stay where we were)
+static int cpu_cap_group_enter(void) {
+    if (cpuCapGroup[0]) return 0;
+    
+    char line[512], cgPath[512] = "";
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            strncpy(cgPath, line + 3, sizeof(cgPath) - 1);
+            cgPath[strcspn(cgPath, "\n")] = '\0';
+            break;
+        }
+    }
+    fclose(f);
+    if (cgPath[0] != '/') return -1;    // cgroup v1 only
+    
+    char leaf[sizeof(cpuCapGroup)], file[800], pid[32];
+    snprintf(cpuCapParent, sizeof(cpuCapParent), "/sys/fs/cgroup%s", strcmp(cgPath, "/") == 0 ? "" : cgPath);
+    snprintf(leaf, sizeof(leaf), "%s/image-compressor-%d", cpuCapParent, (int)getpid());
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    if (mkdir(leaf, 0755) != 0 && errno != EEXIST) return -1;
+    snprintf(file, sizeof(file), "%s/cgroup.procs", leaf);
+    if (write_text_file(file, pid) != 0) {
+        rmdir(leaf);
+        return -1;
+    }
+    
+    snprintf(file, sizeof(file), "%s/cpu.max", leaf);
+    if (access(file, W_OK) != 0) {
+        char control[800];
+        snprintf(control, sizeof(control), "%s/cgroup.subtree_control", cpuCapParent);
+        cpuCapAddedController = write_text_file(control, "+cpu") == 0;
+    }
+    if (access(file, W_OK) != 0) {
+        snprintf(file, sizeof(file), "%s/cgroup.procs", cpuCapParent);
+        write_text_file(file, pid);
+        rmdir(leaf);
+        return -1;
+    }
+    strcpy(cpuCapGroup, leaf);
+    return 0;
+}
+
+// Back to the original cgroup, removing ours. If the parent already handed
+// the cpu controller down it can't take us back: we stay, uncapped.
+static void cpu_cap_group_leave(void) {
+    char file[800], pid[32];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    if (cpuCapAddedController) {
+        snprintf(file, sizeof(file), "%s/cgroup.subtree_control", cpuCapParent);
+        write_text_file(file, "-cpu");
+    }
+    snprintf(file, sizeof(file), "%s/cgroup.procs", cpuCapParent);
+    if (write_text_file(file, pid) != 0) return;
+    rmdir(cpuCapGroup);     // Fails while encoder children are still in it, harmless
+    cpuCapGroup[0] = '\0';
+    cpuCapAddedController = 0;
+}
+#endif
+
+// Cap the whole process at cpus CPUs, or lift the cap (cpus <= 0)
+// Returns: 0 on success, -1 if this process can't be capped this way
+static int cpu_cap_apply(double cpus) {
+#if defined(__linux__)
+    char file[800], value[64];
+    if (cpus <= 0) {
+        if (!cpuCapGroup[0]) return 0;
+        snprintf(file, sizeof(file), "%s/cpu.max", cpuCapGroup);
+        write_text_file(file, "max");
+        cpu_cap_group_leave();
+        return 0;
+    }
+    if (cpu_cap_group_enter() != 0) return -1;
+    long long quota = (long long)(cpus * CPU_CAP_PERIOD_US);
+    if (quota < 1000) quota = 1000;     // The kernel's minimum
+    snprintf(value, sizeof(value), "%lld %d", quota, CPU_CAP_PERIOD_US);
+    snprintf(file, sizeof(file), "%s/cpu.max", cpuCapGroup);
+    if (write_text_file(file, value) != 0) {
+        cpu_cap_group_leave();
+        return -1;
+    }
+    return 0;
+#elif defined(_WIN32) && defined(JOB_OBJECT_CPU_RATE_CONTROL_ENABLE)
+    static HANDLE cpuCapJob = NULL;     // The process can't leave a job: kept, uncapped when idle
+    if (!cpuCapJob) {
+        if (cpus <= 0) return 0;
+        HANDLE capJob = CreateJobObjectW(NULL, NULL);
+        if (!capJob) return -1;
+        if (!AssignProcessToJobObject(capJob, GetCurrentProcess())) {
+            CloseHandle(capJob);
+            return -1;
+        }
+        cpuCapJob = capJob;
+    }
+    JOBOBJECT_CPU_RATE_CONTROL_INFORMATION info;
+    memset(&info, 0, sizeof(info));
+    if (cpus > 0) {
+        // CpuRate is in 1/10000 of every processor in the system
+        DWORD total = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+        int rate = (int)(cpus * 10000.0 / (double)(total > 0 ? total : 1));
+        info.ControlFlags = JOB_OBJECT_CPU_RATE_CONTROL_ENABLE | JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP;
+        info.CpuRate = rate < 1 ? 1 : rate > 10000 ? 10000 : rate;
+    }
+    return SetInformationJobObject(cpuCapJob, JobObjectCpuRateControlInformation, &info, sizeof(info)) ? 0 : -1;
+#else
+    return cpus > 0 ? -1 : 0;
+#endif
+}
+
+// Put a job under the process-wide cap (the lowest of all capped jobs)
+// Returns: 0 on success, -1 if the process can't be capped
+static int cpu_cap_add(CpuGovernor *gov) {
+    pthread_mutex_lock(&cpuCapLock);
+    double cpus = gov->cpuRate;
+    for (CpuGovernor *g = cappedJobs; g; g = g->nextCapped) {
+        if (g->cpuRate < cpus) cpus = g->cpuRate;
+    }
+    int result = cpu_cap_apply(cpus);
+    if (result == 0) {
+        gov->nextCapped = cappedJobs;
+        cappedJobs = gov;
+    }
+    pthread_mutex_unlock(&cpuCapLock);
+    return result;
+}
+
+static void cpu_cap_remove(CpuGovernor *gov) {
+    pthread_mutex_lock(&cpuCapLock);
+    for (CpuGovernor **g = &cappedJobs; *g; g = &(*g)->nextCapped) {
+        if (*g == gov) {
+            *g = gov->nextCapped;
+            break;
+        }
+    }
+    double cpus = 0;
+    for (CpuGovernor *g = cappedJobs; g; g = g->nextCapped) {
+        if (cpus == 0 || g->cpuRate < cpus) cpus = g->cpuRate;
+    }
+    cpu_cap_apply(cpus);
+    pthread_mutex_unlock(&cpuCapLock);
+}
+
+// Process CPU time (user + system) in ns
+static long long process_cpu_ns(void) {
+#ifdef _WIN32
+    FILETIME creation, exitTime, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exitTime, &kernel, &user)) return 0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+    return (long long)(k.QuadPart + u.QuadPart) * 100;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    return ((long long)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000LL +
+           ((long long)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000LL;
+#endif
+}
+
+#ifdef __linux__
+// CPU time of a worker's isolated encoder process so far, -1 if it has none
+static long long encoder_cpu_ns(ParallelJobData *w) {
+    clockid_t cid;
+    struct timespec ts;
+    if (w->encoder.pid <= 0 || clock_getcpuclockid(w->encoder.pid, &cid) != 0 || clock_gettime(cid, &ts) != 0) return -1;
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Stop every running encoder process for stallNs, then let them go on
+static void stall_encoders(CpuGovernor *gov, long long stallNs) {
+    pthread_mutex_lock(&gov->lock);
+    for (int i = 0; i < gov->workerCount; i++) {
+        ParallelJobData *w = &gov->workers[i];
+        if (w->running && w->encoder.pid > 0 && kill(w->encoder.pid, SIGSTOP) == 0) {
+            w->stoppedPid = w->encoder.pid;
+        }
+    }
+    pthread_mutex_unlock(&gov->lock);
+    
+    struct timespec ts = { (time_t)(stallNs / 1000000000LL), (long)(stallNs % 1000000000LL) };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+    
+    // A worker unpublishes its pid (under the lock) before reaping the child,
+    // so a pid still published can't have been reused
+    pthread_mutex_lock(&gov->lock);
+    for (int i = 0; i < gov->workerCount; i++) {
+        ParallelJobData *w = &gov->workers[i];
+        if (w->stoppedPid > 0 && w->stoppedPid == w->encoder.pid) kill(w->stoppedPid, SIGCONT);
+        w->stoppedPid = 0;
+    }
+    pthread_mutex_unlock(&gov->lock);
+}
+
+static void* cpu_governor_thread(void *arg) {
+    CpuGovernor *gov = (CpuGovernor *)arg;
+    long long lastWall = get_monotonic_ns();
+    long long lastProcessNs = process_cpu_ns();
+    double debtNs = 0;
+    
+    while (!gov->stop) {
+        processor_sleep(GOVERNOR_PERIOD_MS);
+        
+        long long now = get_monotonic_ns();
+        long long processNs = process_cpu_ns();
+        long long usedNs = processNs > lastProcessNs ? processNs - lastProcessNs : 0;
+        lastProcessNs = processNs;
+        int running = 0;
+        
+        pthread_mutex_lock(&gov->lock);
+        for (int i = 0; i < gov->workerCount; i++) {
+            ParallelJobData *w = &gov->workers[i];
+            if (!w->running) continue;
+            long long cpu = encoder_cpu_ns(w);
+            if (cpu < 0) continue;
+            running++;
+            // An encoder process that was recycled restarts its clock
+            if (w->lastCpuNs >= 0 && cpu > w->lastCpuNs) usedNs += cpu - w->lastCpuNs;
+            w->lastCpuNs = cpu;
+        }
+        pthread_mutex_unlock(&gov->lock);
+        
+        debtNs += (double)usedNs - gov->cpuRate * (double)(now - lastWall);
+        lastWall = now;
+        
+        // Don't bank idle time beyond one period, or a burst could blow the cap.
+        // Nor excess beyond GOVERNOR_MAX_DEBT_MS: what the parent uses between
+        // images can't be stopped, and repaying all of it would starve the encoders.
+        double maxCredit = gov->cpuRate * GOVERNOR_PERIOD_MS * 1e6;
+        double maxDebt = gov->cpuRate * GOVERNOR_MAX_DEBT_MS * 1e6;
+        if (debtNs < -maxCredit) debtNs = -maxCredit;
+        if (debtNs > maxDebt) debtNs = maxDebt;
+        if (debtNs <= 0 || running == 0) continue;
+        
+        // While stalled (almost) nothing runs, so the debt is repaid at cpuRate
+        long long stallNs = (long long)(debtNs / gov->cpuRate);
+        if (stallNs > GOVERNOR_MAX_STALL_MS * 1000000LL) stallNs = GOVERNOR_MAX_STALL_MS * 1000000LL;
+        stall_encoders(gov, stallNs);
+    }
+    return NULL;
+}
+#endif
+
+// A background job's encodes run on libvips pool threads (and the encoder's
+// own threads), which take their priority from whichever thread created them,
+// not from the worker that queued the work. On Linux the job is therefore
+// encoded in isolated processes that are lowered as a whole before they start
+// any thread (see encoder_process_start). Elsewhere, and inside a host
+// program, only the job's own threads can be lowered.
+static void isolate_background_job(FolderJob *job) {
+#ifdef __linux__
+    if (!job->config.background || job->config.isolate || processorEmbedded) return;
+    printf("Background: encoding in isolated processes at idle priority\n");
+    job->config.isolate = 1;
+#else
+    (void)job;
+#endif
+}
+
+// Start capping the job's CPU if it has a cap (NULL if it has none or it
+// can't be enforced). Without a process-wide cap this turns config.isolate
+// on, so it must run before the stages that depend on it start.
+static CpuGovernor* start_cpu_governor(FolderJob *job, ParallelJobData *workers, int workerCount) {
+    int limit = job->config.cpuLimit;
+    if (limit <= 0 || limit >= 100) return NULL;
+    
+    CpuGovernor *gov = (CpuGovernor *)calloc(1, sizeof(CpuGovernor));
+    if (!gov) return NULL;
+    pthread_mutex_init(&gov->lock, NULL);
+    gov->cpuRate = (double)limit / 100.0 * (double)get_cpu_count();
+    gov->workers = workers;
+    gov->workerCount = workerCount;
+    
+    if (cpu_cap_add(gov) == 0) {
+#ifdef _WIN32
+        printf("CPU cap: %d%% (%.1f CPUs, job object)\n", limit, gov->cpuRate);
+#else
+        printf("CPU cap: %d%% (%.1f CPUs, cgroup cpu.max)\n", limit, gov->cpuRate);
+#endif
+        return gov;
+    }
+
+#ifdef __linux__
+    if (!processorEmbedded) {
+        if (!job->config.isolate) {
+            printf("CPU cap: no cgroup of our own, encoding in isolated processes\n");
+            job->config.isolate = 1;
+        }
+        if (pthread_create(&gov->thread, NULL, cpu_governor_thread, gov) == 0) {
+            gov->dutyCycle = 1;
+            printf("CPU cap: %d%% (%.1f CPUs, encoder processes stopped when over)\n", limit, gov->cpuRate);
+            return gov;
+        }
+    }
+#endif
+    fprintf(stderr, "Warning: the CPU cap can't be enforced in this process, the job runs uncapped\n");
+    pthread_mutex_destroy(&gov->lock);
+    free(gov);
+    return NULL;
+}
+
+static void stop_cpu_governor(CpuGovernor *gov) {
+    if (!gov) return;
+    if (gov->dutyCycle) {
+        gov->stop = 1;
+        pthread_join(gov->thread, NULL);
+    } else {
+        cpu_cap_remove(gov);
+    }
+    pthread_mutex_destroy(&gov->lock);
+    free(gov);
+}
+
+static void governor_register_worker(ParallelJobData *data) {
+    if (!data->governor) return;
+    pthread_mutex_lock(&data->governor->lock);
+    data->lastCpuNs = -1;
+    data->running = 1;
+    pthread_mutex_unlock(&data->governor->lock);
+}
+
+// Must be called before the worker exits: after this the governor won't touch it
+static void governor_unregister_worker(ParallelJobData *data) {
+    if (!data->governor) return;
+    pthread_mutex_lock(&data->governor->lock);
+    data->running = 0;
+    pthread_mutex_unlock(&data->governor->lock);
+}
+
+// ---- Isolated encoding: recycled child processes ----
+// Each worker thread owns one child (this same executable started with
+// ENCODER_SERVER_ARG) and sends it one image at a time over a socketpair.
+// A crash in a decoder/encoder only loses that image; the child is reaped and
+// a fresh one is started for the next image. Children are recycled after a
+// number of images or once their peak RSS grows too large, which returns
+// fragmented heap memory to the OS.
+#define ENCODER_SERVER_FD          3
+#define ENCODER_RECYCLE_IMAGES     100
+#define ENCODER_RECYCLE_RSS_BYTES  (1024LL * 1024 * 1024)
+
+#ifdef __linux__
+typedef struct {
+    CompressionConfig config;
+    int inputLen;               // String lengths including the terminator
+    int outputLen;
+    int nameLen;
+} EncodeRequest;
+
+typedef struct {
+    int result;                 // compress_image_to_avif() return value
+    ImageResult image;
+    long long peakRss;          // Child's peak RSS so far, in bytes
+} EncodeReply;
+
+static int read_full(int fd, void *buf, size_t len) {
+    char *p = (char *)buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// send() with MSG_NOSIGNAL so a dead peer is an error, not a SIGPIPE
+static int write_full(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Publish the current encoder pid to the CPU governor (if any)
+static void set_encoder_pid(ParallelJobData *data, int pid) {
+    if (data->governor) pthread_mutex_lock(&data->governor->lock);
+    data->encoder.pid = pid;
+    if (data->governor) pthread_mutex_unlock(&data->governor->lock);
+}
+
+static int encoder_process_start(ParallelJobData *data) {
+    EncoderProcess *ep = &data->encoder;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) return -1;
+    
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // Child: only async-signal-safe calls until exec
+        if (sv[1] == ENCODER_SERVER_FD) {
+            fcntl(sv[1], F_SETFD, 0);
+        } else if (dup2(sv[1], ENCODER_SERVER_FD) < 0) {
+            _exit(127);
+        }
+        if (data->job->config.background) {
+            // Still single-threaded: every thread the server starts inherits this
+            struct sched_param param = { 0 };
+            if (sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+                setpriority(PRIO_PROCESS, 0, 19);
+            }
+#ifdef SYS_ioprio_set
+            syscall(SYS_ioprio_set, 1, 0, 3 << 13);     // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+#endif
+        }
+        char *const argv[] = { (char *)"compressor", (char *)ENCODER_SERVER_ARG, NULL };
+        execv("/proc/self/exe", argv);
+        _exit(127);
+    }
+    
+    close(sv[1]);
+    ep->fd = sv[0];
+    ep->imagesDone = 0;
+    set_encoder_pid(data, (int)pid);
+    return 0;
+}
+
+static void encoder_process_stop(ParallelJobData *data) {
+    EncoderProcess *ep = &data->encoder;
+    if (ep->pid <= 0) return;
+    int pid = ep->pid;
+    set_encoder_pid(data, 0);
+    close(ep->fd);  // EOF makes the server exit
+    ep->fd = -1;
+    waitpid(pid, NULL, 0);
+}
+
+// "<marker><tid>.part", the tail of a part name written by the process in marker
+static int is_part_suffix(const char *rest, const char *marker) {
+    size_t markerLen = strlen(marker);
+    if (strncmp(rest, marker, markerLen) != 0) return 0;
+    rest += markerLen;
+    if (!isdigit((unsigned char)*rest)) return 0;
+    while (isdigit((unsigned char)*rest)) rest++;
+    return strcmp(rest, ".part") == 0;
+}
+
+// A child died on an image: remove the temporaries it left for that output
+// (AVIF, segments, manifest and kept original, written by any of its
+// threads), and the finished segments if there is no manifest to use them
+static void remove_encoder_leftovers(const char *outputPath, const char *originalName, int pid) {
+    char dirPath[1024];
+    strncpy(dirPath, outputPath, sizeof(dirPath) - 1);
+    dirPath[sizeof(dirPath) - 1] = '\0';
+    char *lastSlash = strrchr(dirPath, PATH_SEP);
+    if (!lastSlash) return;
+    *lastSlash = '\0';
+    const char *outputName = lastSlash + 1;
+    size_t outputLen = strlen(outputName);
+    size_t baseLen = outputLen;
+    if (baseLen >= 5 && strcmp(outputName + baseLen - 5, ".avif") == 0) baseLen -= 5;
+    size_t originalLen = strlen(originalName);
+    
+    char manifestPath[1100];
+    get_segment_path(manifestPath, sizeof(manifestPath), outputPath, ".segments");
+    int haveManifest = file_exists(manifestPath);
+    char marker[320];
+    pthread_once(&partHostOnce, init_part_host);
+    snprintf(marker, sizeof(marker), ".%s.%d.", partHost, pid);
+    
+    DIR *dir = opendir(dirPath);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        int leftover = 0;
+        if (strncmp(name, outputName, outputLen) == 0) {
+            leftover = is_part_suffix(name + outputLen, marker);
+        }
+        if (!leftover && strncmp(name, originalName, originalLen) == 0) {
+            leftover = is_part_suffix(name + originalLen, marker);
+        }
+        if (!leftover && strncmp(name, outputName, baseLen) == 0) {
+            const char *rest = name + baseLen;
+            if (strncmp(rest, ".segments", 9) == 0) {
+                leftover = is_part_suffix(rest + 9, marker);
+            } else if (strncmp(rest, "_seg", 4) == 0 && isdigit((unsigned char)rest[4])) {
+                rest += 4;
+                while (isdigit((unsigned char)*rest)) rest++;
+                if (strncmp(rest, ".avif", 5) == 0) {
+                    rest += 5;
+                    leftover = *rest == '\0' ? !haveManifest : is_part_suffix(rest, marker);
+                }
+            }
+        }
+        if (!leftover) continue;
+        char path[1400];
+        snprintf(path, sizeof(path), "%s%s%s", dirPath, PATH_SEP_STR, name);
+        remove(path);
+    }
+    closedir(dir);
+}
+
+// Compress one image in the worker's child process.
+// Returns the encoder's result, or -1 if the child died on this image.
+static int encoder_process_compress(ParallelJobData *data, const char *inputPath,
+                                    const char *outputPath, const char *originalName,
+                                    ImageResult *res) {
+    EncoderProcess *ep = &data->encoder;
+    if (ep->pid <= 0 && encoder_process_start(data) != 0) {
+        fprintf(stderr, "Warning: could not start encoder process, encoding in-process\n");
+        return compress_image_to_avif(inputPath, NULL, 0, NULL, outputPath, originalName, &data->job->config, NULL, res);
+    }
+    
+    EncodeRequest req;
+    req.config = data->job->config;
+    req.inputLen = (int)strlen(inputPath) + 1;
+    req.outputLen = (int)strlen(outputPath) + 1;
+    req.nameLen = (int)strlen(originalName) + 1;
+    
+    EncodeReply reply;
+    if (write_full(ep->fd, &req, sizeof(req)) != 0 ||
+        write_full(ep->fd, inputPath, req.inputLen) != 0 ||
+        write_full(ep->fd, outputPath, req.outputLen) != 0 ||
+        write_full(ep->fd, originalName, req.nameLen) != 0 ||
+        read_full(ep->fd, &reply, sizeof(reply)) != 0) {
+        int pid = ep->pid;
+        int status = 0;
+        set_encoder_pid(data, 0);
+        close(ep->fd);
+        ep->fd = -1;
+        waitpid(pid, &status, 0);
+        memset(res, 0, sizeof(*res));
+        if (WIFSIGNALED(status)) {
+            fprintf(stderr, "Encoder process %d crashed (signal %d) on: %s\n", pid, WTERMSIG(status), originalName);
+            snprintf(res->error, sizeof(res->error), "encoder crashed (signal %d)", WTERMSIG(status));
+        } else {
+            fprintf(stderr, "Encoder process %d exited (status %d) on: %s\n", pid, WEXITSTATUS(status), originalName);
+            snprintf(res->error, sizeof(res->error), "encoder exited (status %d)", WEXITSTATUS(status));
+        }
+        remove_encoder_leftovers(outputPath, originalName, pid);
+        return -1;
+    }
+    
+    ep->imagesDone++;
+    if (ep->imagesDone >= ENCODER_RECYCLE_IMAGES || reply.peakRss >= ENCODER_RECYCLE_RSS_BYTES) {
+        printf("Recycling encoder process %d (%d images, peak RSS %lld MB)\n",
+               ep->pid, ep->imagesDone, reply.peakRss / (1024 * 1024));
+        encoder_process_stop(data);
+    }
+    *res = reply.image;
+    return reply.result;
+}
+#endif
+
+int processor_encoder_server_main(void) {
+#ifdef __linux__
+    if (!processor_init()) return 1;
+    
+    int fd = ENCODER_SERVER_FD;
+    EncodeRequest req;
+    char inputPath[1024], outputPath[1024], originalName[1024];
+    
+    while (read_full(fd, &req, sizeof(req)) == 0) {
+        if (req.inputLen <= 0 || req.inputLen > (int)sizeof(inputPath) ||
+            req.outputLen <= 0 || req.outputLen > (int)sizeof(outputPath) ||
+            req.nameLen <= 0 || req.nameLen > (int)sizeof(originalName)) {
+            break;
+        }
+        if (read_full(fd, inputPath, req.inputLen) != 0 ||
+            read_full(fd, outputPath, req.outputLen) != 0 ||
+            read_full(fd, originalName, req.nameLen) != 0) {
+            break;
+        }
+        inputPath[req.inputLen - 1] = '\0';
+        outputPath[req.outputLen - 1] = '\0';
+        originalName[req.nameLen - 1] = '\0';
+        
+        EncodeReply reply;
+        reply.result = compress_image_to_avif(inputPath, NULL, 0, NULL, outputPath, originalName, &req.config, NULL, &reply.image);
+        fflush(stdout);
+        
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        reply.peakRss = (long long)ru.ru_maxrss * 1024;  // ru_maxrss is in KB on Linux
+        if (write_full(fd, &reply, sizeof(reply)) != 0) break;
+    }
+    
+    processor_shutdown();
+    return 0;
+#else
+    fprintf(stderr, "Encoder server mode is only supported on Linux\n");
+    return 1;
+#endif
+}
+
+// ---- Dispatch order for spinning disks (config.diskOrder) ----
+// readdir() order has nothing to do with where the files sit on the platter,
+// so a cold folder on a HDD is read with a seek per file. With diskOrder the
+// list is sorted by the physical offset of each file's first extent (FIEMAP,
+// Linux) or, where that isn't available, by inode number, which most
+// filesystems allocate roughly in disk order. Workers still take images in
+// list order, so reads sweep across the disk instead of jumping around.
+#ifndef _WIN32
+typedef struct {
+    unsigned long long key;
+    char *name;
+} DiskOrderEntry;
+
+static int compare_disk_order(const void *a, const void *b) {
+    const DiskOrderEntry *x = (const DiskOrderEntry *)a;
+    const DiskOrderEntry *y = (const DiskOrderEntry *)b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+// Physical byte offset of a file's first extent
+// Returns: 0 on success, -1 if unknown (no FIEMAP, empty or inline file)
+static int get_physical_offset(const char *path, unsigned long long *offset) {
+#if defined(__linux__) && defined(FS_IOC_FIEMAP)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    union {
+        struct fiemap map;
+        char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.map.fm_length = ~0ULL;
+    request.map.fm_extent_count = 1;
+    int result = -1;
+    if (ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents > 0 &&
+        !(request.map.fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE))) {
+        *offset = request.map.fm_extents[0].fe_physical;
+        result = 0;
+    }
+    close(fd);
+    return result;
+#else
+    (void)path;
+    (void)offset;
+    return -1;
+#endif
+}
+
+// Sort the image list into on-disk order
+static void sort_by_disk_order(FolderJob *job, char **imageFiles, int imageCount) {
+    if (imageCount <= 1) return;
+    DiskOrderEntry *entries = (DiskOrderEntry *)malloc(imageCount * sizeof(DiskOrderEntry));
+    if (!entries) return;
+    
+    long long startNs = get_monotonic_ns();
+    int byExtent = 0;
+    char path[1100];
+    for (int i = 0; i < imageCount; i++) {
+        snprintf(path, sizeof(path), "%s%s%s", job->sourcePath, PATH_SEP_STR, imageFiles[i]);
+        entries[i].name = imageFiles[i];
+        entries[i].key = 0;
+        if (get_physical_offset(path, &entries[i].key) == 0) {
+            byExtent++;
+            continue;
+        }
+        struct stat st;
+        if (stat(path, &st) == 0) entries[i].key = (unsigned long long)st.st_ino;
+    }
+    // Physical offsets and inode numbers don't mix: use offsets only if every file has one
+    if (byExtent > 0 && byExtent < imageCount) {
+        for (int i = 0; i < imageCount; i++) {
+            snprintf(path, sizeof(path), "%s%s%s", job->sourcePath, PATH_SEP_STR, imageFiles[i]);
+            struct stat st;
+            entries[i].key = stat(path, &st) == 0 ? (unsigned long long)st.st_ino : 0;
+        }
+        byExtent = 0;
+    }
+    qsort(entries, imageCount, sizeof(DiskOrderEntry), compare_disk_order);
+    for (int i = 0; i < imageCount; i++) {
+        imageFiles[i] = entries[i].name;
+    }
+    free(entries);
+    printf("Disk order: %d images sorted by %s in %.1f ms\n", imageCount,
+           byExtent ? "physical extent" : "inode", (double)(get_monotonic_ns() - startNs) / 1e6);
+}
+#endif
+
+// ---- Cooperative processing of one folder by several processes ----
+// Static: --shard i/N keeps only the images whose name hashes to shard i, so
+// every process gets the same split regardless of readdir order.
+// Dynamic (POSIX): a process claims an image by creating ".<name>.lease" in the
+// output folder with O_EXCL and deletes it when done. A keeper thread refreshes
+// the mtime of held leases every ttl/3; a lease older than ttl, or owned by a
+// dead pid on this host, is abandoned and gets reclaimed (see lease_reclaim).
+// Images leased by someone else are retried once the rest of the folder is done.
+#define LEASE_DEFAULT_TTL_SEC 120
+
+#define LEASE_ACQUIRED  1
+#define LEASE_BUSY      0
+#define LEASE_ERROR    -1
+
+// FNV-1a, stable across processes and machines
+static unsigned int hash_name(const char *name) {
+    unsigned int h = 2166136261u;
+    for (; *name; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Drop images that belong to other shards. Returns the new image count.
+static int apply_shard_filter(FolderJob *job, char **imageFiles, int imageCount) {
+    int count = job->config.shardCount;
+    int index = job->config.shardIndex;
+    if (count <= 1 || index < 0 || index >= count) return imageCount;
+    
+    int kept = 0;
+    for (int i = 0; i < imageCount; i++) {
+        if (hash_name(imageFiles[i]) % (unsigned int)count == (unsigned int)index) {
+            imageFiles[kept++] = imageFiles[i];
+        } else {
+            free(imageFiles[i]);
+        }
+    }
+    printf("Shard %d/%d: %d of %d images\n", index, count, kept, imageCount);
+    return kept;
+}
+
+static int get_lease_ttl(FolderJob *job) {
+    return job->config.leaseTtl > 0 ? job->config.leaseTtl : LEASE_DEFAULT_TTL_SEC;
+}
+
+#ifndef _WIN32
+static void get_lease_path(char *leasePath, size_t size, const char *outputDir, const char *name) {
+    snprintf(leasePath, size, "%s%c.%s.lease", outputDir, PATH_SEP, name);
+}
+
+// st: the lease as just stat'ed
+static int lease_is_stale(const char *leasePath, const struct stat *st, int ttl) {
+    if (time(NULL) - st->st_mtime > ttl) return 1;
+
+    // Same host: no need to wait for the TTL if the owner is gone
+    int stale = 0;
+    FILE *f = fopen(leasePath, "r");
+    if (f) {
+        char owner[256], host[256];
+        int pid;
+        if (fscanf(f, "%255s %d", owner, &pid) == 2 && gethostname(host, sizeof(host)) == 0) {
+            host[sizeof(host) - 1] = '\0';
+            if (strcmp(owner, host) == 0 && kill(pid, 0) != 0 && errno == ESRCH) stale = 1;
+        }
+        fclose(f);
+    }
+    return stale;
+}
+
+// Remove an abandoned lease, safely against other processes reclaiming it too.
+// Each hard-links it to a marker named after its inode and mtime: link() is
+// atomic (NFS included), so only one of them gets the marker, and it checks
+// that it linked that very lease and not a fresh one created meanwhile.
+// A fresh lease is therefore never deleted by a late reclaimer.
+// Returns: 1 if the stale lease was removed
+static int lease_reclaim(const char *leasePath, const struct stat *stale, int ttl) {
+    char markerPath[1200];
+    snprintf(markerPath, sizeof(markerPath), "%s.%llu-%lld.reclaim", leasePath,
+             (unsigned long long)stale->st_ino, (long long)stale->st_mtime);
+    if (link(leasePath, markerPath) != 0) {
+        // Another process is reclaiming it; a marker left by a crash expires
+        // (a link sets the ctime, the mtime is the stale lease's)
+        struct stat marker;
+        if (errno == EEXIST && stat(markerPath, &marker) == 0 && time(NULL) - marker.st_ctime > ttl) {
+            unlink(markerPath);
+        }
+        return 0;
+    }
+    
+    struct stat linked;
+    int ours = stat(markerPath, &linked) == 0 && linked.st_dev == stale->st_dev && linked.st_ino == stale->st_ino;
+    if (ours) unlink(leasePath);
+    unlink(markerPath);
+    return ours;
+}
+
+static int lease_try_acquire(const char *leasePath, int ttl) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = open(leasePath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd >= 0) {
+            char host[256] = "unknown";
+            gethostname(host, sizeof(host));
+            host[sizeof(host) - 1] = '\0';
+            char owner[320];
+            int len = snprintf(owner, sizeof(owner), "%s %d\n", host, (int)getpid());
+            if (write(fd, owner, len) != len) {
+                // Unreadable owner: other hosts still expire it by mtime
+            }
+            close(fd);
+            return LEASE_ACQUIRED;
+        }
+        if (errno != EEXIST) return LEASE_ERROR;
+        struct stat st;
+        if (stat(leasePath, &st) != 0) continue;        // Released meanwhile
+        if (!lease_is_stale(leasePath, &st, ttl) || !lease_reclaim(leasePath, &st, ttl)) return LEASE_BUSY;
+        printf("Reclaimed abandoned lease: %s\n", leasePath);
+    }
+    return LEASE_BUSY;
+}
+
+typedef struct {
+    pthread_t thread;
+    volatile int stop;
+    int ttl;
+    ParallelJobData *workers;
+    int workerCount;
+    pthread_mutex_t *lock;
+} LeaseKeeper;
+
+static void* lease_keeper_thread(void *arg) {
+    LeaseKeeper *keeper = (LeaseKeeper *)arg;
+    long long intervalNs = (long long)keeper->ttl * 1000000000LL / 3;
+    long long lastRefresh = get_monotonic_ns();
+    
+    while (!keeper->stop) {
+        processor_sleep(200);
+        if (get_monotonic_ns() - lastRefresh < intervalNs) continue;
+        lastRefresh = get_monotonic_ns();
+        
+        pthread_mutex_lock(keeper->lock);
+        for (int i = 0; i < keeper->workerCount; i++) {
+            if (keeper->workers[i].leasePath[0]) utime(keeper->workers[i].leasePath, NULL);
+        }
+        pthread_mutex_unlock(keeper->lock);
+    }
+    return NULL;
+}
+
+static LeaseKeeper* start_lease_keeper(FolderJob *job, ParallelJobData *workers, int workerCount, pthread_mutex_t *lock) {
+    if (!job->config.useLeases) return NULL;
+    LeaseKeeper *keeper = (LeaseKeeper *)calloc(1, sizeof(LeaseKeeper));
+    if (!keeper) return NULL;
+    keeper->ttl = get_lease_ttl(job);
+    keeper->workers = workers;
+    keeper->workerCount = workerCount;
+    keeper->lock = lock;
+    if (pthread_create(&keeper->thread, NULL, lease_keeper_thread, keeper) != 0) {
+        free(keeper);
+        return NULL;
+    }
+    return keeper;
+}
+
+static void stop_lease_keeper(LeaseKeeper *keeper) {
+    if (!keeper) return;
+    keeper->stop = 1;
+    pthread_join(keeper->thread, NULL);
+    free(keeper);
+}
+
+static void release_lease(ParallelJobData *data) {
+    pthread_mutex_lock(data->lock);
+    if (data->leasePath[0]) {
+        unlink(data->leasePath);
+        data->leasePath[0] = '\0';
+    }
+    pthread_mutex_unlock(data->lock);
+}
+#endif
+
+// Whether another process holds a live lease on an image: the read-ahead and
+// the decoder skip those, the worker would only defer them
+static int lease_held_elsewhere(FolderJob *job, const char *outputDir, const char *name) {
+#ifdef _WIN32
+    (void)job; (void)outputDir; (void)name;
+    return 0;
+#else
+    if (!job->config.useLeases) return 0;
+    char leasePath[1100];
+    get_lease_path(leasePath, sizeof(leasePath), outputDir, name);
+    struct stat st;
+    if (stat(leasePath, &st) != 0) return 0;
+    return !lease_is_stale(leasePath, &st, get_lease_ttl(job));
+#endif
+}
+
+// ---- Machine-readable event stream (JSON lines, see processor.h) ----
+#define EVENT_FORMAT_VERSION 1
+#define EVENT_PROGRESS_MS    500     // Minimum interval between progress events per job
+
+static FILE *eventOutput = NULL;
+static pthread_mutex_t eventLock = PTHREAD_MUTEX_INITIALIZER;
+static int lastEventJobId = 0;       // Guarded by eventLock
+
+void processor_set_event_output(FILE *out) {
+    pthread_mutex_lock(&eventLock);
+    eventOutput = out;
+    pthread_mutex_unlock(&eventLock);
+}
+
+
+// Write s as a quoted, escaped JSON string into dst
+static const char* json_quote(char *dst, size_t size, const char *s) {
+    size_t n = 0;
+    if (size < 3) return "\"\"";
+    dst[n++] = '"';
+    for (; *s && n + 7 < size; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            dst[n++] = '\\';
+            dst[n++] = (char)c;
+        } else if (c < 0x20) {
+            n += snprintf(dst + n, size - n, "\\u%04x", c);
+        } else {
+            dst[n++] = (char)c;
+        }
+    }
+    dst[n++] = '"';
+    dst[n] = '\0';
+    return dst;
+}
+
+// Give a job its event id (once)
+static void event_assign_job_id(FolderJob *job) {
+    pthread_mutex_lock(&eventLock);
+    if (job->eventId == 0) job->eventId = ++lastEventJobId;
+    pthread_mutex_unlock(&eventLock);
+}
+
+// Emit one event; fields is a printf format for the extra members (or NULL)
+static void emit_event(FolderJob *job, const char *event, const char *fields, ...) {
+    if (!eventOutput) return;
+    
+    char line[2048];
+    int len = snprintf(line, sizeof(line), "{\"v\":%d,\"t\":%lld,\"event\":\"%s\",\"job\":%d",
+                       EVENT_FORMAT_VERSION, get_unix_ms(), event, job->eventId);
+    if (fields && len < (int)sizeof(line) - 1) {
+        line[len++] = ',';
+        va_list args;
+        va_start(args, fields);
+        vsnprintf(line + len, sizeof(line) - len, fields, args);
+        va_end(args);
+    }
+    
+    // One write per line so lines from several workers never interleave
+    pthread_mutex_lock(&eventLock);
+    if (eventOutput) {
+        fprintf(eventOutput, "%s}\n", line);
+        fflush(eventOutput);
+    }
+    pthread_mutex_unlock(&eventLock);
+}
+
+void processor_event_job_queued(FolderJob *job) {
+    event_assign_job_id(job);
+    char folder[1100];
+    emit_event(job, "job_queued", "\"folder\":%s", json_quote(folder, sizeof(folder), job->sourcePath));
+}
+
+// Job start/end: event stream and shared-memory stats
+static void report_job_started(FolderJob *job, int streaming) {
+    stats_job_begin(job);
+    event_assign_job_id(job);
+    job->eventStartMs = get_monotonic_ns() / 1000000;
+    job->eventProgressMs = 0;
+    char folder[1100], output[1100];
+    emit_event(job, "job_started", "\"folder\":%s,\"output\":%s,\"total\":%d,\"threads\":%d,\"streaming\":%s",
+               json_quote(folder, sizeof(folder), job->sourcePath),
+               json_quote(output, sizeof(output), job->outputPath),
+               job->totalFiles, job->config.threads, streaming ? "true" : "false");
+}
+
+static void report_job_finished(FolderJob *job, const char *message) {
+    stats_job_end(job);
+    event_assign_job_id(job);
+    
+    // Where the memory went: libvips buffers vs. the whole process
+    VipsMemoryStats vm;
+    processor_get_vips_stats(&vm);
+    long long rss = get_process_ram_usage();
+    printf("Memory: RSS %lld MB, libvips %lld MB (peak %lld MB, %d allocs), %d files open, cache %d/%d ops\n",
+           rss / (1024 * 1024), vm.trackedBytes / (1024 * 1024), vm.trackedPeak / (1024 * 1024),
+           vm.trackedAllocs, vm.openFiles, vm.cacheOps, vm.cacheMaxOps);
+    
+    const char *status = job->status == JOB_COMPLETED ? "completed" :
+                         job->status == JOB_STOPPED ? "stopped" : "error";
+    char quoted[300];
+    emit_event(job, "job_finished", "\"status\":\"%s\",\"done\":%d,\"total\":%d,\"failed\":%d,\"ms\":%lld,"
+               "\"rss_bytes\":%lld,\"vips_bytes\":%lld,\"vips_peak_bytes\":%lld,\"vips_allocs\":%d,"
+               "\"vips_files\":%d,\"cache_ops\":%d%s%s",
+               status, job->doneFiles, job->totalFiles, job->failedFiles,
+               job->eventStartMs ? get_monotonic_ns() / 1000000 - job->eventStartMs : 0LL,
+               rss, vm.trackedBytes, vm.trackedPeak, vm.trackedAllocs, vm.openFiles, vm.cacheOps,
+               message ? ",\"error\":" : "", message ? json_quote(quoted, sizeof(quoted), message) : "");
+}
+
+// ---- Streamed input (file lists on stdin) ----
+
+// Create a folder and any missing parents
+static void make_dirs(const char *path) {
+    if (check_is_directory(path)) return;
+    
+    char partial[1024];
+    strncpy(partial, path, sizeof(partial) - 1);
+    partial[sizeof(partial) - 1] = '\0';
+    for (char *p = partial + 1; *p; p++) {
+        if (*p != PATH_SEP && *p != '/') continue;
+        char sep = *p;
+        *p = '\0';
+#ifdef _WIN32
+        create_dir_unicode(partial);
+#else
+        my_mkdir(partial);
+#endif
+        *p = sep;
+    }
+#ifdef _WIN32
+    create_dir_unicode(partial);
+#else
+    my_mkdir(partial);
+#endif
+}
+
+// Output folder for a streamed input path:
+//   no outputDir:           "<input folder> (compressed)", like folder jobs
+//   outputDir + prefix:     outputDir + the input folder below the prefix
+//   outputDir alone:        outputDir (flat)
+static void get_stream_output_dir(const FileStream *stream, const char *inputPath, char *outputDir, size_t size) {
+    char inputDir[1024];
+    size_t dirLen = (size_t)(path_basename(inputPath) - inputPath);
+    if (dirLen > 0) dirLen--;                          // Drop the separator
+    if (dirLen >= sizeof(inputDir)) dirLen = sizeof(inputDir) - 1;
+    memcpy(inputDir, inputPath, dirLen);
+    inputDir[dirLen] = '\0';
+    if (dirLen == 0) strcpy(inputDir, path_basename(inputPath) == inputPath ? "." : PATH_SEP_STR);
+    
+    if (!stream->outputDir) {
+        get_output_folder_path(inputDir, outputDir, (int)size);
+        return;
+    }
+    
+    size_t prefixLen = stream->mirrorPrefix ? strlen(stream->mirrorPrefix) : 0;
+    if (prefixLen > 0 && strncmp(inputDir, stream->mirrorPrefix, prefixLen) == 0 &&
+        (inputDir[prefixLen] == '\0' || inputDir[prefixLen] == PATH_SEP || inputDir[prefixLen] == '/' ||
+         stream->mirrorPrefix[prefixLen - 1] == PATH_SEP || stream->mirrorPrefix[prefixLen - 1] == '/')) {
+        const char *relative = inputDir + prefixLen;
+        while (*relative == PATH_SEP || *relative == '/') relative++;
+        if (*relative) {
+            snprintf(outputDir, size, "%s%c%s", stream->outputDir, PATH_SEP, relative);
+            return;
+        }
+    }
+    snprintf(outputDir, size, "%s", stream->outputDir);
+}
+
+// Output name of an entry: its file name without the extension
+static void get_output_base_name(const char *entry, char *baseName, size_t size) {
+    strncpy(baseName, path_basename(entry), size - 1);
+    baseName[size - 1] = '\0';
+    char *dot = strrchr(baseName, '.');
+    if (dot) *dot = '\0';
+}
+
+// Input file, output folder and output AVIF path of a list entry
+// outputName: base name to use instead of the entry's (FileStream.outputNames), or NULL
+static void get_image_paths(const ParallelJobData *data, const char *entry, const char *outputName,
+                            char *inputPath, char *outputDir, char *outputPath, size_t size) {
+    if (data->stream) {
+        snprintf(inputPath, size, "%s", entry);
+        get_stream_output_dir(data->stream, entry, outputDir, size);
+    } else {
+        snprintf(inputPath, size, "%s%c%s", data->job->sourcePath, PATH_SEP, entry);
+        snprintf(outputDir, size, "%s", data->job->outputPath);
+    }
+    
+    // Build output path by stripping original extension
+    char baseName[260];
+    if (outputName) {
+        snprintf(baseName, sizeof(baseName), "%s", outputName);
+    } else {
+        get_output_base_name(entry, baseName, sizeof(baseName));
+    }
+    
+    snprintf(outputPath, size, "%s%c%s.avif", outputDir, PATH_SEP, baseName);
+}
+
+// Output paths handed out by a stream, so two inputs never share one: with a
+// flat --output-dir, a/001.jpg and b/001.jpg would both become 001.avif (and
+// a.jpg/a.png collide anywhere). Only the reader thread uses it. Keyed by a
+// 64-bit hash of the path, case-folded for Windows/macOS file systems; a false
+// hit only renames an output, it never loses one.
+typedef struct {
+    unsigned long long *slots;  // 0 = empty
+    int capacity;               // Power of two
+    int count;
+} OutputSet;
+
+static unsigned long long hash_output_path(const char *path) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (; *path; path++) {
+        unsigned char c = (unsigned char)tolower((unsigned char)*path);
+        if (c == '\\') c = '/';
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+// Returns: 1 if the path was added, 0 if it was already taken, -1 if out of memory
+static int output_set_add(OutputSet *set, const char *path) {
+    if ((set->count + 1) * 2 > set->capacity) {
+        int capacity = set->capacity ? set->capacity * 2 : 1024;
+        unsigned long long *slots = (unsigned long long *)calloc((size_t)capacity, sizeof(*slots));
+        if (!slots) return -1;
+        for (int i = 0; i < set->capacity; i++) {
+            if (!set->slots[i]) continue;
+            int j = (int)(set->slots[i] & (unsigned long long)(capacity - 1));
+            while (slots[j]) j = (j + 1) & (capacity - 1);
+            slots[j] = set->slots[i];
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->capacity = capacity;
+    }
+    
+    unsigned long long h = hash_output_path(path);
+    int i = (int)(h & (unsigned long long)(set->capacity - 1));
+    while (set->slots[i]) {
+        if (set->slots[i] == h) return 0;
+        i = (i + 1) & (set->capacity - 1);
+    }
+    set->slots[i] = h;
+    set->count++;
+    return 1;
+}
+
+// Claims the output of a streamed entry. If its default name is taken, picks
+// "<name>-<hash of the full input path>" and returns it in *outputName
+// (malloc'ed); otherwise *outputName is NULL.
+// Returns: 0 on success, -1 if out of memory
+static int claim_stream_output(const FileStream *stream, OutputSet *outputs, const char *path, char **outputName) {
+    char outputDir[1024], baseName[260], outputPath[1300];
+    get_stream_output_dir(stream, path, outputDir, sizeof(outputDir));
+    get_output_base_name(path, baseName, sizeof(baseName));
+    snprintf(outputPath, sizeof(outputPath), "%s%c%s.avif", outputDir, PATH_SEP, baseName);
+    
+    *outputName = NULL;
+    int added = output_set_add(outputs, outputPath);
+    for (unsigned int salt = 0; added == 0; salt++) {
+        char unique[280];
+        snprintf(unique, sizeof(unique), "%s-%08x", baseName, hash_name(path) + salt);
+        snprintf(outputPath, sizeof(outputPath), "%s%c%s.avif", outputDir, PATH_SEP, unique);
+        added = output_set_add(outputs, outputPath);
+        if (added == 1) {
+            *outputName = strdup(unique);
+            if (!*outputName) return -1;
+            fprintf(stderr, "Warning: %s has the same output as an earlier image, writing %s\n", path, outputPath);
+        }
+    }
+    return added < 0 ? -1 : 0;
+}
+
+// ---- Read-ahead: load the next files into memory ahead of the workers ----
+// One reader thread follows the job's list a few images ahead of the workers
+// and reads each file whole, one at a time, so encoders decode from memory
+// instead of stalling on slow disks, NAS or FUSE mounts (and the disk sees
+// sequential reads instead of one stream per worker). Image i lives in slot
+// i % slotCount. A worker that reaches an image the reader hasn't started
+// reads it itself and the reader skips past it.
+#define READAHEAD_DEFAULT_MB 256
+
+#define READAHEAD_EMPTY    0
+#define READAHEAD_LOADING  1
+#define READAHEAD_READY    2
+
+typedef struct {
+    int index;                  // Image index, -1 = none
+    int state;                  // READAHEAD_*
+    char *buffer;               // NULL when READY = not read (error or already done)
+    size_t size;
+} ReadAheadSlot;
+
+struct ReadAhead {
+    ParallelJobData shared;     // Only the fields common to all workers (list, lock, next index)
+    ReadAheadSlot *slots;
+    int slotCount;
+    int nextRead;               // Next image index the reader will load
+    long long bytesHeld;        // Buffers read and not yet released by a worker
+    long long budgetBytes;      // No new read starts above this (one file may exceed it)
+    int hits;                   // Images workers got from memory
+    int misses;
+    pthread_mutex_t lock;
+    pthread_t thread;
+    volatile int running;
+};
+
+static void* read_ahead_thread(void *arg) {
+    ReadAhead *ra = (ReadAhead *)arg;
+    ParallelJobData *data = &ra->shared;
+    if (data->job->config.background) {
+        set_worker_background_priority();
+    }
+    
+    while (ra->running) {
+        // Where the workers are
+        pthread_mutex_lock(data->lock);
+        int next = *data->nextImageIndex;
+        int available = data->stream ? data->stream->count : data->imageCount;
+        int stopping = data->job->status == JOB_STOPPED || data->job->status == JOB_STOPPING;
+        pthread_mutex_unlock(data->lock);
+        if (stopping) break;
+        
+        pthread_mutex_lock(&ra->lock);
+        if (ra->nextRead < next) ra->nextRead = next;
+        int index = ra->nextRead;
+        ReadAheadSlot *slot = &ra->slots[index % ra->slotCount];
+        if (index >= available || index - next >= ra->slotCount ||
+            slot->state != READAHEAD_EMPTY || ra->bytesHeld >= ra->budgetBytes) {
+            // Far enough ahead, over budget, or waiting for more streamed entries
+            pthread_mutex_unlock(&ra->lock);
+            processor_sleep(10);
+            continue;
+        }
+        slot->index = index;
+        slot->state = READAHEAD_LOADING;
+        ra->nextRead++;
+        pthread_mutex_unlock(&ra->lock);
+        
+        // Entry strings never move (the stream array may)
+        pthread_mutex_lock(data->lock);
+        const char *entry = data->stream ? data->stream->paths[index] : data->imageFiles[index];
+        const char *outputName = data->stream ? data->stream->outputNames[index] : NULL;
+        pthread_mutex_unlock(data->lock);
+        
+        char inputPath[1024], outputDir[1024], outputPath[1024];
+        get_image_paths(data, entry, outputName, inputPath, outputDir, outputPath, sizeof(inputPath));
+        
+        // Don't read images a previous run already finished, or another process has
+        size_t size = 0;
+        char *buffer = NULL;
+        if (!is_image_done(outputPath, path_basename(entry)) &&
+            !lease_held_elsewhere(data->job, outputDir, path_basename(entry))) {
+            buffer = read_whole_file(inputPath, &size, data->job->config.dropCache);
+        }
+        
+        pthread_mutex_lock(&ra->lock);
+        slot->buffer = buffer;
+        slot->size = buffer ? size : 0;
+        slot->state = READAHEAD_READY;
+        ra->bytesHeld += slot->size;
+        pthread_mutex_unlock(&ra->lock);
+    }
+    return NULL;
+}
+
+// Start the reader for a job (NULL when config.readAhead is 0)
+// Isolated encoders read by path in the child, so read-ahead is skipped there
+static ReadAhead* start_read_ahead(FolderJob *job, char **imageFiles, int imageCount, FileStream *stream,
+                                   int *nextImageIndex, pthread_mutex_t *lock) {
+    if (job->config.readAhead <= 0 || job->config.isolate) return NULL;
+    
+    ReadAhead *ra = (ReadAhead *)calloc(1, sizeof(ReadAhead));
+    if (!ra) return NULL;
+    ra->slotCount = job->config.readAhead;
+    ra->slots = (ReadAheadSlot *)calloc(ra->slotCount, sizeof(ReadAheadSlot));
+    if (!ra->slots) {
+        free(ra);
+        return NULL;
+    }
+    for (int i = 0; i < ra->slotCount; i++) ra->slots[i].index = -1;
+    ra->budgetBytes = (long long)(job->config.readAheadMB > 0 ? job->config.readAheadMB : READAHEAD_DEFAULT_MB) * 1024 * 1024;
+    ra->shared.job = job;
+    ra->shared.imageFiles = imageFiles;
+    ra->shared.imageCount = imageCount;
+    ra->shared.stream = stream;
+    ra->shared.nextImageIndex = nextImageIndex;
+    ra->shared.lock = lock;
+    pthread_mutex_init(&ra->lock, NULL);
+    
+    ra->running = 1;
+    if (pthread_create(&ra->thread, NULL, read_ahead_thread, ra) != 0) {
+        pthread_mutex_destroy(&ra->lock);
+        free(ra->slots);
+        free(ra);
+        return NULL;
+    }
+    printf("Read-ahead: %d files, %d MB\n", ra->slotCount, (int)(ra->budgetBytes / (1024 * 1024)));
+    return ra;
+}
+
+static void stop_read_ahead(ReadAhead *ra) {
+    if (!ra) return;
+    ra->running = 0;
+    pthread_join(ra->thread, NULL);
+    
+    // Buffers of images no worker took (job stopped)
+    for (int i = 0; i < ra->slotCount; i++) {
+        free(ra->slots[i].buffer);
+    }
+    printf("Read-ahead: %d images from memory, %d read by the workers\n", ra->hits, ra->misses);
+    pthread_mutex_destroy(&ra->lock);
+    free(ra->slots);
+    free(ra);
+}
+
+// Take the prefetched copy of an image, waiting if it's being read right now
+// Call once per picked image; the buffer goes back through read_ahead_release()
+// Returns: 1 if *buffer was set, 0 if the worker must read the file itself
+static int read_ahead_take(ReadAhead *ra, int index, char **buffer, size_t *size) {
+    *buffer = NULL;
+    *size = 0;
+    if (!ra) return 0;
+    
+    pthread_mutex_lock(&ra->lock);
+    ReadAheadSlot *slot = &ra->slots[index % ra->slotCount];
+    while (slot->index == index && slot->state == READAHEAD_LOADING) {
+        pthread_mutex_unlock(&ra->lock);
+        processor_sleep(2);
+        pthread_mutex_lock(&ra->lock);
+    }
+    if (slot->index == index && slot->state == READAHEAD_READY) {
+        *buffer = slot->buffer;
+        *size = slot->size;
+        slot->buffer = NULL;
+        slot->index = -1;
+        slot->state = READAHEAD_EMPTY;
+    } else if (ra->nextRead <= index) {
+        // Not started: the reader must not load it after us
+        ra->nextRead = index + 1;
+    }
+    if (*buffer) ra->hits++;
+    else ra->misses++;
+    pthread_mutex_unlock(&ra->lock);
+    return *buffer != NULL;
+}
+
+static void read_ahead_release(ReadAhead *ra, char *buffer, size_t size) {
+    if (!ra || !buffer) return;
+    free(buffer);
+    pthread_mutex_lock(&ra->lock);
+    ra->bytesHeld -= (long long)size;
+    pthread_mutex_unlock(&ra->lock);
+}
+
+// ---- Decode stage: decoder threads feeding the encoders ----
+// Without it every worker decodes (PNG inflate, JPEG IDCT) and then encodes,
+// so the encoder sits idle for the whole decode. With config.decoders the
+// workers only encode: decoder threads follow the job's list ahead of them and
+// materialize each image in memory (vips_image_copy_memory), up to a byte
+// budget. Image i lives in slot i % slotCount, like the read-ahead stage, which
+// the decoders take their files from when it is on. A worker that reaches an
+// image no decoder has started decodes it itself. Decoders follow the job's
+// limits: pinned after the workers with pinThreads, no new decodes while the
+// memory throttle holds workers back, and under a CPU cap they are capped with
+// the rest of the process.
+// Auto sizing (decoders = -1): both stages time every image, and the number of
+// decoders allowed to run is encoders * decode time / encode time, rounded up.
+#define DECODE_DEFAULT_MB 512
+
+#define DECODE_EMPTY     0
+#define DECODE_DECODING  1
+#define DECODE_READY     2
+
+typedef struct {
+    int index;                  // Image index, -1 = none
+    int state;                  // DECODE_*
+    VipsImage *image;           // NULL when READY = not decoded (error or already done)
+    long long bytes;            // Decoded size
+    size_t fileSize;
+} DecodeSlot;
+
+struct Decoder {
+    ParallelJobData shared;     // Only the fields common to all workers (list, lock, next index)
+    ReadAhead *readAhead;
+    DecodeSlot *slots;
+    int slotCount;
+    int nextDecode;             // Next image index a decoder will load
+    long long bytesHeld;        // Decoded images not yet taken by an encoder
+    long long budgetBytes;      // No new decode starts above this (one image may exceed it)
+    pthread_t *threads;
+    int threadCount;
+    int threadsStarted;         // Gives each decoder its number
+    int allowed;                // Decoders numbered below this run, the rest wait
+    int autoSize;
+    int encoders;
+    double decodeMs;            // Moving averages per image
+    double encodeMs;
+    int hits;                   // Images encoders got decoded
+    int misses;
+    pthread_mutex_t lock;
+    volatile int running;
+};
+
+// Decoders needed to keep the encoders busy (dec->lock held)
+static void decoder_resize(Decoder *dec) {
+    if (!dec->autoSize || dec->decodeMs <= 0.0 || dec->encodeMs <= 0.0) return;
+    int needed = (int)(dec->encoders * dec->decodeMs / dec->encodeMs + 0.999);
+    if (needed < 1) needed = 1;
+    if (needed > dec->threadCount) needed = dec->threadCount;
+    dec->allowed = needed;
+}
+
+// Load an image fully into memory
+// Returns: the image, or NULL on error (the worker then loads it again and reports why)
+static VipsImage* decode_image(Decoder *dec, int index, const char *inputPath, size_t *fileSize) {
+    char *buffer = NULL;
+    size_t size = 0;
+    const CompressionConfig *config = &dec->shared.job->config;
+    VipsImage *loaded = NULL;
+    if (read_ahead_take(dec->readAhead, index, &buffer, &size)) {
+        loaded = load_image(inputPath, buffer, size, config);
+        *fileSize = size;
+    } else {
+        loaded = load_image(inputPath, NULL, 0, config);
+        *fileSize = (size_t)get_file_size(inputPath);
+    }
+    
+    // Strips that get split stay sequential: the worker loads them band by band
+    if (loaded && get_segment_height(config, vips_image_get_height(loaded)) > 0) {
+        g_object_unref(loaded);
+        loaded = NULL;
+    }
+    VipsImage *image = loaded ? vips_image_copy_memory(loaded) : NULL;
+    if (loaded) g_object_unref(loaded);
+    read_ahead_release(dec->readAhead, buffer, size);
+    vips_error_clear();
+    return image;
+}
+
+static void* decoder_thread(void *arg) {
+    Decoder *dec = (Decoder *)arg;
+    ParallelJobData *data = &dec->shared;
+    int self = __atomic_fetch_add(&dec->threadsStarted, 1, __ATOMIC_RELAXED);
+    if (data->job->config.background) {
+        set_worker_background_priority();
+    }
+    if (data->job->config.pinThreads) {
+        pin_worker_thread(dec->encoders + self);    // Nodes of the CPUs after the workers'
+    }
+    
+    while (dec->running) {
+        // Where the encoders are, and whether the memory throttle holds workers back
+        pthread_mutex_lock(data->lock);
+        int next = *data->nextImageIndex;
+        int available = data->stream ? data->stream->count : data->imageCount;
+        int stopping = data->job->status == JOB_STOPPED || data->job->status == JOB_STOPPING;
+        int throttled = data->job->allowedThreads > 0;
+        pthread_mutex_unlock(data->lock);
+        if (stopping) break;
+        
+        pthread_mutex_lock(&dec->lock);
+        if (dec->nextDecode < next) dec->nextDecode = next;
+        int index = dec->nextDecode;
+        DecodeSlot *slot = &dec->slots[index % dec->slotCount];
+        if (self >= dec->allowed || throttled || index >= available || index - next >= dec->slotCount ||
+            slot->state != DECODE_EMPTY || dec->bytesHeld >= dec->budgetBytes) {
+            // Not needed right now, memory pressure (admitted workers decode
+            // their own), far enough ahead, over budget, or waiting for more
+            // streamed entries
+            pthread_mutex_unlock(&dec->lock);
+            processor_sleep(10);
+            continue;
+        }
+        slot->index = index;
+        slot->state = DECODE_DECODING;
+        dec->nextDecode++;
+        pthread_mutex_unlock(&dec->lock);
+        
+        // Entry strings never move (the stream array may)
+        pthread_mutex_lock(data->lock);
+        const char *entry = data->stream ? data->stream->paths[index] : data->imageFiles[index];
+        const char *outputName = data->stream ? data->stream->outputNames[index] : NULL;
+        pthread_mutex_unlock(data->lock);
+        
+        char inputPath[1024], outputDir[1024], outputPath[1024];
+        get_image_paths(data, entry, outputName, inputPath, outputDir, outputPath, sizeof(inputPath));
+        
+        // Don't decode images a previous run already finished, or another process has
+        VipsImage *image = NULL;
+        size_t fileSize = 0;
+        long long startNs = get_monotonic_ns();
+        if (!is_image_done(outputPath, path_basename(entry)) &&
+            !lease_held_elsewhere(data->job, outputDir, path_basename(entry))) {
+            image = decode_image(dec, index, inputPath, &fileSize);
+        }
+        double elapsedMs = (double)(get_monotonic_ns() - startNs) / 1e6;
+        
+        pthread_mutex_lock(&dec->lock);
+        slot->image = image;
+        slot->bytes = image ? (long long)VIPS_IMAGE_SIZEOF_IMAGE(image) : 0;
+        slot->fileSize = fileSize;
+        slot->state = DECODE_READY;
+        dec->bytesHeld += slot->bytes;
+        if (image) {
+            dec->decodeMs = dec->decodeMs > 0.0 ? dec->decodeMs * 0.8 + elapsedMs * 0.2 : elapsedMs;
+            decoder_resize(dec);
+        }
+        pthread_mutex_unlock(&dec->lock);
+    }
+    vips_thread_shutdown();
+    return NULL;
+}
+
+// Start the decode stage for a job (NULL when config.decoders is 0)
+// Isolated encoders load by path in the child, so the stage is skipped there
+static Decoder* start_decoder(FolderJob *job, char **imageFiles, int imageCount, FileStream *stream,
+                              int *nextImageIndex, pthread_mutex_t *lock, ReadAhead *readAhead, int encoders) {
+    if (job->config.decoders == 0 || job->config.isolate) return NULL;
+    
+    Decoder *dec = (Decoder *)calloc(1, sizeof(Decoder));
+    if (!dec) return NULL;
+    dec->autoSize = job->config.decoders < 0;
+    dec->threadCount = dec->autoSize ? encoders : job->config.decoders;
+    dec->allowed = dec->autoSize ? 1 : dec->threadCount;
+    dec->encoders = encoders;
+    dec->slotCount = encoders + dec->threadCount;
+    dec->slots = (DecodeSlot *)calloc(dec->slotCount, sizeof(DecodeSlot));
+    dec->threads = (pthread_t *)calloc(dec->threadCount, sizeof(pthread_t));
+    if (!dec->slots || !dec->threads) {
+        free(dec->slots);
+        free(dec->threads);
+        free(dec);
+        return NULL;
+    }
+    for (int i = 0; i < dec->slotCount; i++) dec->slots[i].index = -1;
+    dec->budgetBytes = (long long)(job->config.decodeQueueMB > 0 ? job->config.decodeQueueMB : DECODE_DEFAULT_MB) * 1024 * 1024;
+    dec->readAhead = readAhead;
+    dec->shared.job = job;
+    dec->shared.imageFiles = imageFiles;
+    dec->shared.imageCount = imageCount;
+    dec->shared.stream = stream;
+    dec->shared.nextImageIndex = nextImageIndex;
+    dec->shared.lock = lock;
+    pthread_mutex_init(&dec->lock, NULL);
+    
+    dec->running = 1;
+    int started = 0;
+    while (started < dec->threadCount && pthread_create(&dec->threads[started], NULL, decoder_thread, dec) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        pthread_mutex_destroy(&dec->lock);
+        free(dec->slots);
+        free(dec->threads);
+        free(dec);
+        return NULL;
+    }
+    dec->threadCount = started;
+    if (dec->allowed > started) dec->allowed = started;
+    printf("Decoders: %d%s, %d MB queue\n", started, dec->autoSize ? " (auto)" : "",
+           (int)(dec->budgetBytes / (1024 * 1024)));
+    return dec;
+}
+
+static void stop_decoder(Decoder *dec) {
+    if (!dec) return;
+    dec->running = 0;
+    for (int i = 0; i < dec->threadCount; i++) {
+        pthread_join(dec->threads[i], NULL);
+    }
+    
+    // Images no encoder took (job stopped)
+    for (int i = 0; i < dec->slotCount; i++) {
+        if (dec->slots[i].image) g_object_unref(dec->slots[i].image);
+    }
+    printf("Decoders: %d images decoded ahead, %d decoded by the encoders; %.0f ms decode, %.0f ms encode per image, %d of %d decoders in use\n",
+           dec->hits, dec->misses, dec->decodeMs, dec->encodeMs, dec->allowed, dec->threadCount);
+    pthread_mutex_destroy(&dec->lock);
+    free(dec->slots);
+    free(dec->threads);
+    free(dec);
+}
+
+// Take the decoded image, waiting if a decoder is on it right now
+// Call once per picked image; *fileSize is the source file's size
+// Returns: 1 if *image was set, 0 if the worker must load the image itself
+static int decoder_take(Decoder *dec, int index, VipsImage **image, size_t *fileSize) {
+    *image = NULL;
+    if (!dec) return 0;
+    
+    pthread_mutex_lock(&dec->lock);
+    DecodeSlot *slot = &dec->slots[index % dec->slotCount];
+    while (slot->index == index && slot->state == DECODE_DECODING) {
+        pthread_mutex_unlock(&dec->lock);
+        processor_sleep(2);
+        pthread_mutex_lock(&dec->lock);
+    }
+    if (slot->index == index && slot->state == DECODE_READY) {
+        *image = slot->image;
+        *fileSize = slot->fileSize;
+        dec->bytesHeld -= slot->bytes;
+        slot->image = NULL;
+        slot->index = -1;
+        slot->state = DECODE_EMPTY;
+    } else if (dec->nextDecode <= index) {
+        // Not started: no decoder must load it after us
+        dec->nextDecode = index + 1;
+    }
+    if (*image) dec->hits++;
+    else dec->misses++;
+    pthread_mutex_unlock(&dec->lock);
+    return *image != NULL;
+}
+
+// Time an encoder spent on a decoded image, for auto sizing
+static void decoder_note_encode(Decoder *dec, long long elapsedMs) {
+    pthread_mutex_lock(&dec->lock);
+    dec->encodeMs = dec->encodeMs > 0.0 ? dec->encodeMs * 0.8 + (double)elapsedMs * 0.2 : (double)elapsedMs;
+    decoder_resize(dec);
+    pthread_mutex_unlock(&dec->lock);
+}
+
+// ---- Tail phase: more threads per image once a job runs out of images ----
+// While a job has more images than workers every core is busy with its own
+// image. Once fewer images are left than workers, the workers that finish
+// have nothing to take and their cores sit idle while the last (often
+// biggest) pages encode. Images started from then on raise vips concurrency
+// to the usable CPUs divided by the encodes expected to run alongside them:
+// those of every job in the process, plus the images this job has left.
+// Concurrency is process-wide in vips, so the boost only happens while the job
+// is the only one in the process, and the job's own value is put back when it
+// ends or another job starts. vips reads it when an operation starts its
+// thread pool: encodes already running keep their threads, and AV1 tiling is
+// not exposed by vips.
+static volatile int encodesRunning = 0;        // Images being encoded by all jobs
+static pthread_mutex_t tailLock = PTHREAD_MUTEX_INITIALIZER;
+static int jobsRunning = 0;                    // Jobs between tail_job_begin/end (tailLock)
+static int tailRestore = 0;                    // Concurrency before the boost, 0 = not boosted (tailLock)
+
+// A job's vips concurrency, set by its runner when it starts (supersedes a boost)
+static void set_job_concurrency(int threads) {
+    pthread_mutex_lock(&tailLock);
+    vips_concurrency_set(threads);
+    tailRestore = 0;
+    pthread_mutex_unlock(&tailLock);
+}
+
+// Around a job's workers: a job starting ends another one's boost
+static void tail_job_begin(void) {
+    pthread_mutex_lock(&tailLock);
+    jobsRunning++;
+    if (tailRestore > 0) {
+        vips_concurrency_set(tailRestore);
+        tailRestore = 0;
     }
-    
-    char buffer[8192];
-    size_t bytes;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), in)) > 0) {
-        fwrite(buffer, 1, bytes, out);
+    pthread_mutex_unlock(&tailLock);
+}
+
+static void tail_job_end(void) {
+    pthread_mutex_lock(&tailLock);
+    jobsRunning--;
+    if (tailRestore > 0) {
+        vips_concurrency_set(tailRestore);
+        tailRestore = 0;
     }
-    
-    fclose(in);
-    fclose(out);
-    return 0;
+    pthread_mutex_unlock(&tailLock);
 }
 
-// Compress a single image to AVIF
-static int compress_image_to_avif(const char *inputPath, const char *outputPath, 
-                                   const char *originalName, CompressionConfig *config) {
-    VipsImage *image = NULL;
+// Called before an encode, with the images of the job nobody has picked yet
+static void tail_encode_begin(ParallelJobData *data, int remaining) {
+    int running = __atomic_add_fetch(&encodesRunning, 1, __ATOMIC_RELAXED);
+#ifdef _WIN32
+    // process_folder keeps vips at one thread per image on Windows, don't raise it
+    (void)data;
+    (void)remaining;
+    (void)running;
+#else
+    const CompressionConfig *config = &data->job->config;
+    if (config->noTailBoost || config->isolate || (config->cpuLimit > 0 && config->cpuLimit < 100)) return;
+    if (remaining < 0 || remaining >= data->workerCount) return;
     
-    // Load the image (using sequential access for low memory)
-    image = vips_image_new_from_file(inputPath, "access", VIPS_ACCESS_SEQUENTIAL, NULL);
-    if (!image) {
-        fprintf(stderr, "Error loading: %s\n", inputPath);
-        return -1;
+    // Workers of this job that will still start an image
+    int idle = data->workerCount - data->job->activeThreads;
+    int expected = running + (remaining < idle ? remaining : idle);
+    int threads = get_cpu_count() / (expected > 0 ? expected : 1);
+    pthread_mutex_lock(&tailLock);
+    if (jobsRunning == 1 && threads > vips_concurrency_get()) {
+        if (tailRestore == 0) tailRestore = vips_concurrency_get();
+        vips_concurrency_set(threads);
+        printf("Tail: %d image%s left to start, %d threads per image\n", remaining, remaining == 1 ? "" : "s", threads);
     }
-    
-    // Original size for comparison
-    long originalSize = get_file_size(inputPath);
-    
-    // Speed mapping: UI (0=slow, 10=fast) -> libvips effort (0=slow/best, 9=fast/worst)
-    int effort = config->speed;
-    if (effort > 9) effort = 9;
+    pthread_mutex_unlock(&tailLock);
+#endif
+}
 
-    // Save as AVIF with specified quality
-    int result = vips_heifsave(image, outputPath,
-                               "Q", config->quality,
-                               "effort", effort,
-                               "compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1,
-                               NULL);
-    
-    g_object_unref(image);
-    vips_error_clear();
+static void tail_encode_end(void) {
+    __atomic_sub_fetch(&encodesRunning, 1, __ATOMIC_RELAXED);
+}
+
+// Images finished by every job, read by the metrics sampler
+static volatile long long imagesFinished = 0;
+
+// Count an image as finished, update progress and notify the job's callback
+static void finish_image(ParallelJobData *data, const char *name, int failed) {
+    int emitProgress = 0;
+    __atomic_add_fetch(&imagesFinished, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(data->lock);
+    if (failed) {
+        data->job->failedFiles++;
+    }
+    data->job->doneFiles++;
+    data->job->activeThreads--;
+    int total = data->stream ? data->stream->count : data->imageCount;
+    if (total > 0) {
+        data->job->progress = (data->job->doneFiles * 100) / total;
+    }
+    if (eventOutput) {
+        long long nowMs = get_monotonic_ns() / 1000000;
+        if (nowMs - data->job->eventProgressMs >= EVENT_PROGRESS_MS || data->job->doneFiles == total) {
+            data->job->eventProgressMs = nowMs;
+            emitProgress = 1;
+        }
+    }
+    int done = data->job->doneFiles, doneFailed = data->job->failedFiles;
+    stats_job_update(data->job, -1, 0, 0);
+    pthread_mutex_unlock(data->lock);
     
-#ifdef _WIN32
-    // Small delay after processing each image to allow Windows to close file handles
-    // Since cache is disabled, we don't need to call vips_cache_drop_all() here
-    Sleep(10);
-#endif
+    stats_worker_state(STATS_WORKER_IDLE, "");
+    if (statsRegion) statsRegion->rssBytes = get_process_ram_usage();
     
-    if (result != 0) {
-        fprintf(stderr, "Error saving AVIF: %s - %s\n", outputPath, vips_error_buffer());
-        vips_error_clear();
-        return -1;
+    if (emitProgress) {
+        emit_event(data->job, "progress", "\"done\":%d,\"total\":%d,\"failed\":%d,\"active\":%d",
+                   done, total, doneFailed, data->job->activeThreads);
     }
     
-    // Check if compression was worthwhile (>15% reduction)
-    long compressedSize = get_file_size(outputPath);
-    if (compressedSize > 0 && originalSize > 0) {
-        double ratio = (double)compressedSize / (double)originalSize;
-        if (ratio > 0.85) {
-            // Compression didn't help much, keep original format
-            remove(outputPath);
-            
-            // Build path for original copy
-            char outputDir[512];
-            strncpy(outputDir, outputPath, sizeof(outputDir) - 1);
-            char *lastSlash = strrchr(outputDir, PATH_SEP);
-            if (lastSlash) *lastSlash = '\0';
-            
-            char originalDest[520];
-            snprintf(originalDest, sizeof(originalDest), "%s%s%s", 
-                     outputDir, PATH_SEP_STR, originalName);
-            copy_file(inputPath, originalDest);
-            printf("Kept original (%.0f%%): %s\n", ratio * 100, originalName);
-        } else {
-            printf("Compressed to %.0f%%: %s\n", ratio * 100, originalName);
-        }
+    if (data->job->onImageDone) {
+        data->job->onImageDone(data->job, name, failed);
     }
-    
-    return 0;
 }
 
-// Data passed to image processing threads
-typedef struct {
-    FolderJob *job;
-    char **imageFiles;
-    int imageCount;
-    int *nextImageIndex;
-    pthread_mutex_t *lock;
-} ParallelJobData;
+// Share of the job's encode time that went to encoder setup
+static void report_encoder_setup(ParallelJobData *threadData, int numThreads) {
+    long long setupNs = -1, encodeNs = 0;
+    int encoded = 0;
+    for (int i = 0; i < numThreads; i++) {
+        if (threadData[i].encoderSetupNs >= 0) setupNs = threadData[i].encoderSetupNs;
+        encodeNs += threadData[i].encodeNs;
+        encoded += threadData[i].encoded;
+    }
+    if (setupNs < 0 || encoded == 0) return;
+    double perImageMs = (double)encodeNs / encoded / 1e6;
+    printf("Encoder setup: %.1f ms of %.1f ms per image (%.0f%%, paid by every image)\n", (double)setupNs / 1e6, perImageMs,
+           perImageMs > 0.0 ? (double)setupNs / 1e6 * 100.0 / perImageMs : 0.0);
+}
+
+// How much shrink-on-load saved: encode time scales with the pixels encoded
+static void report_shrink(FolderJob *job, ParallelJobData *threadData, int numThreads) {
+    const CompressionConfig *config = &job->config;
+    if (config->maxWidth <= 0 && config->maxHeight <= 0 && config->maxMegapixels <= 0) return;
+    long long sourcePixels = 0, encodedPixels = 0;
+    int shrunk = 0, encoded = 0;
+    for (int i = 0; i < numThreads; i++) {
+        sourcePixels += threadData[i].sourcePixels;
+        encodedPixels += threadData[i].encodedPixels;
+        shrunk += threadData[i].shrunk;
+        encoded += threadData[i].encoded;
+    }
+    if (encodedPixels <= 0) return;
+    printf("Shrink-on-load: %d of %d images downscaled, %.1f -> %.1f MP encoded (%.1fx fewer pixels)\n",
+           shrunk, encoded, (double)sourcePixels / 1e6, (double)encodedPixels / 1e6,
+           (double)sourcePixels / (double)encodedPixels);
+}
 
 // Thread function for processing images in parallel
 void* image_worker(void *arg) {
@@ -294,9 +4161,26 @@ void* image_worker(void *arg) {
     // NOTE: Do NOT call vips_concurrency_set() here - it's set globally in process_folder()
     // Calling it per-thread can cause GLib errors when starting new jobs
     // Each thread processes one image at a time, which is the desired behavior
+    // The one change mid-job is the tail boost (tail_encode_begin): a single
+    // call under tailLock, only while this is the process's only job, undone
+    // when the job ends. vips only reads the value when an operation starts
+    // its thread pool, so encodes already running are unaffected.
+    
+    if (data->job->config.pinThreads) {
+        pin_worker_thread(data->workerIndex);
+    }
+    if (data->job->config.background) {
+        set_worker_background_priority();
+    }
+    governor_register_worker(data);
+    stats_worker_begin(data->job);
+    data->encoderSetupNs = data->job->config.isolate ? -1 : get_encoder_setup_ns(&data->job->config);
     
     while (1) {
         int index = -1;
+        int retry = 0;
+        const char *entry = NULL;
+        const char *outputName = NULL;
         
         // Pick next image
         pthread_mutex_lock(data->lock);
@@ -305,8 +4189,34 @@ void* image_worker(void *arg) {
             break;
         }
         
-        if (*data->nextImageIndex < data->imageCount) {
+        int available = data->stream ? data->stream->count : data->imageCount;
+        int hasWork = *data->nextImageIndex < available || *data->deferredCount > 0;
+        
+        // Memory pressure: park this worker instead of admitting a new image
+        if (hasWork && !memory_throttle_admit(data->throttle, data->job)) {
+            pthread_mutex_unlock(data->lock);
+            processor_sleep(200);
+            continue;
+        }
+        
+        if (*data->nextImageIndex < available) {
             index = (*data->nextImageIndex)++;
+        } else if (*data->deferredCount > 0) {
+            // Leased by another process: check back until it's done or abandoned
+            index = data->deferred[--(*data->deferredCount)];
+            retry = 1;
+        } else if (data->stream && !data->stream->closed) {
+            // Streamed input: wait for the reader to append more paths
+            pthread_mutex_unlock(data->lock);
+            processor_sleep(50);
+            continue;
+        }
+        if (index != -1) {
+            entry = data->stream ? data->stream->paths[index] : data->imageFiles[index];
+            outputName = data->stream ? data->stream->outputNames[index] : NULL;
+            // Take the slot in the same critical section as the admission check,
+            // or several workers could pass it at once under memory pressure
+            data->job->activeThreads++;
         }
         pthread_mutex_unlock(data->lock);
         
@@ -317,68 +4227,161 @@ void* image_worker(void *arg) {
             processor_sleep(200);
             if (data->job->status == JOB_STOPPED || data->job->status == JOB_STOPPING) break;
         }
-        if (data->job->status == JOB_STOPPED || data->job->status == JOB_STOPPING) break;
+        if (data->job->status == JOB_STOPPED || data->job->status == JOB_STOPPING) {
+            pthread_mutex_lock(data->lock);
+            data->job->activeThreads--;
+            pthread_mutex_unlock(data->lock);
+            break;
+        }
 
         char inputPath[1024];
         char outputPath[1024];
-        const char *filename = "";
+        char outputDir[1024];
         
-        // Get filename for UI display
-        const char *lastSlash = strrchr(data->imageFiles[index], PATH_SEP);
-        filename = lastSlash ? lastSlash + 1 : data->imageFiles[index];
+        // File name (for the UI and the output) and where the output goes
+        const char *filename = path_basename(entry);
+        get_image_paths(data, entry, outputName, inputPath, outputDir, outputPath, sizeof(inputPath));
+        if (data->stream) make_dirs(outputDir);
 
-        snprintf(inputPath, sizeof(inputPath), "%s%c%s", data->job->sourcePath, PATH_SEP, data->imageFiles[index]);
-        
-        // Build output path by stripping original extension
-        char baseName[260];
-        strncpy(baseName, data->imageFiles[index], sizeof(baseName) - 1);
-        baseName[sizeof(baseName) - 1] = '\0';
-        char *dot = strrchr(baseName, '.');
-        if (dot) *dot = '\0';
-        
-        snprintf(outputPath, sizeof(outputPath), "%s%c%s.avif", data->job->outputPath, PATH_SEP, baseName);
-
-        // Update current file status and active count
+        // Update current file status
         pthread_mutex_lock(data->lock);
         strncpy(data->job->currentFile, filename, 255);
-        data->job->activeThreads++;
+        int remaining = available - *data->nextImageIndex + *data->deferredCount;
+        stats_job_update(data->job, remaining, 0, 0);
+        if (data->stream && !data->stream->closed) remaining = -1;     // More may arrive
         pthread_mutex_unlock(data->lock);
-
+        stats_worker_state(STATS_WORKER_LOADING, filename);
+        
+        // Decoded image from the decode stage, or the prefetched file from the
+        // read-ahead stage, if they got there first
+        char *inputBuffer = NULL;
+        size_t inputSize = 0;
+        VipsImage *decoded = NULL;
+        if (!decoder_take(data->decoder, index, &decoded, &inputSize)) {
+            read_ahead_take(data->readAhead, index, &inputBuffer, &inputSize);
+        }
+        
+        char quotedFile[600];
+        json_quote(quotedFile, sizeof(quotedFile), data->stream ? entry : filename);
+        
         // Check if already processed to enable resume
-#ifdef _WIN32
-        wchar_t wideOutputPath[520];
-        utf8_to_wide(outputPath, wideOutputPath, 520);
-        if (GetFileAttributesW(wideOutputPath) != INVALID_FILE_ATTRIBUTES) {
-#else
-        struct stat st;
-        if (stat(outputPath, &st) == 0) {
-#endif
-            pthread_mutex_lock(data->lock);
-            data->job->doneFiles++;
-            data->job->activeThreads--; // Decrement since we're done here
-            if (data->imageCount > 0) {
-                data->job->progress = (data->job->doneFiles * 100) / data->imageCount;
-            }
-            pthread_mutex_unlock(data->lock);
+        if (is_image_done(outputPath, filename)) {
+            read_ahead_release(data->readAhead, inputBuffer, inputSize);
+            if (decoded) g_object_unref(decoded);
+            emit_event(data->job, "image_skipped", "\"file\":%s,\"reason\":\"done\"", quotedFile);
+            finish_image(data, filename, 0);
             continue;
         }
 
+#ifndef _WIN32
+        // Cooperative mode: claim the image before encoding it
+        if (data->job->config.useLeases) {
+            char leasePath[1100];
+            get_lease_path(leasePath, sizeof(leasePath), outputDir, filename);
+            int lease = lease_try_acquire(leasePath, get_lease_ttl(data->job));
+            if (lease == LEASE_BUSY) {
+                read_ahead_release(data->readAhead, inputBuffer, inputSize);
+                if (decoded) g_object_unref(decoded);
+                pthread_mutex_lock(data->lock);
+                data->deferred[(*data->deferredCount)++] = index;
+                data->job->activeThreads--;
+                pthread_mutex_unlock(data->lock);
+                stats_worker_state(STATS_WORKER_IDLE, "");
+                if (retry) processor_sleep(1000);
+                continue;
+            }
+            if (lease == LEASE_ACQUIRED) {
+                pthread_mutex_lock(data->lock);
+                strncpy(data->leasePath, leasePath, sizeof(data->leasePath) - 1);
+                pthread_mutex_unlock(data->lock);
+                
+                // Another process may have finished it between our check and the claim
+                if (is_image_done(outputPath, filename)) {
+                    release_lease(data);
+                    read_ahead_release(data->readAhead, inputBuffer, inputSize);
+                    if (decoded) g_object_unref(decoded);
+                    emit_event(data->job, "image_skipped", "\"file\":%s,\"reason\":\"done\"", quotedFile);
+                    finish_image(data, filename, 0);
+                    continue;
+                }
+            } else {
+                fprintf(stderr, "Warning: cannot create lease %s, processing without it\n", leasePath);
+            }
+        }
+#endif
+
         // Parallelism proof: Log before starting
         printf("[Job %p] Thread %p: Starting %s\n", (void*)data->job, (void*)pthread_self(), filename);
 
+        emit_event(data->job, "image_started", "\"file\":%s,\"worker\":%d", quotedFile, data->workerIndex);
+        long long startNs = get_monotonic_ns();
+
         // Compress
-        compress_image_to_avif(inputPath, outputPath, data->imageFiles[index], &data->job->config);
+        int result;
+        ImageResult imageResult;
+#ifdef __linux__
+        if (data->job->config.isolate) {
+            stats_worker_state(STATS_WORKER_ENCODING, NULL);   // The child can't report phases
+            result = encoder_process_compress(data, inputPath, outputPath, filename, &imageResult);
+        } else
+#endif
+        {
+            tail_encode_begin(data, remaining);
+            result = compress_image_to_avif(inputPath, inputBuffer, inputSize, decoded, outputPath, filename, &data->job->config, data->writer, &imageResult);
+            tail_encode_end();
+        }
+        read_ahead_release(data->readAhead, inputBuffer, inputSize);
+        if (decoded) decoder_note_encode(data->decoder, (get_monotonic_ns() - startNs) / 1000000);
+        if (result == 0) {
+            data->encodeNs += get_monotonic_ns() - startNs;
+            data->encoded++;
+            if (imageResult.encodedPixels < imageResult.sourcePixels) data->shrunk++;
+            data->sourcePixels += imageResult.sourcePixels;
+            data->encodedPixels += imageResult.encodedPixels;
+        }
+        
+        // Page-cache hygiene: the source is decoded and the output written (the
+        // writer stage drops what it writes, and copies kept originals later)
+        if (data->job->config.dropCache) {
+            if (!(data->writer && imageResult.keptOriginal)) drop_file_cache(inputPath, 0);
+            if (result == 0 && !data->writer) {
+                char keptPath[1100];
+                get_kept_original_path(keptPath, sizeof(keptPath), outputPath, filename);
+                drop_file_cache(imageResult.keptOriginal ? keptPath : outputPath, 1);
+            }
+        }
+        
+        long long elapsedMs = (get_monotonic_ns() - startNs) / 1000000;
+        if (result == 0 && statsRegion) {
+            pthread_mutex_lock(data->lock);
+            stats_job_update(data->job, -1, imageResult.inputBytes, imageResult.outputBytes);
+            pthread_mutex_unlock(data->lock);
+        }
+        if (result == 0) {
+            emit_event(data->job, "image_finished",
+                       "\"file\":%s,\"in_bytes\":%lld,\"out_bytes\":%lld,\"ratio\":%.4f,\"ms\":%lld,\"kept_original\":%s,\"segments\":%d",
+                       quotedFile, imageResult.inputBytes, imageResult.outputBytes,
+                       imageResult.inputBytes > 0 ? (double)imageResult.outputBytes / (double)imageResult.inputBytes : 1.0,
+                       elapsedMs, imageResult.keptOriginal ? "true" : "false", imageResult.segments);
+        } else {
+            char quotedError[300];
+            emit_event(data->job, "image_error", "\"file\":%s,\"error\":%s,\"ms\":%lld",
+                       quotedFile, json_quote(quotedError, sizeof(quotedError), imageResult.error), elapsedMs);
+        }
 
+#ifndef _WIN32
+        release_lease(data);
+#endif
+        
         // Update progress and decrement active count
-        pthread_mutex_lock(data->lock);
-        data->job->doneFiles++;
-        data->job->activeThreads--; 
-        if (data->imageCount > 0) {
-            data->job->progress = (data->job->doneFiles * 100) / data->imageCount;
-        }
-        pthread_mutex_unlock(data->lock);
+        finish_image(data, filename, result != 0);
     }
     
+#ifdef __linux__
+    encoder_process_stop(data);
+#endif
+    governor_unregister_worker(data);
+    stats_worker_end();
     vips_thread_shutdown();
     return NULL;
 }
@@ -396,20 +4399,23 @@ int process_folder(FolderJob *job) {
     
     printf("Processing: %s\n", job->sourcePath);
     
-    job->status = JOB_PROCESSING;
+    // A stop issued before the runner got here (imgc_job_stop) must stick
+    if (job->status != JOB_STOPPING && job->status != JOB_STOPPED) job->status = JOB_PROCESSING;
     job->progress = 0;
     job->doneFiles = 0;
+    job->failedFiles = 0;
     job->activeThreads = 0;
     
     // Set libvips concurrency for this job
     // vips_concurrency_set(job->config.threads);
-    vips_concurrency_set(1);
+    set_job_concurrency(1);
     printf("Job Concurrency: %d threads\n", job->config.threads);
     
     // Convert source path to wide (raylib uses UTF-8)
     if (utf8_to_wide(job->sourcePath, wideSourcePath, 520) == 0) {
         fprintf(stderr, "Error: Failed to convert path to unicode\n");
         job->status = JOB_ERROR;
+        report_job_finished(job, "invalid folder path");
         return -1;
     }
     
@@ -425,6 +4431,7 @@ int process_folder(FolderJob *job) {
     if (!imageFiles) {
         fprintf(stderr, "Error: Failed to allocate memory\n");
         job->status = JOB_ERROR;
+        report_job_finished(job, "out of memory");
         return -1;
     }
     
@@ -433,6 +4440,7 @@ int process_folder(FolderJob *job) {
     if (hFind == INVALID_HANDLE_VALUE) {
         fprintf(stderr, "Error: Cannot open directory\n");
         job->status = JOB_ERROR;
+        report_job_finished(job, "cannot open folder");
         free(imageFiles);
         return -1;
     }
@@ -456,10 +4464,14 @@ int process_folder(FolderJob *job) {
     
     FindClose(hFind);
     
+    imageCount = apply_shard_filter(job, imageFiles, imageCount);
     job->totalFiles = imageCount;
+    report_job_started(job, 0);
     
     // Prepare parallel processing
     int nextIndex = 0;
+    int deferredCount = 0;
+    int *deferred = (int*)malloc((imageCount > 0 ? imageCount : 1) * sizeof(int));
     pthread_mutex_t jobLock;
     pthread_mutex_init(&jobLock, NULL);
     
@@ -469,15 +4481,32 @@ int process_folder(FolderJob *job) {
     
     printf("Spawning %d threads for %d images\n", numThreads, imageCount);
     
+    tail_job_begin();
     pthread_t *threads = (pthread_t*)malloc(numThreads * sizeof(pthread_t));
-    ParallelJobData *threadData = (ParallelJobData*)malloc(numThreads * sizeof(ParallelJobData));
+    ParallelJobData *threadData = (ParallelJobData*)calloc(numThreads, sizeof(ParallelJobData));
+    isolate_background_job(job);
+    CpuGovernor *governor = start_cpu_governor(job, threadData, numThreads);
+    Writer *writer = start_writer(job, &jobLock);
+    ReadAhead *readAhead = start_read_ahead(job, imageFiles, imageCount, NULL, &nextIndex, &jobLock);
+    Decoder *decoder = start_decoder(job, imageFiles, imageCount, NULL, &nextIndex, &jobLock, readAhead, numThreads);
+    MemoryThrottle throttle;
+    memory_throttle_init(&throttle, job, numThreads);
     
     for (int i = 0; i < numThreads; i++) {
         threadData[i].job = job;
         threadData[i].imageFiles = imageFiles;
         threadData[i].imageCount = imageCount;
         threadData[i].nextImageIndex = &nextIndex;
+        threadData[i].deferred = deferred;
+        threadData[i].deferredCount = &deferredCount;
         threadData[i].lock = &jobLock;
+        threadData[i].workerIndex = i;
+        threadData[i].throttle = &throttle;
+        threadData[i].governor = governor;
+        threadData[i].readAhead = readAhead;
+        threadData[i].decoder = decoder;
+        threadData[i].workerCount = numThreads;
+        threadData[i].writer = writer;
         pthread_create(&threads[i], NULL, image_worker, &threadData[i]);
     }
     
@@ -485,9 +4514,17 @@ int process_folder(FolderJob *job) {
     for (int i = 0; i < numThreads; i++) {
         pthread_join(threads[i], NULL);
     }
-    
+    tail_job_end();
+    report_encoder_setup(threadData, numThreads);
+    report_shrink(job, threadData, numThreads);
+    stop_cpu_governor(governor);
+    stop_decoder(decoder);
+    stop_read_ahead(readAhead);
+    stop_writer(writer);
+
     free(threads);
     free(threadData);
+    free(deferred);
     pthread_mutex_destroy(&jobLock);
     
     // Clean up file list
@@ -502,6 +4539,7 @@ int process_folder(FolderJob *job) {
     } else if (job->status != JOB_STOPPED) {
         job->status = JOB_COMPLETED;
     }
+    report_job_finished(job, NULL);
     
 #ifdef _WIN32
     // On Windows, cache is disabled so vips_cache_drop_all() is not needed
@@ -512,6 +4550,7 @@ int process_folder(FolderJob *job) {
     // On Linux/Unix, drop cache to release file handles
     vips_cache_drop_all();
 #endif
+    release_heap_memory();
     
     printf("Job finished (status %d): %s\n", job->status, job->sourcePath);
     return 0;
@@ -526,13 +4565,24 @@ int process_folder(FolderJob *job) {
     int imageCount = 0;
     int capacity = 64;
     
-    job->status = JOB_PROCESSING;
+    // A stop issued before the runner got here (imgc_job_stop) must stick
+    if (job->status != JOB_STOPPING && job->status != JOB_STOPPED) job->status = JOB_PROCESSING;
     job->progress = 0;
     job->doneFiles = 0;
+    job->failedFiles = 0;
     job->activeThreads = 0;
     
+    // A lease is released as soon as the worker is done with the image, which
+    // with the writer stage is before the output exists: another process could
+    // claim it again, or skip it while it's still queued
+    if (job->config.useLeases && (job->config.serialWrites || job->config.syncWrites)) {
+        fprintf(stderr, "Warning: --serial-writes/--sync-writes are not supported with --lease, workers write their own outputs\n");
+        job->config.serialWrites = 0;
+        job->config.syncWrites = 0;
+    }
+    
     // Set libvips concurrency for this job
-    vips_concurrency_set(job->config.threads);
+    set_job_concurrency(job->config.threads);
     printf("Job Concurrency: %d threads\n", job->config.threads);
     
     // Create output directory
@@ -542,6 +4592,7 @@ int process_folder(FolderJob *job) {
     imageFiles = (char **)malloc(capacity * sizeof(char *));
     if (!imageFiles) {
         job->status = JOB_ERROR;
+        report_job_finished(job, "out of memory");
         return -1;
     }
     
@@ -549,6 +4600,7 @@ int process_folder(FolderJob *job) {
     dir = opendir(job->sourcePath);
     if (!dir) {
         job->status = JOB_ERROR;
+        report_job_finished(job, "cannot open folder");
         free(imageFiles);
         return -1;
     }
@@ -566,11 +4618,16 @@ int process_folder(FolderJob *job) {
     }
     closedir(dir);
     
+    imageCount = apply_shard_filter(job, imageFiles, imageCount);
+    if (job->config.diskOrder) sort_by_disk_order(job, imageFiles, imageCount);
     job->totalFiles = imageCount;
+    report_job_started(job, 0);
     printf("Found %d images in %s\n", imageCount, job->sourcePath);
     
     // Prepare parallel processing
     int nextIndex = 0;
+    int deferredCount = 0;
+    int *deferred = (int*)malloc((imageCount > 0 ? imageCount : 1) * sizeof(int));
     pthread_mutex_t jobLock;
     pthread_mutex_init(&jobLock, NULL);
     
@@ -580,15 +4637,33 @@ int process_folder(FolderJob *job) {
     
     printf("Spawning %d threads for %d images\n", numThreads, imageCount);
     
+    tail_job_begin();
     pthread_t *threads = (pthread_t*)malloc(numThreads * sizeof(pthread_t));
-    ParallelJobData *threadData = (ParallelJobData*)malloc(numThreads * sizeof(ParallelJobData));
+    ParallelJobData *threadData = (ParallelJobData*)calloc(numThreads, sizeof(ParallelJobData));
+    isolate_background_job(job);
+    CpuGovernor *governor = start_cpu_governor(job, threadData, numThreads);
+    LeaseKeeper *leaseKeeper = start_lease_keeper(job, threadData, numThreads, &jobLock);
+    Writer *writer = start_writer(job, &jobLock);
+    ReadAhead *readAhead = start_read_ahead(job, imageFiles, imageCount, NULL, &nextIndex, &jobLock);
+    Decoder *decoder = start_decoder(job, imageFiles, imageCount, NULL, &nextIndex, &jobLock, readAhead, numThreads);
+    MemoryThrottle throttle;
+    memory_throttle_init(&throttle, job, numThreads);
     
     for (int i = 0; i < numThreads; i++) {
         threadData[i].job = job;
         threadData[i].imageFiles = imageFiles;
         threadData[i].imageCount = imageCount;
         threadData[i].nextImageIndex = &nextIndex;
+        threadData[i].deferred = deferred;
+        threadData[i].deferredCount = &deferredCount;
         threadData[i].lock = &jobLock;
+        threadData[i].workerIndex = i;
+        threadData[i].throttle = &throttle;
+        threadData[i].governor = governor;
+        threadData[i].readAhead = readAhead;
+        threadData[i].decoder = decoder;
+        threadData[i].workerCount = numThreads;
+        threadData[i].writer = writer;
         pthread_create(&threads[i], NULL, image_worker, &threadData[i]);
     }
     
@@ -596,9 +4671,18 @@ int process_folder(FolderJob *job) {
     for (int i = 0; i < numThreads; i++) {
         pthread_join(threads[i], NULL);
     }
+    tail_job_end();
+    report_encoder_setup(threadData, numThreads);
+    report_shrink(job, threadData, numThreads);
+    stop_cpu_governor(governor);
+    stop_decoder(decoder);
+    stop_read_ahead(readAhead);
+    stop_writer(writer);
+    stop_lease_keeper(leaseKeeper);
     
     free(threads);
     free(threadData);
+    free(deferred);
     pthread_mutex_destroy(&jobLock);
     
     // Clean up file list
@@ -612,9 +4696,11 @@ int process_folder(FolderJob *job) {
     } else if (job->status != JOB_STOPPED) {
         job->status = JOB_COMPLETED;
     }
+    report_job_finished(job, NULL);
     
     // Force libvips to release all file handles from cache
     vips_cache_drop_all();
+    release_heap_memory();
     
     // On Linux/Unix, don't shutdown threads to allow subsequent jobs
     // vips_thread_shutdown();
@@ -624,6 +4710,179 @@ int process_folder(FolderJob *job) {
 }
 #endif
 
+// Read one list entry terminated by delimiter (or EOF), without the delimiter
+// Returns: entry length, or -1 at end of input
+static int read_list_entry(FILE *input, int delimiter, char *buf, int size) {
+    int len = 0;
+    int c;
+    while ((c = fgetc(input)) != EOF && c != delimiter) {
+        if (len < size - 1) buf[len++] = (char)c;
+    }
+    if (c == EOF && len == 0) return -1;
+    if (delimiter == '\n' && len > 0 && buf[len - 1] == '\r') len--;
+    buf[len] = '\0';
+    return len;
+}
+
+int process_file_stream(FolderJob *job, FILE *input, int delimiter, const char *outputDir, const char *mirrorPrefix) {
+    FileStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.capacity = 64;
+    stream.paths = (char **)malloc(stream.capacity * sizeof(char *));
+    stream.outputNames = (char **)malloc(stream.capacity * sizeof(char *));
+    stream.outputDir = outputDir;
+    stream.mirrorPrefix = mirrorPrefix;
+    OutputSet outputs;
+    memset(&outputs, 0, sizeof(outputs));
+    if (!stream.paths || !stream.outputNames) {
+        free(stream.paths);
+        free(stream.outputNames);
+        job->status = JOB_ERROR;
+        report_job_finished(job, "out of memory");
+        return -1;
+    }
+    
+    // A stop issued before the runner got here (imgc_job_stop) must stick
+    if (job->status != JOB_STOPPING && job->status != JOB_STOPPED) job->status = JOB_PROCESSING;
+    job->progress = 0;
+    job->totalFiles = 0;
+    job->doneFiles = 0;
+    job->failedFiles = 0;
+    job->activeThreads = 0;
+    
+    // Leases need the full list up front (retries of busy images); shards don't
+    if (job->config.useLeases) {
+        fprintf(stderr, "Warning: leases are not supported with streamed input, use --shard\n");
+        job->config.useLeases = 0;
+    }
+    int shardCount = job->config.shardCount;
+    int shardIndex = job->config.shardIndex;
+    if (shardIndex < 0 || shardIndex >= shardCount) shardCount = 0;
+    
+    set_job_concurrency(job->config.threads);
+    if (outputDir) make_dirs(outputDir);
+    report_job_started(job, 1);
+    
+    int nextIndex = 0;
+    int deferredCount = 0;      // Always 0 without leases
+    int deferredUnused = 0;
+    pthread_mutex_t jobLock;
+    pthread_mutex_init(&jobLock, NULL);
+    
+    int numThreads = job->config.threads;
+    if (numThreads < 1) numThreads = 1;
+    printf("Spawning %d threads for streamed input\n", numThreads);
+    
+    tail_job_begin();
+    pthread_t *threads = (pthread_t*)malloc(numThreads * sizeof(pthread_t));
+    ParallelJobData *threadData = (ParallelJobData*)calloc(numThreads, sizeof(ParallelJobData));
+    isolate_background_job(job);
+    CpuGovernor *governor = start_cpu_governor(job, threadData, numThreads);
+    Writer *writer = start_writer(job, &jobLock);
+    ReadAhead *readAhead = start_read_ahead(job, NULL, 0, &stream, &nextIndex, &jobLock);
+    Decoder *decoder = start_decoder(job, NULL, 0, &stream, &nextIndex, &jobLock, readAhead, numThreads);
+    MemoryThrottle throttle;
+    memory_throttle_init(&throttle, job, numThreads);
+    
+    for (int i = 0; i < numThreads; i++) {
+        threadData[i].job = job;
+        threadData[i].stream = &stream;
+        threadData[i].nextImageIndex = &nextIndex;
+        threadData[i].deferred = &deferredUnused;
+        threadData[i].deferredCount = &deferredCount;
+        threadData[i].lock = &jobLock;
+        threadData[i].workerIndex = i;
+        threadData[i].throttle = &throttle;
+        threadData[i].governor = governor;
+        threadData[i].readAhead = readAhead;
+        threadData[i].decoder = decoder;
+        threadData[i].workerCount = numThreads;
+        threadData[i].writer = writer;
+        pthread_create(&threads[i], NULL, image_worker, &threadData[i]);
+    }
+    
+    // Read entries as they arrive; workers start on the first one
+    char path[1024];
+    int len;
+    while ((len = read_list_entry(input, delimiter, path, sizeof(path))) >= 0) {
+        if (job->status == JOB_STOPPING || job->status == JOB_STOPPED) break;
+        if (len == 0 || !is_supported_image(path_basename(path))) continue;
+        if (shardCount > 1 && hash_name(path) % (unsigned int)shardCount != (unsigned int)shardIndex) continue;
+        
+        char *outputName = NULL;
+        if (claim_stream_output(&stream, &outputs, path, &outputName) != 0) break;
+        char *copy = strdup(path);
+        if (!copy) {
+            free(outputName);
+            break;
+        }
+        pthread_mutex_lock(&jobLock);
+        if (stream.count >= stream.capacity) {
+            char **grownNames = (char **)realloc(stream.outputNames, stream.capacity * 2 * sizeof(char *));
+            if (grownNames) stream.outputNames = grownNames;
+            char **grown = grownNames ? (char **)realloc(stream.paths, stream.capacity * 2 * sizeof(char *)) : NULL;
+            if (!grown) {
+                pthread_mutex_unlock(&jobLock);
+                free(outputName);
+                free(copy);
+                break;
+            }
+            stream.paths = grown;
+            stream.capacity *= 2;
+        }
+        stream.outputNames[stream.count] = outputName;
+        stream.paths[stream.count++] = copy;
+        job->totalFiles = stream.count;
+        pthread_mutex_unlock(&jobLock);
+        
+        char quotedFile[1100];
+        emit_event(job, "image_queued", "\"file\":%s", json_quote(quotedFile, sizeof(quotedFile), path));
+    }
+    
+    pthread_mutex_lock(&jobLock);
+    stream.closed = 1;
+    pthread_mutex_unlock(&jobLock);
+    
+    // Wait for all threads to finish
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    tail_job_end();
+    report_encoder_setup(threadData, numThreads);
+    report_shrink(job, threadData, numThreads);
+    stop_cpu_governor(governor);
+    stop_decoder(decoder);
+    stop_read_ahead(readAhead);
+    stop_writer(writer);
+
+    free(threads);
+    free(threadData);
+    pthread_mutex_destroy(&jobLock);
+    
+    for (int i = 0; i < stream.count; i++) {
+        free(stream.paths[i]);
+        free(stream.outputNames[i]);
+    }
+    free(stream.paths);
+    free(stream.outputNames);
+    free(outputs.slots);
+    
+    if (job->status == JOB_STOPPING) {
+        job->status = JOB_STOPPED;
+    } else if (job->status != JOB_STOPPED) {
+        job->status = JOB_COMPLETED;
+    }
+    report_job_finished(job, NULL);
+    
+#ifndef _WIN32
+    vips_cache_drop_all();
+#endif
+    release_heap_memory();
+    
+    printf("Job finished (status %d): %d streamed images\n", job->status, job->totalFiles);
+    return 0;
+}
+
 char* pick_folder_dialog(void) {
     char *path = (char *)malloc(1024);
     if (!path) return NULL;
@@ -672,6 +4931,19 @@ char* pick_folder_dialog(void) {
     return path;
 }
 
+void processor_get_vips_stats(VipsMemoryStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!vips_initialized) return;
+    stats->trackedBytes = (long long)vips_tracked_get_mem();
+    stats->trackedPeak = (long long)vips_tracked_get_mem_highwater();
+    stats->trackedAllocs = vips_tracked_get_allocs();
+    stats->openFiles = vips_tracked_get_files();
+    stats->cacheOps = (int)vips_cache_get_size();
+    stats->cacheMaxOps = vips_cache_get_max();
+    stats->cacheMaxBytes = (long long)vips_cache_get_max_mem();
+    stats->cacheMaxFiles = vips_cache_get_max_files();
+}
+
 long long get_process_ram_usage(void) {
 #ifdef _WIN32
     PROCESS_MEMORY_COUNTERS pmc;
@@ -692,3 +4964,187 @@ long long get_process_ram_usage(void) {
     return (long long)RSS;
 #endif
 }
+
+// ---- Process metrics sampler (see processor.h) ----
+#define METRICS_MAX_TRACKED_THREADS 512
+
+static MetricsSample metricsRing[METRICS_HISTORY];
+static int metricsHead = 0;        // Next slot to write
+static int metricsCount = 0;
+static pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t metricsThread;
+static volatile int metricsRunning = 0;
+static int metricsIntervalMs = 500;
+
+// Storage I/O since process start
+static void process_io_bytes(long long *readBytes, long long *writeBytes) {
+    *readBytes = 0;
+    *writeBytes = 0;
+#ifdef _WIN32
+    IO_COUNTERS io;
+    if (GetProcessIoCounters(GetCurrentProcess(), &io)) {
+        *readBytes = (long long)io.ReadTransferCount;
+        *writeBytes = (long long)io.WriteTransferCount;
+    }
+#elif defined(__linux__)
+    FILE *fp = fopen("/proc/self/io", "r");
+    if (!fp) return;
+    char line[128];
+    while (fgets(line, sizeof(line), fp)) {
+        sscanf(line, "read_bytes: %lld", readBytes);
+        sscanf(line, "write_bytes: %lld", writeBytes);
+    }
+    fclose(fp);
+#endif
+}
+
+#ifdef __linux__
+typedef struct {
+    int tid;
+    long long ticks;
+} ThreadTicks;
+
+// Per-thread CPU from /proc/self/task/*/stat; returns the busiest thread's
+// % of one core since the previous call and sets *threadCount
+static float sample_thread_cpu(ThreadTicks *prev, int *prevCount, double elapsedSec, int *threadCount) {
+    ThreadTicks current[METRICS_MAX_TRACKED_THREADS];
+    int count = 0;
+    float busiest = 0;
+    long ticksPerSec = sysconf(_SC_CLK_TCK);
+    
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) {
+        *threadCount = 0;
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && count < METRICS_MAX_TRACKED_THREADS) {
+        int tid = atoi(entry->d_name);
+        if (tid <= 0) continue;
+        
+        char path[64], buf[512];
+        snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+        if (!read_line_file(path, buf, sizeof(buf))) continue;
+        
+        // Fields after "(comm)": state ... utime(14) stime(15)
+        const char *rest = strrchr(buf, ')');
+        unsigned long long utime = 0, stime = 0;
+        if (!rest || sscanf(rest + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) continue;
+        
+        current[count].tid = tid;
+        current[count].ticks = (long long)(utime + stime);
+        for (int i = 0; i < *prevCount; i++) {
+            if (prev[i].tid == tid && elapsedSec > 0 && ticksPerSec > 0) {
+                float pct = (float)((current[count].ticks - prev[i].ticks) * 100.0 / ticksPerSec / elapsedSec);
+                if (pct > busiest) busiest = pct;
+                break;
+            }
+        }
+        count++;
+    }
+    closedir(dir);
+    
+    memcpy(prev, current, count * sizeof(ThreadTicks));
+    *prevCount = count;
+    *threadCount = count;
+    return busiest;
+}
+#endif
+
+static void* metrics_thread(void *arg) {
+    (void)arg;
+    int cpus = get_cpu_count();
+    long long lastNs = get_monotonic_ns();
+    long long lastCpu = process_cpu_ns();
+    long long lastRead = 0, lastWrite = 0;
+    process_io_bytes(&lastRead, &lastWrite);
+    long long lastImages = __atomic_load_n(&imagesFinished, __ATOMIC_RELAXED);
+#ifdef __linux__
+    static ThreadTicks threadTicks[METRICS_MAX_TRACKED_THREADS];
+    int threadTicksCount = 0;
+    int ignored;
+    sample_thread_cpu(threadTicks, &threadTicksCount, 0, &ignored);
+#endif
+    
+    while (metricsRunning) {
+        processor_sleep(metricsIntervalMs);
+        if (!metricsRunning) break;
+        
+        MetricsSample sample;
+        memset(&sample, 0, sizeof(sample));
+        long long nowNs = get_monotonic_ns();
+        double elapsedSec = (double)(nowNs - lastNs) / 1e9;
+        sample.timeMs = nowNs / 1000000;
+        sample.rssBytes = get_process_ram_usage();
+        
+        long long cpu = process_cpu_ns();
+        if (elapsedSec > 0 && cpus > 0) {
+            sample.cpuPercent = (float)((double)(cpu - lastCpu) / 1e9 / elapsedSec * 100.0 / cpus);
+        }
+        
+        process_io_bytes(&sample.readBytes, &sample.writeBytes);
+        if (elapsedSec > 0) {
+            sample.readBytesPerSec = (float)((sample.readBytes - lastRead) / elapsedSec);
+            sample.writeBytesPerSec = (float)((sample.writeBytes - lastWrite) / elapsedSec);
+        }
+        
+        sample.imagesDone = __atomic_load_n(&imagesFinished, __ATOMIC_RELAXED);
+        if (elapsedSec > 0) {
+            sample.imagesPerSec = (float)((sample.imagesDone - lastImages) / elapsedSec);
+        }
+        
+#ifdef __linux__
+        sample.busiestThreadPercent = sample_thread_cpu(threadTicks, &threadTicksCount, elapsedSec, &sample.threadCount);
+#endif
+        processor_get_vips_stats(&sample.vips);
+        
+        lastNs = nowNs;
+        lastCpu = cpu;
+        lastRead = sample.readBytes;
+        lastWrite = sample.writeBytes;
+        lastImages = sample.imagesDone;
+        
+        pthread_mutex_lock(&metricsLock);
+        metricsRing[metricsHead] = sample;
+        metricsHead = (metricsHead + 1) % METRICS_HISTORY;
+        if (metricsCount < METRICS_HISTORY) metricsCount++;
+        pthread_mutex_unlock(&metricsLock);
+    }
+    return NULL;
+}
+
+int processor_metrics_start(int intervalMs) {
+    if (metricsRunning) return 1;
+    metricsIntervalMs = intervalMs > 50 ? intervalMs : 50;
+    metricsRunning = 1;
+    if (pthread_create(&metricsThread, NULL, metrics_thread, NULL) != 0) {
+        metricsRunning = 0;
+        return 0;
+    }
+    return 1;
+}
+
+void processor_metrics_stop(void) {
+    if (!metricsRunning) return;
+    metricsRunning = 0;
+    pthread_join(metricsThread, NULL);
+}
+
+int processor_metrics_latest(MetricsSample *out) {
+    pthread_mutex_lock(&metricsLock);
+    int have = metricsCount > 0;
+    if (have) *out = metricsRing[(metricsHead + METRICS_HISTORY - 1) % METRICS_HISTORY];
+    pthread_mutex_unlock(&metricsLock);
+    return have;
+}
+
+int processor_metrics_history(MetricsSample *out, int max) {
+    pthread_mutex_lock(&metricsLock);
+    int n = metricsCount < max ? metricsCount : max;
+    int start = (metricsHead + METRICS_HISTORY - n) % METRICS_HISTORY;
+    for (int i = 0; i < n; i++) {
+        out[i] = metricsRing[(start + i) % METRICS_HISTORY];
+    }
+    pthread_mutex_unlock(&metricsLock);
+    return n;
+}
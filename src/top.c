@@ -0,0 +1,279 @@
+/*
+ * Image Compressor - compressor-top
+ * Live view of a running compressor from its shared-memory stats (stats.h).
+ * Read-only: never blocks or slows down the process it watches.
+ *
+ * Standalone: uses the JOB_* constants from processor.h and the layout from
+ * stats.h, does not link processor.c (no vips or raylib).
+ *
+ * Build (Linux):
+ *   gcc top.c -o compressor-top -lrt
+ *
+ * Usage:
+ *   compressor-top [-1] [-d SEC] [pid]
+ */
+
+#ifndef _WIN32
+    #define _GNU_SOURCE
+#endif
+
+#include "processor.h"
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <unistd.h>
+    #include <signal.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <dirent.h>
+    #include <sys/mman.h>
+#endif
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [-1] [-d SEC] [pid]\n", prog);
+    printf("\n");
+    printf("  pid        Process to watch (default: the only running one, Linux)\n");
+    printf("  -1         Print once and exit\n");
+    printf("  -d SEC     Refresh interval (default: 1)\n");
+}
+
+static long long now_unix_ms(void) {
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    ULARGE_INTEGER t;
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    return (long long)(t.QuadPart / 10000ULL) - 11644473600000LL;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+static int process_alive(int pid) {
+#ifdef _WIN32
+    HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (!h) return 0;
+    int alive = WaitForSingleObject(h, 0) == WAIT_TIMEOUT;
+    CloseHandle(h);
+    return alive;
+#else
+    return kill(pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+// Map a process's stats segment read-only
+// Returns NULL if it doesn't exist or has another layout version
+static const StatsRegion* stats_attach(int pid) {
+    char name[96];
+    const StatsRegion *region = NULL;
+#ifdef _WIN32
+    snprintf(name, sizeof(name), "Local\\%s%d", STATS_SHM_PREFIX, pid);
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (!mapping) return NULL;
+    region = (const StatsRegion *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(StatsRegion));
+    CloseHandle(mapping);      // The view keeps the mapping alive
+    if (!region) return NULL;
+#else
+    snprintf(name, sizeof(name), "/%s%d", STATS_SHM_PREFIX, pid);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+    void *mapped = mmap(NULL, sizeof(StatsRegion), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return NULL;
+    region = (const StatsRegion *)mapped;
+#endif
+    if (__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+        region->version != STATS_VERSION || region->size != sizeof(StatsRegion)) {
+        fprintf(stderr, "Error: pid %d publishes stats version %u, this tool reads version %d\n",
+                pid, region->version, STATS_VERSION);
+        return NULL;
+    }
+    return region;
+}
+
+// Consistent copy of one slot (seqlock reader, see stats.h)
+// Returns: 1 on success, 0 if the writer kept it busy
+static int read_slot(const volatile unsigned int *seq, const void *slot, void *out, size_t size) {
+    for (int tries = 0; tries < 1000; tries++) {
+        unsigned int before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        if (before & 1) continue;
+        memcpy(out, slot, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(seq, __ATOMIC_RELAXED) == before) return 1;
+    }
+    return 0;
+}
+
+#ifdef __linux__
+// Find the single live process publishing stats (/dev/shm listing)
+// Segments left behind by killed processes are skipped (the next compressor
+// to start removes them)
+// Returns: pid, 0 if none, -1 if several (they are listed)
+static int find_publisher(void) {
+    DIR *dir = opendir("/dev/shm");
+    if (!dir) return 0;
+    int found = 0, count = 0;
+    struct dirent *entry;
+    size_t prefixLen = strlen(STATS_SHM_PREFIX);
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, STATS_SHM_PREFIX, prefixLen) != 0) continue;
+        int pid = atoi(entry->d_name + prefixLen);
+        if (pid <= 0) continue;
+        if (!process_alive(pid)) continue;
+        if (count == 1) fprintf(stderr, "Several compressors are running, pick one:\n  %d\n", found);
+        if (count >= 1) fprintf(stderr, "  %d\n", pid);
+        found = pid;
+        count++;
+    }
+    closedir(dir);
+    return count > 1 ? -1 : found;
+}
+#endif
+
+static const char* status_name(int status) {
+    switch (status) {
+        case JOB_PENDING:    return "pending";
+        case JOB_PROCESSING: return "processing";
+        case JOB_COMPLETED:  return "done";
+        case JOB_ERROR:      return "error";
+        case JOB_STOPPED:    return "stopped";
+        case JOB_PAUSED:     return "paused";
+        case JOB_STOPPING:   return "stopping";
+        default:             return "?";
+    }
+}
+
+static const char* worker_state_name(int state) {
+    switch (state) {
+        case STATS_WORKER_IDLE:     return "idle";
+        case STATS_WORKER_LOADING:  return "loading";
+        case STATS_WORKER_ENCODING: return "encoding";
+        case STATS_WORKER_WRITING:  return "writing";
+        default:                    return "?";
+    }
+}
+
+// Human-readable size into buf
+static const char* format_bytes(char *buf, size_t size, long long bytes) {
+    if (bytes >= 1024LL * 1024 * 1024) snprintf(buf, size, "%.2f GB", (double)bytes / (1024.0 * 1024.0 * 1024.0));
+    else if (bytes >= 1024LL * 1024) snprintf(buf, size, "%.1f MB", (double)bytes / (1024.0 * 1024.0));
+    else snprintf(buf, size, "%lld KB", bytes / 1024);
+    return buf;
+}
+
+static void draw(const StatsRegion *region, int clear) {
+    static long long lastWritten[STATS_MAX_JOBS], lastWrittenMs[STATS_MAX_JOBS];
+    long long now = now_unix_ms();
+    char rss[32], in[32], out[32];
+
+    if (clear) printf("\033[H\033[2J");
+    printf("compressor-top  pid %d  RSS %s  updated %.1fs ago\n\n", region->pid,
+           format_bytes(rss, sizeof(rss), region->rssBytes),
+           region->updatedMs ? (double)(now - region->updatedMs) / 1000.0 : 0.0);
+
+    int untracked = 0;          // Workers beyond STATS_MAX_WORKERS
+    printf("JOB  STATUS       DONE/TOTAL  FAILED  QUEUE  ACTIVE  IN -> OUT              SAVED  IMG/S  WRITE Q  W MB/S  FOLDER\n");
+    for (int i = 0; i < STATS_MAX_JOBS; i++) {
+        StatsJob job;
+        if (!read_slot(&region->jobs[i].seq, (const void *)&region->jobs[i], &job, sizeof(job))) continue;
+        if (job.startedMs == 0) continue;
+        job.folder[sizeof(job.folder) - 1] = '\0';
+        if (job.inUse) untracked += job.untrackedWorkers;
+
+        long long end = job.inUse ? now : job.updatedMs;
+        double seconds = (double)(end - job.startedMs) / 1000.0;
+        char traffic[64];
+        snprintf(traffic, sizeof(traffic), "%s -> %s", format_bytes(in, sizeof(in), job.bytesIn), format_bytes(out, sizeof(out), job.bytesOut));
+        
+        // Writer stage: backlog and write rate since the previous refresh
+        char writeQueue[16] = "-", writeRate[16] = "-";
+        if (job.writerActive) {
+            snprintf(writeQueue, sizeof(writeQueue), "%d", job.writeQueued);
+            double rate = 0.0;
+            if (lastWrittenMs[i] > 0 && now > lastWrittenMs[i] && job.bytesWritten >= lastWritten[i]) {
+                rate = (double)(job.bytesWritten - lastWritten[i]) / (1024.0 * 1024.0) / ((double)(now - lastWrittenMs[i]) / 1000.0);
+            }
+            snprintf(writeRate, sizeof(writeRate), "%.1f", rate);
+        }
+        lastWritten[i] = job.bytesWritten;
+        lastWrittenMs[i] = now;
+        
+        printf("%3d  %-11s %5d/%-5d  %6d  %5d  %6d  %-21s %4.0f%%  %5.1f  %7s  %6s  %s\n",
+               i, status_name(job.status), job.done, job.total, job.failed, job.queued, job.activeThreads,
+               traffic, job.bytesIn > 0 ? 100.0 - (double)job.bytesOut * 100.0 / (double)job.bytesIn : 0.0,
+               seconds > 0 ? job.done / seconds : 0.0, writeQueue, writeRate, job.folder);
+    }
+
+    printf("\nWORKER  JOB  STATE      TIME  FILE\n");
+    for (int i = 0; i < STATS_MAX_WORKERS; i++) {
+        StatsWorker worker;
+        if (!read_slot(&region->workers[i].seq, (const void *)&region->workers[i], &worker, sizeof(worker))) continue;
+        if (worker.state == STATS_WORKER_FREE) continue;
+        worker.file[sizeof(worker.file) - 1] = '\0';
+        printf("%6d  %3d  %-9s %5.1fs  %s\n", i, worker.job, worker_state_name(worker.state),
+               (double)(now - worker.stateSinceMs) / 1000.0, worker.file);
+    }
+    if (untracked > 0) printf("(+%d workers not shown, only %d fit)\n", untracked, STATS_MAX_WORKERS);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    int pid = 0;
+    int once = 0;
+    double interval = 1.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "-1") == 0) {
+            once = 1;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            interval = atof(argv[++i]);
+            if (interval < 0.1) interval = 0.1;
+        } else if (argv[i][0] != '-' && atoi(argv[i]) > 0) {
+            pid = atoi(argv[i]);
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+#ifdef __linux__
+    if (pid == 0) pid = find_publisher();
+    if (pid < 0) return 2;
+#endif
+    if (pid == 0) {
+        fprintf(stderr, "Error: no running compressor found (pass its pid)\n");
+        return 1;
+    }
+
+    const StatsRegion *region = stats_attach(pid);
+    if (!region) {
+        fprintf(stderr, "Error: pid %d does not publish stats (compressor-cli does by default)\n", pid);
+        return 1;
+    }
+
+    while (1) {
+        draw(region, !once);
+        if (once) break;
+        if (!process_alive(pid)) {
+            printf("\nProcess %d exited.\n", pid);
+            break;
+        }
+#ifdef _WIN32
+        Sleep((DWORD)(interval * 1000));
+#else
+        usleep((useconds_t)(interval * 1000000));
+#endif
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#!/bin/bash
+# Image Compressor - several processes sharing one folder with --lease
+# Starts N compressor-cli processes on the same folder at once, plus two
+# abandoned leases (a dead pid on this host, and an expired one from another
+# host), and checks that every image is encoded exactly once, by one process,
+# with no temporary or lease files left behind.
+#
+# Usage: tests/lease_multiproc.sh <compressor-cli> <make_images> [processes] [images]
+set -euo pipefail
+
+CLI="$1"
+MAKE_IMAGES="$2"
+PROCESSES="${3:-4}"
+IMAGES="${4:-40}"
+
+# A pid that no longer exists, for an abandoned lease (before the trap: the
+# child must not inherit it)
+/bin/true & DEAD_PID=$!
+wait "$DEAD_PID"
+
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+SOURCE="$WORK/shared"
+OUTPUT="$WORK/shared (compressed)"
+mkdir -p "$SOURCE" "$OUTPUT"
+"$MAKE_IMAGES" "$SOURCE" "$IMAGES" 1600 1200
+
+# Abandoned leases: the owner is gone (reclaimed at once), or silent for longer than the TTL
+echo "$(hostname) $DEAD_PID" > "$OUTPUT/.img0000.jpg.lease"
+echo "other-host 1" > "$OUTPUT/.img0001.jpg.lease"
+touch -d '10 minutes ago' "$OUTPUT/.img0001.jpg.lease"
+
+PIDS=()
+for i in $(seq 1 "$PROCESSES"); do
+    "$CLI" --lease --lease-ttl 30 -t 2 --json-fd 3 "$SOURCE" 3> "$WORK/events$i.jsonl" > "$WORK/log$i.txt" 2>&1 &
+    PIDS+=($!)
+done
+FAILED=0
+for pid in "${PIDS[@]}"; do
+    wait "$pid" || FAILED=1
+done
+[ "$FAILED" -eq 0 ] || { echo "FAIL: a process exited with an error"; cat "$WORK"/log*.txt; exit 1; }
+
+# Every image finished once in total (a skipped image was done by someone else)
+FINISHED=$(cat "$WORK"/events*.jsonl | grep '"event":"image_finished"' | sed 's/.*"file":"\([^"]*\)".*/\1/' | sort)
+TOTAL=$(echo "$FINISHED" | grep -c . || true)
+UNIQUE=$(echo "$FINISHED" | sort -u | grep -c . || true)
+echo "$PROCESSES processes: $TOTAL images encoded, $UNIQUE distinct, of $IMAGES"
+for i in $(seq 1 "$PROCESSES"); do
+    echo "  process $i: $(grep -c '"event":"image_finished"' "$WORK/events$i.jsonl" || true) encoded"
+done
+if [ "$TOTAL" -ne "$IMAGES" ] || [ "$UNIQUE" -ne "$IMAGES" ]; then
+    echo "FAIL: images encoded twice or not at all:"
+    echo "$FINISHED" | uniq -d
+    exit 1
+fi
+
+# One output per image, nothing left half-written or claimed
+OUTPUTS=$(find "$OUTPUT" -maxdepth 1 -type f ! -name '.*' ! -name '*.part' | wc -l)
+LEFTOVERS=$(find "$OUTPUT" -maxdepth 1 \( -name '*.part' -o -name '*.lease' -o -name '*.reclaim' \) | wc -l)
+if [ "$OUTPUTS" -ne "$IMAGES" ] || [ "$LEFTOVERS" -ne 0 ]; then
+    echo "FAIL: $OUTPUTS outputs for $IMAGES images, $LEFTOVERS temporary files left:"
+    ls -a "$OUTPUT"
+    exit 1
+fi
+echo "PASS"
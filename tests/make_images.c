@@ -0,0 +1,52 @@
+/*
+ * Image Compressor - test image generator
+ * Writes synthetic JPEGs (Gaussian noise, so they neither compress to nothing
+ * nor decode instantly) for the scripts in this folder.
+ *
+ * Build (Linux):
+ *   gcc make_images.c -o make_images $(pkg-config --cflags --libs vips)
+ *
+ * Usage:
+ *   make_images <folder> <count> [width] [height]
+ */
+
+#include <vips/vips.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <folder> <count> [width] [height]\n", argv[0]);
+        return 2;
+    }
+    const char *folder = argv[1];
+    int count = atoi(argv[2]);
+    int width = argc > 3 ? atoi(argv[3]) : 1600;
+    int height = argc > 4 ? atoi(argv[4]) : 1200;
+    if (count <= 0 || width <= 0 || height <= 0) {
+        fprintf(stderr, "Error: count, width and height must be positive\n");
+        return 2;
+    }
+    if (VIPS_INIT(argv[0])) {
+        fprintf(stderr, "Error: Failed to initialize libvips\n");
+        return 1;
+    }
+
+    int rc = 0;
+    for (int i = 0; i < count && rc == 0; i++) {
+        VipsImage *noise = NULL, *pixels = NULL;
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/img%04d.jpg", folder, i);
+        if (vips_gaussnoise(&noise, width, height, "mean", 128.0, "sigma", 40.0, NULL) != 0 ||
+            vips_cast_uchar(noise, &pixels, NULL) != 0 ||
+            vips_jpegsave(pixels, path, "Q", 90, NULL) != 0) {
+            fprintf(stderr, "Error writing %s: %s\n", path, vips_error_buffer());
+            rc = 1;
+        }
+        if (pixels) g_object_unref(pixels);
+        if (noise) g_object_unref(noise);
+    }
+
+    vips_shutdown();
+    return rc;
+}
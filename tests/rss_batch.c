@@ -0,0 +1,113 @@
+/*
+ * Image Compressor - RSS across a multi-folder batch
+ * Compresses several folders one after another in one process, the way the
+ * window and the CLI do, and checks that RSS returns close to the baseline
+ * after every folder (arena cap and heap trimming, see release_heap_memory()).
+ * The baseline is taken right after processor_init(), before any image, so
+ * arenas kept by a folder can't hide in it. After each folder RSS must be
+ * back within a fixed slack of it (what libvips, libheif and the thread pools
+ * keep once) and well below that folder's peak.
+ *
+ * This file ONLY uses processor.h, never vips directly.
+ *
+ * Build (Linux):
+ *   gcc rss_batch.c ../src/processor.c -I../include -o rss_batch $(pkg-config --cflags --libs vips) -lm -lpthread -ldl -lrt
+ *
+ * Usage:
+ *   rss_batch <folder>...     (at least two; run_tests.sh generates them)
+ * Exit code: 0 = RSS came back every time, 1 = it did not, 2 = bad usage
+ */
+
+#include "processor.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Allowed growth over the baseline once a folder is done
+#define RSS_SLACK_BYTES    (48LL * 1024 * 1024)
+#define RSS_SLACK_PERCENT  15
+// Share of a folder's peak growth that may still be held once it is done
+#define RSS_KEPT_PERCENT   50
+
+static long long peakRss = 0;
+static long long lastSampleMs = 0;
+
+// Highest RSS the metrics sampler saw since the last call
+static long long take_peak_rss(void) {
+    static MetricsSample samples[METRICS_HISTORY];
+    int count = processor_metrics_history(samples, METRICS_HISTORY);
+    long long peak = 0;
+    for (int i = 0; i < count; i++) {
+        if (samples[i].timeMs <= lastSampleMs) continue;
+        if (samples[i].rssBytes > peak) peak = samples[i].rssBytes;
+        lastSampleMs = samples[i].timeMs;
+    }
+    if (peak > peakRss) peakRss = peak;
+    return peak;
+}
+
+static int run_folder(const char *folder, const CompressionConfig *config) {
+    FolderJob *job = (FolderJob *)calloc(1, sizeof(FolderJob));
+    if (!job) return -1;
+    strncpy(job->sourcePath, folder, sizeof(job->sourcePath) - 1);
+    get_output_folder_path(job->sourcePath, job->outputPath, sizeof(job->outputPath));
+    job->config = *config;
+    job->status = JOB_PENDING;
+    process_folder(job);
+    int ok = job->status == JOB_COMPLETED && job->failedFiles == 0 && job->doneFiles > 0;
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s: %d/%d images, %d failed\n", folder, job->doneFiles, job->totalFiles, job->failedFiles);
+    }
+    free(job);
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <folder>... (at least two)\n", argv[0]);
+        return 2;
+    }
+    if (!processor_init() || !processor_metrics_start(100)) {
+        fprintf(stderr, "FAIL: cannot initialize the processor\n");
+        return 1;
+    }
+
+    int cpus = get_cpu_count();
+    CompressionConfig config;
+    memset(&config, 0, sizeof(config));
+    config.quality = 55;
+    config.speed = 9;
+    config.threads = cpus > 1 ? cpus : 2;       // Every worker gets its own arena
+    config.cpuLimit = 100;
+
+    int rc = 0;
+    long long baseline = get_process_ram_usage();
+    take_peak_rss();
+    long long limit = baseline + RSS_SLACK_BYTES + baseline * RSS_SLACK_PERCENT / 100;
+    printf("Baseline after init: %lld MB (limit %lld MB)\n", baseline / (1024 * 1024), limit / (1024 * 1024));
+    
+    for (int i = 1; i < argc; i++) {
+        if (run_folder(argv[i], &config) != 0) rc = 1;
+        long long rss = get_process_ram_usage();
+        long long peak = take_peak_rss();
+        if (peak < rss) peak = rss;         // Shorter than a sampling interval
+        if (peak > peakRss) peakRss = peak;
+        printf("%s: RSS %lld MB after, peak %lld MB during\n", argv[i], rss / (1024 * 1024), peak / (1024 * 1024));
+        if (rss > limit) {
+            fprintf(stderr, "FAIL: RSS stayed at %lld MB after %s (baseline %lld MB)\n",
+                    rss / (1024 * 1024), argv[i], baseline / (1024 * 1024));
+            rc = 1;
+        }
+        // A folder that barely grew RSS says nothing about what is given back
+        if (peak - baseline > RSS_SLACK_BYTES && rss - baseline > (peak - baseline) * RSS_KEPT_PERCENT / 100) {
+            fprintf(stderr, "FAIL: RSS only fell from %lld MB to %lld MB after %s (baseline %lld MB)\n",
+                    peak / (1024 * 1024), rss / (1024 * 1024), argv[i], baseline / (1024 * 1024));
+            rc = 1;
+        }
+    }
+
+    printf("%s: peak %lld MB, baseline %lld MB\n", rc == 0 ? "PASS" : "FAIL", peakRss / (1024 * 1024), baseline / (1024 * 1024));
+    processor_metrics_stop();
+    processor_shutdown();
+    return rc;
+}
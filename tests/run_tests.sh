@@ -0,0 +1,67 @@
+#!/bin/bash
+# Image Compressor - tests (Linux)
+# Builds the test programs against the libvips that build_linux.sh fetched
+# (or the system one) and runs them on generated images in a temporary folder.
+#
+# Usage: tests/run_tests.sh
+set -euo pipefail
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+BUILD_DIR="$ROOT/build/tests"
+LIBVIPS_DIR="$ROOT/external/libvips"
+mkdir -p "$BUILD_DIR"
+
+export PKG_CONFIG_PATH="$LIBVIPS_DIR/lib/pkgconfig:${PKG_CONFIG_PATH:-}"
+export LD_LIBRARY_PATH="$LIBVIPS_DIR/lib:${LD_LIBRARY_PATH:-}"
+VIPS_CFLAGS=$(pkg-config --cflags vips)
+VIPS_LIBS=$(pkg-config --libs vips)
+if [ -d "$LIBVIPS_DIR/include/glib-2.0" ]; then
+    VIPS_CFLAGS="$VIPS_CFLAGS -I$LIBVIPS_DIR/include/glib-2.0"
+fi
+if [ -d "$LIBVIPS_DIR/lib/glib-2.0/include" ]; then
+    VIPS_CFLAGS="$VIPS_CFLAGS -I$LIBVIPS_DIR/lib/glib-2.0/include"
+fi
+
+echo "Building tests..."
+gcc "$ROOT/tests/make_images.c" -o "$BUILD_DIR/make_images" $VIPS_CFLAGS $VIPS_LIBS -O2
+gcc "$ROOT/tests/rss_batch.c" "$ROOT/src/processor.c" -o "$BUILD_DIR/rss_batch" \
+    $VIPS_CFLAGS -I"$ROOT/include" $VIPS_LIBS -lm -lpthread -ldl -lrt -O2
+
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+FAILED=0
+
+run_test() {
+    local name="$1"
+    shift
+    echo ""
+    echo "== $name"
+    if "$@"; then
+        echo "== $name: ok"
+    else
+        echo "== $name: FAILED"
+        FAILED=1
+    fi
+}
+
+# RSS back near the baseline after each folder of a batch
+for i in 1 2 3 4 5; do
+    mkdir -p "$WORK/rss/folder$i"
+    "$BUILD_DIR/make_images" "$WORK/rss/folder$i" 12 2400 1800
+done
+run_test "RSS across folders" "$BUILD_DIR/rss_batch" "$WORK"/rss/folder{1..5}
+
+# Several processes sharing one folder with leases
+if [ -x "$ROOT/build/compressor-cli" ]; then
+    run_test "Processes sharing a folder" "$ROOT/tests/lease_multiproc.sh" "$ROOT/build/compressor-cli" "$BUILD_DIR/make_images"
+else
+    echo ""
+    echo "== Processes sharing a folder: skipped (run build_linux.sh first)"
+fi
+
+echo ""
+if [ "$FAILED" -ne 0 ]; then
+    echo "Some tests FAILED"
+    exit 1
+fi
+echo "All tests passed"